@@ -0,0 +1,238 @@
+#!/usr/bin/python
+#
+# Writes the data files the feature tests load, see README.md.
+#
+# Example usage:
+#   python gen_feature_data.py mapped /tmp/run
+#
+# The values come from a fixed linear congruential generator rather than
+# numpy, so every machine writes the same files and the expected outputs
+# stay valid.
+
+import sys, os
+import struct
+import zlib
+
+class Lcg:
+	def __init__(self, seed):
+		self.state = seed
+
+	def next(self, low, high):
+		# a value in [low, high)
+		self.state = (self.state * 6364136223846793005 + 1442695040888963407) % (1 << 64)
+		return low + (self.state >> 33) % (high - low)
+
+def writeCsv(path, dbName, tableName, columns):
+	with open(path, "w") as output_file:
+		output_file.write(",".join("{}.{}.col{}".format(dbName, tableName, i + 1) for i in range(len(columns))) + "\n")
+		for row in zip(*columns):
+			output_file.write(",".join(str(value) for value in row) + "\n")
+
+def writeColumnFile(directory, tableName, columnName, values):
+	# raw ints, the layout of column data files since the first version
+	with open(os.path.join(directory, "{}.{}.data".format(tableName, columnName)), "wb") as output_file:
+		output_file.write(struct.pack("<{}i".format(len(values)), *values))
+
+############################################################################
+# Data sets, each writes its files into the given directory
+############################################################################
+
+# db1.tbl1: 3 columns of 100000 rows, so the columns span two segments
+def generateMapped(directory):
+	rand = Lcg(1)
+	rows = 100000
+	column1 = list(range(rows))
+	column2 = [rand.next(0, 1000) for i in range(rows)]
+	column3 = [rand.next(-50000, 50000) for i in range(rows)]
+	writeCsv(os.path.join(directory, "mapped.csv"), "db1", "tbl1", [column1, column2, column3])
+
+# db1.tbl1: 2 columns of 70000 rows, so the load is logged in two chunks
+def generateLogged(directory):
+	rand = Lcg(2)
+	rows = 70000
+	column1 = list(range(rows))
+	column2 = [rand.next(0, 100) for i in range(rows)]
+	writeCsv(os.path.join(directory, "logged.csv"), "db1", "tbl1", [column1, column2])
+
+# data/: db1.tbl1 of 2 columns and 80000 rows persisted with the text
+# meta.data catalog of the first version
+def generateLegacy(directory):
+	rand = Lcg(4)
+	rows = 80000
+	data_directory = os.path.join(directory, "data")
+	os.makedirs(data_directory)
+	writeColumnFile(data_directory, "tbl1", "col1", list(range(rows)))
+	writeColumnFile(data_directory, "tbl1", "col2", [rand.next(0, 500) for i in range(rows)])
+	with open(os.path.join(data_directory, "meta.data"), "w") as output_file:
+		output_file.write("db1,1\ntbl1,2,{}\ncol1\ncol2\n".format(rows))
+
+# db1.tbl1, db1.tbl2 and db1.tbl3 of 3, 4 and 1 columns, 70000, 20000 and
+# 1000 rows, in multi1.csv to multi3.csv
+def generateMulti(directory):
+	rand = Lcg(6)
+	for number, (numColumns, rows) in enumerate([(3, 70000), (4, 20000), (1, 1000)], 1):
+		columns = [list(range(rows))]
+		for i in range(1, numColumns):
+			columns.append([rand.next(0, 10000) for j in range(rows)])
+		writeCsv(os.path.join(directory, "multi{}.csv".format(number)), "db1", "tbl{}".format(number), columns)
+
+# db1.tbl1 of 2 columns: segments1.csv fills the first segment but for 6
+# rows, segments2.csv appends 140000 rows that start mid-segment
+def generateSegments(directory):
+	rand = Lcg(7)
+	rows = 65530
+	writeCsv(os.path.join(directory, "segments1.csv"), "db1", "tbl1",
+		[list(range(rows)), [i % 97 for i in range(rows)]])
+	column1 = list(range(rows + 20, rows + 20 + 140000))
+	writeCsv(os.path.join(directory, "segments2.csv"), "db1", "tbl1",
+		[column1, [rand.next(0, 97) for i in column1]])
+
+# db1.tbl1 of 2 columns and 200000 rows, col1 rises by one every 1000 rows
+# so segments cover disjoint ranges of it, col2 is random
+def generateZones(directory):
+	rand = Lcg(8)
+	rows = 200000
+	writeCsv(os.path.join(directory, "zones.csv"), "db1", "tbl1",
+		[[i // 1000 for i in range(rows)], [rand.next(0, 1000000) for i in range(rows)]])
+
+# db1.tbl1 of 5 columns and 4 segments and 100 rows: a narrow range for
+# frame-of-reference, rising values for deltas, a constant, full-range
+# values that don't pack and a narrow negative range
+def generatePacked(directory):
+	rand = Lcg(9)
+	rows = 4 * 65536 + 100
+	column2 = []
+	value = -1000
+	for i in range(rows):
+		value += rand.next(0, 4)
+		column2.append(value)
+	writeCsv(os.path.join(directory, "packed.csv"), "db1", "tbl1",
+		[[rand.next(1000000, 1000100) for i in range(rows)], column2, [42] * rows,
+		[rand.next(-2147483647, 2147483647) for i in range(rows)], [rand.next(-5000, -4000) for i in range(rows)]])
+
+# db1.tbl1 of 2 columns: edges.csv mixes line endings, blanks, signs,
+# blank lines and the int extremes and has no final newline,
+# malformed.csv breaks off at its second row
+def generateEdges(directory):
+	with open(os.path.join(directory, "edges.csv"), "w", newline="") as output_file:
+		output_file.write("db1.tbl1.col1,db1.tbl1.col2\r\n1,2\r\n 3, +4\r\n\r\n-2147483648,2147483647\n\n5,-6")
+	with open(os.path.join(directory, "malformed.csv"), "w") as output_file:
+		output_file.write("db1.tbl1.col1,db1.tbl1.col2\n7,8\n9,x\n10,11\n")
+
+# db1.tbl1 of 4 columns: wide.csv has 300000 rows, about 8MB, and
+# wide_malformed.csv has 200000 rows of which row 150000 is malformed
+def generateWide(directory):
+	rand = Lcg(12)
+	rows = 300000
+	columns = [list(range(rows))] + [[rand.next(-1000000, 1000000) for i in range(rows)] for j in range(3)]
+	writeCsv(os.path.join(directory, "wide.csv"), "db1", "tbl1", columns)
+	with open(os.path.join(directory, "wide_malformed.csv"), "w") as output_file:
+		output_file.write("db1.tbl1.col1,db1.tbl1.col2,db1.tbl1.col3,db1.tbl1.col4\n")
+		for i in range(200000):
+			output_file.write("{0},{0},{0},{1}\n".format(rows + i, "x" if i == 150000 else i))
+
+# db1.tbl1 of 2 columns and 1300000 rows in streamed/streamed.csv, about
+# 22MB, more than the server takes in one piece
+def generateStreamed(directory):
+	rand = Lcg(13)
+	rows = 1300000
+	os.makedirs(os.path.join(directory, "streamed"))
+	writeCsv(os.path.join(directory, "streamed", "streamed.csv"), "db1", "tbl1",
+		[list(range(rows)), [rand.next(0, 100000000) for i in range(rows)]])
+
+def columnarFile(dbName, tableName, names, columns):
+	# the layout of columnar.h: header, column descriptions, then the values
+	data = struct.pack("<IIQQ64s64s", 0x4c4f4343, 1, len(columns[0]), len(columns),
+		dbName.encode(), tableName.encode())
+	for name in names:
+		data += struct.pack("<64sII", name.encode(), 1, 0)
+	for values in columns:
+		data += struct.pack("<{}i".format(len(values)), *values)
+	return data
+
+# db1.tbl1 of 3 columns as columnar files of 1000 rows: columnar.col with
+# the columns in the order col3, col1, col2 and truncated.col, which is cut
+# short in its last column
+def generateColumnar(directory):
+	rows = 1000
+	data = columnarFile("db1", "tbl1", ["col3", "col1", "col2"],
+		[[-i for i in range(rows)], list(range(200000, 200000 + rows)), [i % 10 for i in range(rows)]])
+	with open(os.path.join(directory, "columnar.col"), "wb") as output_file:
+		output_file.write(data)
+	with open(os.path.join(directory, "truncated.col"), "wb") as output_file:
+		output_file.write(data[:-10])
+
+# db1.tbl1 of 4 columns and 150000 rows: row numbers, a permutation of
+# them, and two random columns, narrow and wide
+def generateIndexed(directory):
+	rand = Lcg(16)
+	rows = 150000
+	writeCsv(os.path.join(directory, "indexed.csv"), "db1", "tbl1",
+		[list(range(rows)), [i * 7919 % rows for i in range(rows)],
+		[rand.next(0, 5000) for i in range(rows)], [rand.next(-100000, 100000) for i in range(rows)]])
+
+# data/: the db1.tbl1 of "legacy" persisted with a version 1 binary
+# catalog, whose columns have no statistics
+def generateCatalogV1(directory):
+	rand = Lcg(4)
+	rows = 80000
+	data_directory = os.path.join(directory, "data")
+	os.makedirs(data_directory)
+	writeColumnFile(data_directory, "tbl1", "col1", list(range(rows)))
+	writeColumnFile(data_directory, "tbl1", "col2", [rand.next(0, 500) for i in range(rows)])
+	# the layout of catalog.h, up to the statistics of each column
+	body = struct.pack("<64sQQ", b"tbl1", rows, 2)
+	for name in [b"col1", b"col2"]:
+		body += struct.pack("<64sIIIIQQQQQ", name, 1, 0, 0, 0, 0, 0, 0, 0, 0)
+	size = 104 + len(body)
+	checked = struct.pack("<QQQ64s", size, 0, 1, b"db1") + body
+	with open(os.path.join(data_directory, "catalog.data"), "wb") as output_file:
+		output_file.write(struct.pack("<IIII", 0x35363143, 1, zlib.crc32(checked) & 0xffffffff, 0) + checked)
+
+# db1.tbl1 of 3 columns and 200003 rows, a length no vector width divides:
+# row numbers, a narrow range and full-range values that include the int
+# extremes
+def generateScan(directory):
+	rand = Lcg(19)
+	rows = 200003
+	column3 = [rand.next(-32768, 32768) * 65536 + rand.next(0, 65536) for i in range(rows)]
+	for i in range(0, rows, 9973):
+		column3[i] = -2147483648 if i % 2 else 2147483647
+	writeCsv(os.path.join(directory, "scan.csv"), "db1", "tbl1",
+		[list(range(rows)), [rand.next(-100, 100) for i in range(rows)], column3])
+
+# inserts.dsl: 70000 single-row inserts into db1.tbl1 of 2 columns, more
+# than an index keeps waiting, with a select every 5000 rows so they reach
+# the server in separate batches
+def generatePending(directory):
+	rand = Lcg(20)
+	rows = 70000
+	with open(os.path.join(directory, "inserts.dsl"), "w") as output_file:
+		for i in range(rows):
+			output_file.write("relational_insert(db1.tbl1,{},{})\n".format(i, rand.next(0, 20000)))
+			if i % 5000 == 4999:
+				output_file.write("s0=select(db1.tbl1.col1,0,1)\n")
+
+DATA_SETS = {
+	"mapped": generateMapped,
+	"logged": generateLogged,
+	"legacy": generateLegacy,
+	"multi": generateMulti,
+	"segments": generateSegments,
+	"zones": generateZones,
+	"packed": generatePacked,
+	"edges": generateEdges,
+	"wide": generateWide,
+	"streamed": generateStreamed,
+	"columnar": generateColumnar,
+	"indexed": generateIndexed,
+	"catalog_v1": generateCatalogV1,
+	"scan": generateScan,
+	"pending": generatePending,
+}
+
+if __name__ == "__main__":
+	if len(sys.argv) != 3 or sys.argv[1] not in DATA_SETS:
+		sys.stderr.write("usage: gen_feature_data.py <{}> <directory>\n".format("|".join(sorted(DATA_SETS))))
+		sys.exit(1)
+	DATA_SETS[sys.argv[1]](sys.argv[2])
@@ -0,0 +1,215 @@
+#! /bin/bash
+
+#### Feature test runner                   ####
+# Runs the tests in this directory against a built server and client and
+# checks every step's output against its .exp file.
+#
+# usage: ./run_feature_tests.sh [test_dir ...]
+#   with no arguments every test directory is run, in order
+#
+# environment:
+#   SRC_DIR   source tree whose server and client are tested (default ../../src)
+#   WORK_DIR  where data, builds and outputs go (default a fresh temporary dir)
+#
+# A test is a directory holding steps 1.dsl, 2.dsl, ... that are fed to the
+# client in turn, with the expected output of step N in N.exp (no N.exp means
+# no output is expected). Every test starts without a database. The server is
+# started before a step whenever it isn't running, so a step ending with
+# shutdown makes the next one start from what was persisted.
+#
+# Lines of a step starting with "-- @" are directives for this script, the
+# server skips them like any other comment:
+#   -- @build FLAG ...  (first step) builds the tree with -DFLAG ... for this test
+#   -- @data NAME ...   runs gen_feature_data.py to write data set NAME first
+#   -- @feed FILE       also sends FILE, written by @data, after the step
+#   -- @pause SECONDS   waits before sending the rest of the step, in the
+#                       same client session
+#   -- @cut-log BYTES   cuts BYTES off the newest log segment before the step
+#   -- @sleep SECONDS   waits after the step
+#   -- @kill            kills the server with SIGKILL after the step (and the wait)
+
+
+TESTS_DIR=$(cd "$(dirname "$0")" && pwd)
+SRC_DIR=$(cd "${SRC_DIR:-$TESTS_DIR/../../src}" && pwd)
+WORK_DIR=${WORK_DIR:-$(mktemp -d)}
+SOCKET=/tmp/cs165_unix_socket
+
+GRN="\e[42m"
+RED="\e[31m"
+RST="\e[0m"
+
+SERVER_PID=
+
+# Same cleaning as infra_scripts/verify_output_standalone.sh: drop colors,
+# comments and blank lines, and round decimals to 2 digits
+function clean_output
+{
+    sed -r 's/\x1B\[([0-9]{1,2}(;[0-9]{1,2})?)?[m|K]//g' "$1" | awk '{sub("--.*$","",$0);print;}' | sed -e 's/^[[:space:]]*//g;s/[[:space:]]*$//g' | grep '[^[:blank:]]' | awk -F, '{  if ($1 ~ /\./) { printf("%0.2f",$1); } else { printf("%s",$1); } for(i=2;i<=NF;i++){ if ($i ~ /\./) { printf(",%0.2f",$i) } else { printf(",%s",$i); } } printf("\n"); }'
+}
+
+# Values of a directive in a step, one line per occurrence
+function directive
+{
+    sed -n "s/^-- @$2[[:space:]]*//p" "$1" | tr -d '\r'
+}
+
+# Sends the lines of a step and the files it feeds, waiting at its pauses
+function send_step
+{
+    local file line
+    for file in "$@"; do
+        while IFS= read -r line || [ -n "$line" ]; do
+            if [[ "$line" == "-- @pause "* ]]; then
+                sleep "${line#-- @pause }"
+            else
+                printf '%s\n' "$line"
+            fi
+        done < "$file"
+    done
+}
+
+# Builds the tree with the given flags once, echoes the directory of the binaries
+function build_variant
+{
+    if [ -z "$1" ]; then
+        echo "$SRC_DIR"
+        return
+    fi
+    local dir="$WORK_DIR/builds/$(echo "$1" | tr -c 'A-Za-z0-9_=\n' '_')"
+    if [ ! -x "$dir/server" ]; then
+        mkdir -p "$dir"
+        cp -r "$SRC_DIR"/*.c "$SRC_DIR"/include "$SRC_DIR"/Makefile "$dir"
+        local cflags=""
+        for flag in $1; do
+            cflags="$cflags -D$flag"
+        done
+        make -C "$dir" CFLAGS="$cflags" > "$dir/build.log" 2>&1 || return 1
+    fi
+    echo "$dir"
+}
+
+function start_server
+{
+    rm -f "$SOCKET"
+    (cd "$RUN_DIR" && exec "$BIN_DIR/server" >> server.log 2>&1) &
+    SERVER_PID=$!
+    for i in $(seq 300); do
+        if [ -S "$SOCKET" ] || ! kill -0 $SERVER_PID 2> /dev/null; then
+            # The socket is bound just before the server listens on it
+            sleep 0.2
+            return
+        fi
+        sleep 0.1
+    done
+}
+
+# Waits for the server to exit after a shutdown, kills it if it hangs
+function wait_server
+{
+    for i in $(seq 600); do
+        if ! kill -0 $SERVER_PID 2> /dev/null; then
+            wait $SERVER_PID 2> /dev/null
+            SERVER_PID=
+            return 0
+        fi
+        sleep 0.1
+    done
+    stop_server
+    return 1
+}
+
+function stop_server
+{
+    if [ -n "$SERVER_PID" ]; then
+        kill -9 $SERVER_PID 2> /dev/null
+        wait $SERVER_PID 2> /dev/null
+        SERVER_PID=
+    fi
+}
+
+# Runs one test directory, returns non-zero if a step failed
+function run_test
+{
+    local test_dir=$1
+    local name=$(basename "$test_dir")
+    RUN_DIR="$WORK_DIR/runs/$name"
+    rm -rf "$RUN_DIR"
+    mkdir -p "$RUN_DIR"
+
+    BIN_DIR=$(build_variant "$(directive "$test_dir/1.dsl" build)")
+    if [ $? -ne 0 ]; then
+        echo -e "Failure! $name doesn't build. [${RED}fail${RST}]"
+        return 1
+    fi
+
+    local failed=0
+    local step=1
+    while [ -f "$test_dir/$step.dsl" ]; do
+        local dsl="$test_dir/$step.dsl"
+        for data in $(directive "$dsl" data); do
+            python3 "$TESTS_DIR/gen_feature_data.py" "$data" "$RUN_DIR" || failed=1
+        done
+        for bytes in $(directive "$dsl" cut-log); do
+            local log=$(ls "$RUN_DIR"/data/wal.*.log 2> /dev/null | tail -n 1)
+            truncate -s -"$bytes" "$log"
+        done
+
+        if [ -z "$SERVER_PID" ] || ! kill -0 $SERVER_PID 2> /dev/null; then
+            start_server
+        fi
+        local feeds=$(directive "$dsl" feed)
+        if ! (cd "$RUN_DIR" && send_step "$dsl" $feeds | "$BIN_DIR/client" > "$step.out" 2> "$step.err"); then
+            echo -e "Failure! $name step $step: the client failed, see $RUN_DIR/$step.err [${RED}fail${RST}]"
+            failed=1
+        fi
+
+        if grep -q '^shutdown' "$dsl" && ! wait_server; then
+            echo -e "Failure! $name step $step doesn't shut down. [${RED}fail${RST}]"
+            failed=1
+        fi
+        for seconds in $(directive "$dsl" sleep); do
+            sleep "$seconds"
+        done
+        if grep -q '^-- @kill' "$dsl"; then
+            stop_server
+        fi
+
+        local exp="$test_dir/$step.exp"
+        clean_output "$RUN_DIR/$step.out" > "$RUN_DIR/$step.cleaned.out"
+        if [ -f "$exp" ]; then
+            diff -B -w "$RUN_DIR/$step.cleaned.out" "$exp" > "$RUN_DIR/$step.diff"
+        else
+            diff -B -w "$RUN_DIR/$step.cleaned.out" /dev/null > "$RUN_DIR/$step.diff"
+        fi
+        if [ $? -ne 0 ]; then
+            echo -e "Failure! $name step $step differs, see $RUN_DIR/$step.diff [${RED}fail${RST}]"
+            failed=1
+        fi
+        step=$((step + 1))
+    done
+    stop_server
+
+    if [ $failed -eq 0 ]; then
+        echo -e "Success! $name passes! [${GRN}ok${RST}]"
+    fi
+    return $failed
+}
+
+
+if [ $# -eq 0 ]; then
+    set -- $(ls -d "$TESTS_DIR"/*/ | sort)
+fi
+
+PASSED=0
+FAILED=0
+for test_dir in "$@"; do
+    test_dir=$(cd "$test_dir" && pwd)
+    if run_test "$test_dir"; then
+        PASSED=$((PASSED + 1))
+    else
+        FAILED=$((FAILED + 1))
+    fi
+done
+
+echo "$PASSED passed, $FAILED failed, outputs in $WORK_DIR"
+[ $FAILED -eq 0 ]
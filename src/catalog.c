@@ -0,0 +1,325 @@
+/*
+ * This file reads and writes the binary catalog described in catalog.h.
+ */
+
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "catalog.h"
+#include "cs165_api.h"
+#include "utils.h"
+
+// The checksum covers the header from this field to the end of the file
+#define CHECKSUM_START offsetof(CatalogHeader, size)
+
+
+CatalogTable* catalog_first_table(CatalogHeader* catalog) {
+    return (CatalogTable*) (catalog + 1);
+}
+
+CatalogColumn* catalog_columns(CatalogTable* table) {
+    return (CatalogColumn*) (table + 1);
+}
+
+CatalogTable* catalog_next_table(CatalogTable* table) {
+    return (CatalogTable*) (catalog_columns(table) + table->col_count);
+}
+
+
+static uint32_t catalog_checksum(CatalogHeader* catalog) {
+    return crc32((char*) catalog + CHECKSUM_START, catalog->size - CHECKSUM_START, 0);
+}
+
+/*
+ * Checks that every table and column entry lies inside the catalog, given
+ * the size of its column entries.
+ */
+static bool catalog_is_consistent(CatalogHeader* catalog, size_t column_size) {
+    char* end = (char*) catalog + catalog->size;
+    CatalogTable* table = catalog_first_table(catalog);
+    for (uint64_t i = 0; i < catalog->num_tables; i++) {
+        if ((char*) (table + 1) > end ||
+            table->col_count > (uint64_t) (end - (char*) (table + 1)) / column_size) {
+            return false;
+        }
+        table = (CatalogTable*) ((char*) (table + 1) + table->col_count * column_size);
+    }
+    return (char*) table == end;
+}
+
+
+/*
+ * Builds a catalog from one of version 1, whose column entries end before
+ * the statistics. Those are left empty, to be rebuilt on loading.
+ */
+static CatalogHeader* upgrade_catalog_v1(CatalogHeader* old) {
+    size_t old_column_size = offsetof(CatalogColumn, stats);
+    size_t size = sizeof(CatalogHeader);
+    CatalogTable* old_table = catalog_first_table(old);
+    for (uint64_t i = 0; i < old->num_tables; i++) {
+        size += sizeof(CatalogTable) + old_table->col_count * sizeof(CatalogColumn);
+        old_table = (CatalogTable*) ((char*) (old_table + 1) + old_table->col_count * old_column_size);
+    }
+
+    CatalogHeader* header = calloc(1, size);
+    *header = *old;
+    header->version = CATALOG_VERSION;
+    header->size = size;
+    old_table = catalog_first_table(old);
+    CatalogTable* table = catalog_first_table(header);
+    for (uint64_t i = 0; i < old->num_tables; i++) {
+        *table = *old_table;
+        const char* old_column = (const char*) (old_table + 1);
+        CatalogColumn* columns = catalog_columns(table);
+        for (uint64_t j = 0; j < table->col_count; j++, old_column += old_column_size) {
+            memcpy(&columns[j], old_column, old_column_size);
+        }
+        old_table = (CatalogTable*) old_column;
+        table = catalog_next_table(table);
+    }
+    return header;
+}
+
+
+/*
+ * Builds a catalog from the text meta.data file of earlier versions.
+ */
+static Status read_legacy_catalog(FILE* fp, CatalogHeader** catalog) {
+    Status ret_status;
+    char buf[BUF_SIZE];
+
+    if (fgets(buf, BUF_SIZE, fp) == NULL) {
+        log_err("Empty metadata file\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+
+    size_t capacity = sizeof(CatalogHeader);
+    CatalogHeader* header = calloc(1, capacity);
+    char* line = buf;
+    copy_name(header->db_name, strsep(&line, ","));
+    char* table_count = strsep(&line, ",");
+    header->num_tables = table_count ? strtoull(table_count, NULL, 10) : 0;
+    header->checkpoint_lsn = line ? strtoull(line, NULL, 10) : 0;
+    size_t size = sizeof(CatalogHeader);
+
+    for (uint64_t i = 0; i < header->num_tables; i++) {
+        if (fgets(buf, BUF_SIZE, fp) == NULL) {
+            free(header);
+            log_err("Truncated metadata file\n");
+            ret_status.code = ERROR;
+            return ret_status;
+        }
+        line = buf;
+        char* table_name = strsep(&line, ",");
+        char* column_count = strsep(&line, ",");
+        char* table_length = strsep(&line, ",");
+        uint64_t num_columns = column_count ? strtoull(column_count, NULL, 10) : 0;
+
+        size_t needed = size + sizeof(CatalogTable) + num_columns * sizeof(CatalogColumn);
+        if (needed > capacity) {
+            capacity = needed * 2;
+            header = realloc(header, capacity);
+        }
+        CatalogTable* table = (CatalogTable*) ((char*) header + size);
+        memset(table, 0, needed - size);
+        copy_name(table->name, table_name);
+        table->col_count = num_columns;
+        table->length = table_length ? strtoull(table_length, NULL, 10) : 0;
+
+        CatalogColumn* columns = catalog_columns(table);
+        for (uint64_t j = 0; j < num_columns; j++) {
+            if (fgets(buf, BUF_SIZE, fp) == NULL) {
+                free(header);
+                log_err("Truncated metadata file\n");
+                ret_status.code = ERROR;
+                return ret_status;
+            }
+            copy_name(columns[j].name, trim_newline(buf));
+            columns[j].data_type = INT;
+        }
+        size = needed;
+    }
+
+    header->magic = CATALOG_MAGIC;
+    header->version = CATALOG_VERSION;
+    header->size = size;
+    *catalog = header;
+    ret_status.code = OK;
+    return ret_status;
+}
+
+
+Status read_catalog(CatalogHeader** catalog) {
+    Status ret_status;
+    *catalog = NULL;
+
+    char path[strlen(MAINDIR) + strlen(METADATA_FILE_NAME) + 2];
+    sprintf(path, "%s/%s", MAINDIR, METADATA_FILE_NAME);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        // Fall back to the text catalog of a database persisted by an earlier version
+        char legacy_path[strlen(MAINDIR) + strlen(LEGACY_METADATA_FILE_NAME) + 2];
+        sprintf(legacy_path, "%s/%s", MAINDIR, LEGACY_METADATA_FILE_NAME);
+        FILE* fp = fopen(legacy_path, "r");
+        if (!fp) {
+            ret_status.code = OK;
+            return ret_status;
+        }
+        log_info("Migrating text catalog %s\n", legacy_path);
+        ret_status = read_legacy_catalog(fp, catalog);
+        fclose(fp);
+        return ret_status;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(CatalogHeader)) {
+        close(fd);
+        log_err("Catalog is truncated\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+
+    // The whole catalog is read at once
+    CatalogHeader* header = malloc(st.st_size);
+    ssize_t bytes = pread(fd, header, st.st_size, 0);
+    close(fd);
+    if (bytes != st.st_size) {
+        free(header);
+        log_err("Reading catalog failed\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+
+    if (header->magic != CATALOG_MAGIC) {
+        free(header);
+        log_err("Not a catalog file\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+    if (header->version != CATALOG_VERSION && header->version != 1) {
+        log_err("Unsupported catalog version %u\n", header->version);
+        free(header);
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+    size_t column_size = header->version == 1 ? offsetof(CatalogColumn, stats) : sizeof(CatalogColumn);
+    if (header->size != (uint64_t) st.st_size || catalog_checksum(header) != header->checksum ||
+        !catalog_is_consistent(header, column_size)) {
+        free(header);
+        log_err("Catalog is corrupt\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+    if (header->version == 1) {
+        log_info("Upgrading catalog from version 1\n");
+        CatalogHeader* upgraded = upgrade_catalog_v1(header);
+        free(header);
+        header = upgraded;
+    }
+
+    *catalog = header;
+    ret_status.code = OK;
+    return ret_status;
+}
+
+
+Status write_catalog(uint64_t checkpoint_lsn) {
+    Status ret_status;
+
+    // Serialize the catalog
+    size_t size = sizeof(CatalogHeader);
+    for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
+        size += sizeof(CatalogTable) + current_db->tables[tbl]->col_count * sizeof(CatalogColumn);
+    }
+    CatalogHeader* header = calloc(1, size);
+    header->magic = CATALOG_MAGIC;
+    header->version = CATALOG_VERSION;
+    header->size = size;
+    header->checkpoint_lsn = checkpoint_lsn;
+    header->num_tables = current_db->tables_size;
+    copy_name(header->db_name, current_db->name);
+
+    CatalogTable* entry = catalog_first_table(header);
+    for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
+        Table* table = current_db->tables[tbl];
+        copy_name(entry->name, table->name);
+        entry->length = table->table_length;
+        entry->col_count = table->col_count;
+
+        CatalogColumn* columns = catalog_columns(entry);
+        for (size_t col = 0; col < table->col_count; col++) {
+            Column* column = table->columns[col];
+            if (column->catalog_entry) {
+                // Unchanged since it was read, its files are still the same
+                columns[col] = *column->catalog_entry;
+                columns[col].accesses = column->accesses;
+                columns[col].index_length = column->index ? column->index->length : 0;
+                columns[col].stats = column->stats;
+                continue;
+            }
+            copy_name(columns[col].name, column->name);
+            columns[col].data_type = INT;
+            columns[col].encoding = COLUMN_ENCODING_PLAIN;
+            for (size_t seg = 0; seg < column->packed_persisted; seg++) {
+                if (column->packed[seg]) {
+                    columns[col].encoding = COLUMN_ENCODING_PACKED;
+                    break;
+                }
+            }
+            columns[col].index_type = column->index ? column->index->type : INDEX_NONE;
+            columns[col].index_flags = column->index ? column->index->flags : 0;
+            columns[col].index_length = column->index ? column->index->length : 0;
+            columns[col].sealed_segments = column->sealed_segments;
+            columns[col].accesses = column->accesses;
+            columns[col].stats = column->stats;
+        }
+        entry = catalog_next_table(entry);
+    }
+    header->checksum = catalog_checksum(header);
+
+    // Write it next to the old catalog and swap it in
+    char path[strlen(MAINDIR) + strlen(METADATA_FILE_NAME) + 2];
+    sprintf(path, "%s/%s", MAINDIR, METADATA_FILE_NAME);
+    char tmp_path[strlen(path) + 5];
+    sprintf(tmp_path, "%s.tmp", path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        free(header);
+        log_err("Unable to create catalog file\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+    ssize_t bytes = write(fd, header, size);
+    free(header);
+    if (bytes != (ssize_t) size || fsync(fd) == -1) {
+        close(fd);
+        log_err("Writing catalog failed\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+    close(fd);
+
+    if (rename(tmp_path, path) == -1) {
+        log_err("Replacing catalog failed\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+    int dir_fd = open(MAINDIR, O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    // The text catalog of earlier versions is superseded now
+    char legacy_path[strlen(MAINDIR) + strlen(LEGACY_METADATA_FILE_NAME) + 2];
+    sprintf(legacy_path, "%s/%s", MAINDIR, LEGACY_METADATA_FILE_NAME);
+    unlink(legacy_path);
+
+    ret_status.code = OK;
+    return ret_status;
+}
@@ -0,0 +1,218 @@
+/*
+ * This file implements the background checkpoints described in checkpoint.h.
+ *
+ * A checkpoint takes db_lock, starts a new log segment and forks. The child
+ * persists its snapshot with persist_database() and reports the bytes it
+ * wrote through a pipe. Meanwhile the parent releases db_lock and waits for
+ * the child; afterwards it retakes the lock to advance the high-water marks
+ * of the columns and to drop the log segments the new catalog supersedes.
+ */
+
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "checkpoint.h"
+#include "cs165_api.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include "wal.h"
+
+pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+    bool running;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    CheckpointStats stats;
+    // Pacing of the writes, only enabled inside a checkpoint child
+    uint64_t bytes_written;
+    uint64_t bytes_per_sec;
+    struct timespec started;
+} checkpoint = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+
+static double seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void checkpoint_throttle(size_t bytes) {
+    // Columns are persisted by several workers at shutdown
+    uint64_t written = __atomic_add_fetch(&checkpoint.bytes_written, bytes, __ATOMIC_RELAXED);
+    if (checkpoint.bytes_per_sec == 0) {
+        return;
+    }
+
+    // Sleep off however far the writes are ahead of the allowed bandwidth
+    double ahead = (double) written / checkpoint.bytes_per_sec -
+        seconds_since(&checkpoint.started);
+    if (ahead > 0) {
+        struct timespec pause;
+        pause.tv_sec = (time_t) ahead;
+        pause.tv_nsec = (long) ((ahead - pause.tv_sec) * 1e9);
+        while (nanosleep(&pause, &pause) == -1 && errno == EINTR);
+    }
+}
+
+
+/*
+ * Runs in the forked child: persists the snapshot and exits.
+ */
+static void write_snapshot(int report_fd, uint64_t checkpoint_lsn) {
+    // Only this thread made it into the child, columns are written one by one
+    thread_pool_forget();
+    checkpoint.bytes_written = 0;
+    checkpoint.bytes_per_sec = (uint64_t) CHECKPOINT_BANDWIDTH_MB << 20;
+    clock_gettime(CLOCK_MONOTONIC, &checkpoint.started);
+
+    Status status = persist_database(checkpoint_lsn);
+    uint64_t bytes = checkpoint.bytes_written;
+    bool reported = write(report_fd, &bytes, sizeof(bytes)) == sizeof(bytes);
+    _exit(status.code == OK && reported ? 0 : 1);
+}
+
+static void run_checkpoint() {
+    // Rows inserted past the indexes are persisted as they are, sorting them
+    // in would move rows under the positions clients hold
+    pthread_mutex_lock(&db_lock);
+    compress_columns();
+    if (!database_has_changes()) {
+        pthread_mutex_unlock(&db_lock);
+        return;
+    }
+
+    // The snapshot covers the log up to here, later records go to a new segment
+    uint32_t segment;
+    if (wal_rotate(&segment).code != OK) {
+        pthread_mutex_unlock(&db_lock);
+        return;
+    }
+    uint64_t checkpoint_lsn = wal_last_lsn();
+
+    int report[2];
+    if (pipe(report) == -1) {
+        pthread_mutex_unlock(&db_lock);
+        log_err("Creating checkpoint pipe failed\n");
+        return;
+    }
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(report[0]);
+        write_snapshot(report[1], checkpoint_lsn);
+    }
+    if (pid < 0) {
+        pthread_mutex_unlock(&db_lock);
+        close(report[0]);
+        close(report[1]);
+        log_err("Forking checkpoint failed\n");
+        return;
+    }
+    checkpoint_started();
+    pthread_mutex_unlock(&db_lock);
+    close(report[1]);
+
+    uint64_t bytes = 0;
+    bool success = read(report[0], &bytes, sizeof(bytes)) == sizeof(bytes);
+    close(report[0]);
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+    success = success && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    double duration_ms = seconds_since(&started) * 1000;
+
+    pthread_mutex_lock(&db_lock);
+    checkpoint_finished(success);
+    if (success) {
+        wal_drop_segments(segment);
+    }
+    pthread_mutex_unlock(&db_lock);
+
+    pthread_mutex_lock(&checkpoint.lock);
+    if (success) {
+        checkpoint.stats.completed++;
+        checkpoint.stats.checkpoint_lsn = checkpoint_lsn;
+        checkpoint.stats.last_duration_ms = duration_ms;
+        checkpoint.stats.last_bytes = bytes;
+        checkpoint.stats.total_bytes += bytes;
+    } else {
+        checkpoint.stats.failed++;
+    }
+    pthread_mutex_unlock(&checkpoint.lock);
+
+    if (success) {
+        log_info("Checkpoint at lsn %lu wrote %lu bytes in %.1f ms\n",
+                 (unsigned long) checkpoint_lsn, (unsigned long) bytes, duration_ms);
+    } else {
+        log_err("Checkpoint at lsn %lu failed\n", (unsigned long) checkpoint_lsn);
+    }
+}
+
+static void* checkpoint_loop(void* arg) {
+    (void) arg;
+
+    pthread_mutex_lock(&checkpoint.lock);
+    while (checkpoint.running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += CHECKPOINT_INTERVAL_SEC;
+        while (checkpoint.running &&
+               pthread_cond_timedwait(&checkpoint.wake, &checkpoint.lock, &deadline) != ETIMEDOUT);
+        if (!checkpoint.running) {
+            break;
+        }
+
+        pthread_mutex_unlock(&checkpoint.lock);
+        run_checkpoint();
+        pthread_mutex_lock(&checkpoint.lock);
+    }
+    pthread_mutex_unlock(&checkpoint.lock);
+    return NULL;
+}
+
+
+void checkpoint_start() {
+    if (CHECKPOINT_INTERVAL_SEC <= 0 || checkpoint.running) {
+        return;
+    }
+    checkpoint.running = true;
+    if (pthread_create(&checkpoint.thread, NULL, checkpoint_loop, NULL) != 0) {
+        log_err("Starting checkpoint thread failed\n");
+        checkpoint.running = false;
+    }
+}
+
+void checkpoint_stop() {
+    pthread_mutex_lock(&checkpoint.lock);
+    if (!checkpoint.running) {
+        pthread_mutex_unlock(&checkpoint.lock);
+        return;
+    }
+    checkpoint.running = false;
+    pthread_cond_signal(&checkpoint.wake);
+    pthread_mutex_unlock(&checkpoint.lock);
+    pthread_join(checkpoint.thread, NULL);
+}
+
+
+char* checkpoint_stats() {
+    pthread_mutex_lock(&checkpoint.lock);
+    CheckpointStats stats = checkpoint.stats;
+    pthread_mutex_unlock(&checkpoint.lock);
+
+    char* response = malloc(BUF_SIZE);
+    snprintf(response, BUF_SIZE,
+             "checkpoints=%lu,failed=%lu,lsn=%lu,last_duration_ms=%.1f,last_bytes=%lu,total_bytes=%lu",
+             (unsigned long) stats.completed, (unsigned long) stats.failed,
+             (unsigned long) stats.checkpoint_lsn, stats.last_duration_ms,
+             (unsigned long) stats.last_bytes, (unsigned long) stats.total_bytes);
+    return response;
+}
@@ -19,6 +19,7 @@ machine please look into this as a a source of error. */
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -29,6 +30,23 @@ machine please look into this as a a source of error. */
 #include "utils.h"
 
 #define DEFAULT_STDIN_BUFFER_SIZE 1024
+// Size of the pieces a loaded file is streamed to the server in
+#define LOAD_PIECE_SIZE (1 << 20)
+// Most values a batch of inserts sends in one INSERT_DATA piece
+#define INSERT_BATCH_VALUES (1 << 20)
+
+/*
+ * Consecutive relational_insert queries into the same table, sent together as
+ * a relational_insert(table) query and an INSERT_DATA piece of their values.
+ * They all have the same number of values, so that they make up whole rows
+ * exactly when each of them does.
+ */
+typedef struct InsertBatch {
+    char table[DEFAULT_STDIN_BUFFER_SIZE];
+    size_t width;
+    int* values;
+    size_t count;
+} InsertBatch;
 
 /**
  * connect_client()
@@ -61,6 +79,263 @@ int connect_client() {
     return client_socket;
 }
 
+/**
+ * send_fully()
+ *
+ * Sends all size bytes of buffer, returns -1 on failure.
+ **/
+int send_fully(int client_socket, const void* buffer, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t bytes = send(client_socket, (const char*) buffer + done, size - done, 0);
+        if (bytes == -1) {
+            return -1;
+        }
+        done += bytes;
+    }
+    return 0;
+}
+
+/**
+ * query_path()
+ *
+ * Copies the path argument of a query that starts at start and runs up to
+ * the closing parenthesis, free of quotes, to path. Returns -1 if the query
+ * has no closing parenthesis.
+ **/
+int query_path(const char* query, const char* start, char* path) {
+    const char* end = strrchr(query, ')');
+    if (start == NULL || end == NULL || end < start) {
+        return -1;
+    }
+    if (*start == '"' && end > start && end[-1] == '"') {
+        start++;
+        end--;
+    }
+    size_t length = end - start;
+    memcpy(path, start, length);
+    path[length] = '\0';
+    return 0;
+}
+
+/**
+ * open_load_file()
+ *
+ * Opens the file named by a load("...") query so it can be streamed to the
+ * server. Reports an error and returns NULL if the query isn't a well formed
+ * load or the file can't be read, the query is then not sent.
+ **/
+FILE* open_load_file(const char* query) {
+    char path[DEFAULT_STDIN_BUFFER_SIZE];
+    if (strncmp(query, "load(", 5) != 0 || query_path(query, query + 5, path) == -1) {
+        log_err("Malformed load query, expected load(\"<file>\"): %s", query);
+        return NULL;
+    }
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        log_err("Unable to open load file %s: %s\n", path, strerror(errno));
+    }
+    return file;
+}
+
+/**
+ * open_export_file()
+ *
+ * Creates the file named by an export(table,"...") query for the server to
+ * stream the table into. Reports an error and returns NULL if the query
+ * isn't a well formed export or the file can't be created, the query is then
+ * not sent.
+ **/
+FILE* open_export_file(const char* query) {
+    char path[DEFAULT_STDIN_BUFFER_SIZE];
+    const char* comma = strchr(query, ',');
+    if (strncmp(query, "export(", 7) != 0 || query_path(query, comma ? comma + 1 : NULL, path) == -1) {
+        log_err("Malformed export query, expected export(<table>,\"<file>\"): %s", query);
+        return NULL;
+    }
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        log_err("Unable to create export file %s: %s\n", path, strerror(errno));
+    }
+    return file;
+}
+
+/**
+ * receive_export_file()
+ *
+ * Writes the EXPORT_DATA pieces the server sends ahead of its response to
+ * file, up to the empty one that ends them.
+ **/
+int receive_export_file(int client_socket, FILE* file) {
+    char* piece = malloc(LOAD_PIECE_SIZE);
+    size_t piece_size = LOAD_PIECE_SIZE;
+    message piece_message;
+    while (recv(client_socket, &piece_message, sizeof(message), MSG_WAITALL) == sizeof(message) &&
+            piece_message.status == EXPORT_DATA && piece_message.length >= 0) {
+        if (piece_message.length == 0) {
+            free(piece);
+            return 0;
+        }
+        if ((size_t) piece_message.length > piece_size) {
+            piece_size = piece_message.length;
+            piece = realloc(piece, piece_size);
+        }
+        if (recv(client_socket, piece, piece_message.length, MSG_WAITALL) != piece_message.length) {
+            break;
+        }
+        if (fwrite(piece, 1, piece_message.length, file) != (size_t) piece_message.length) {
+            log_err("Writing export file failed\n");
+        }
+    }
+    free(piece);
+    return -1;
+}
+
+/**
+ * stream_load_file()
+ *
+ * Streams a file to the server as LOAD_DATA pieces, ending it with an empty
+ * one. A read error cuts the file short there.
+ **/
+int stream_load_file(int client_socket, FILE* file) {
+    char* piece = malloc(LOAD_PIECE_SIZE);
+    message piece_message;
+    piece_message.status = LOAD_DATA;
+    piece_message.payload = NULL;
+
+    size_t bytes;
+    do {
+        bytes = fread(piece, 1, LOAD_PIECE_SIZE, file);
+        piece_message.length = bytes;
+        if (send_fully(client_socket, &piece_message, sizeof(message)) == -1 ||
+                send_fully(client_socket, piece, bytes) == -1) {
+            free(piece);
+            return -1;
+        }
+    } while (bytes > 0);
+
+    if (ferror(file)) {
+        log_err("Reading load file failed\n");
+    }
+    free(piece);
+    return 0;
+}
+
+/**
+ * receive_response()
+ *
+ * Waits for the server's response to a query and prints its payload, if any.
+ * Returns -1 if the connection failed or was closed.
+ **/
+int receive_response(int client_socket) {
+    message recv_message;
+    int len;
+    if ((len = recv(client_socket, &(recv_message), sizeof(message), 0)) > 0) {
+        if ((recv_message.status == OK_WAIT_FOR_RESPONSE || recv_message.status == OK_DONE) &&
+            (int) recv_message.length > 0) {
+            // Calculate number of bytes in response package
+            int num_bytes = (int) recv_message.length;
+            char payload[num_bytes + 1];
+
+            // Receive the payload and print it out
+            if ((len = recv(client_socket, payload, num_bytes, 0)) > 0) {
+                payload[num_bytes] = '\0';
+                printf("%s\n", payload);
+            }
+        }
+        return 0;
+    }
+    if (len < 0) {
+        log_err("Failed to receive message.");
+    } else {
+        log_info("-- Server closed connection\n");
+    }
+    return -1;
+}
+
+/**
+ * flush_insert_batch()
+ *
+ * Sends the inserts of a batch as one binary insert and waits for the
+ * response. Returns -1 on failure.
+ **/
+int flush_insert_batch(int client_socket, InsertBatch* batch) {
+    if (batch->count == 0) {
+        return 0;
+    }
+    char query[DEFAULT_STDIN_BUFFER_SIZE + 32];
+    message query_message;
+    query_message.status = INSERT_DATA;
+    query_message.length = snprintf(query, sizeof(query), "relational_insert(%s)", batch->table);
+    query_message.payload = NULL;
+
+    message piece_message;
+    piece_message.status = INSERT_DATA;
+    piece_message.length = batch->count * sizeof(int);
+    piece_message.payload = NULL;
+    batch->count = 0;
+
+    if (send_fully(client_socket, &query_message, sizeof(message)) == -1 ||
+            send_fully(client_socket, query, query_message.length) == -1 ||
+            send_fully(client_socket, &piece_message, sizeof(message)) == -1 ||
+            send_fully(client_socket, batch->values, piece_message.length) == -1) {
+        log_err("Failed to send insert batch.");
+        return -1;
+    }
+    return receive_response(client_socket);
+}
+
+/**
+ * batch_insert()
+ *
+ * Adds the values of a relational_insert(table,values...) query to a batch,
+ * sending the batch first if it is for another table or number of values, or
+ * full. Returns 1 if the query was added, 0 if it isn't such a query and -1
+ * on failure.
+ **/
+int batch_insert(int client_socket, InsertBatch* batch, const char* query) {
+    if (strncmp(query, "relational_insert(", 18) != 0) {
+        return 0;
+    }
+    const char* table = query + 18;
+    const char* comma = strchr(table, ',');
+    if (comma == NULL || comma == table) {
+        return 0;
+    }
+
+    // Values come one after another, the last followed by the ')'
+    int values[DEFAULT_STDIN_BUFFER_SIZE / 2];
+    size_t count = 0;
+    const char* position = comma;
+    while (*position == ',') {
+        char* end;
+        values[count++] = (int) strtol(position + 1, &end, 10);
+        if (end == position + 1) {
+            return 0;
+        }
+        position = end;
+    }
+    if (*position != ')' || position[1 + strspn(position + 1, " \t\r\n")] != '\0') {
+        return 0;
+    }
+
+    size_t table_length = comma - table;
+    if (batch->count > 0 && (strlen(batch->table) != table_length ||
+            strncmp(batch->table, table, table_length) != 0 ||
+            batch->width != count || batch->count + count > INSERT_BATCH_VALUES)) {
+        if (flush_insert_batch(client_socket, batch) == -1) {
+            return -1;
+        }
+    }
+    if (batch->count == 0) {
+        memcpy(batch->table, table, table_length);
+        batch->table[table_length] = '\0';
+        batch->width = count;
+    }
+    memcpy(batch->values + batch->count, values, count * sizeof(int));
+    batch->count += count;
+    return 1;
+}
+
 /**
  * Getting Started Hint:
  *      What kind of protocol or structure will you use to deliver your results from the server to the client?
@@ -75,7 +350,6 @@ int main(void)
     }
 
     message send_message;
-    message recv_message;
 
     // Always output an interactive marker at the start of each command if the
     // input is from stdin. Do not output if piped in from file or from other fd
@@ -85,7 +359,11 @@ int main(void)
     }
 
     char *output_str = NULL;
-    int len = 0;
+
+    // Inserts piped in are sent in batches, interactive ones right away
+    InsertBatch batch;
+    batch.values = prefix[0] == '\0' ? malloc(INSERT_BATCH_VALUES * sizeof(int)) : NULL;
+    batch.count = 0;
 
     // Continuously loop and wait for input. At each iteration:
     // 1. output interactive marker
@@ -106,6 +384,34 @@ int main(void)
         // payload directly to the server.
         send_message.length = strlen(read_buffer);
         if (send_message.length > 1) {
+            // Any other query goes out after the inserts before it
+            if (batch.values) {
+                int batched = batch_insert(client_socket, &batch, read_buffer);
+                if (batched == 1) {
+                    continue;
+                }
+                if (batched == -1 || flush_insert_batch(client_socket, &batch) == -1) {
+                    exit(1);
+                }
+            }
+
+            // Loads send the file along instead of having the server open
+            // it, exports have it sent back
+            FILE* load_file = NULL;
+            FILE* export_file = NULL;
+            if (strncmp(read_buffer, "load", 4) == 0) {
+                load_file = open_load_file(read_buffer);
+                if (load_file == NULL) {
+                    continue;
+                }
+            } else if (strncmp(read_buffer, "export", 6) == 0) {
+                export_file = open_export_file(read_buffer);
+                if (export_file == NULL) {
+                    continue;
+                }
+            }
+            send_message.status = load_file ? LOAD_DATA : export_file ? EXPORT_DATA : 0;
+
             // Send the message_header, which tells server payload size
             if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
                 log_err("Failed to send message header.");
@@ -118,32 +424,33 @@ int main(void)
                 exit(1);
             }
 
-            // Always wait for server response (even if it is just an OK message)
-            if ((len = recv(client_socket, &(recv_message), sizeof(message), 0)) > 0) {
-                if ((recv_message.status == OK_WAIT_FOR_RESPONSE || recv_message.status == OK_DONE) &&
-                    (int) recv_message.length > 0) {
-                    // Calculate number of bytes in response package
-                    int num_bytes = (int) recv_message.length;
-                    char payload[num_bytes + 1];
-
-                    // Receive the payload and print it out
-                    if ((len = recv(client_socket, payload, num_bytes, 0)) > 0) {
-                        payload[num_bytes] = '\0';
-                        printf("%s\n", payload);
-                    }
+            if (load_file) {
+                int streamed = stream_load_file(client_socket, load_file);
+                fclose(load_file);
+                if (streamed == -1) {
+                    log_err("Failed to send load file.");
+                    exit(1);
                 }
             }
-            else {
-                if (len < 0) {
-                    log_err("Failed to receive message.");
+            if (export_file) {
+                int received = receive_export_file(client_socket, export_file);
+                fclose(export_file);
+                if (received == -1) {
+                    log_err("Failed to receive export file.");
+                    exit(1);
                 }
-                else {
-		            log_info("-- Server closed connection\n");
-		        }
+            }
+
+            // Always wait for server response (even if it is just an OK message)
+            if (receive_response(client_socket) == -1) {
                 exit(1);
             }
         }
     }
+    if (batch.values && flush_insert_batch(client_socket, &batch) == -1) {
+        exit(1);
+    }
+    free(batch.values);
     close(client_socket);
     return 0;
 }
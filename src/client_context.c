@@ -69,6 +69,14 @@ Column* lookup_column(char* name) {
         }
     }
 
+    // Read the column in on first use
+    if (column) {
+        column->accesses++;
+        if (load_column(table, column).code != OK) {
+            return NULL;
+        }
+    }
+
     return column;
 }
 
@@ -96,5 +104,7 @@ GeneralizedColumnHandle* create_handle(ClientContext* context, char* name) {
     GeneralizedColumnHandle* handle = &context->chandle_table[context->chandles_in_use];
     context->chandles_in_use++;
     strcpy(handle->name, name);
+    handle->generalized_column.column_type = RESULT;
+    handle->generalized_column.column_pointer.result = NULL;
     return handle;
 }
\ No newline at end of file
@@ -0,0 +1,168 @@
+/*
+ * This file implements the segment encodings described in compression.h.
+ *
+ * Number i of a bit-packed array with b bits per number occupies bits
+ * [i * b, (i + 1) * b) of an array of 64-bit words. One spare word at the end
+ * lets every read load two words without checking for the end.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "compression.h"
+
+// Packing has to save at least a quarter of the space to pay for decoding
+#define MAX_PACKED_BITS 24
+
+
+static uint32_t bits_needed(uint32_t value) {
+    uint32_t bits = 0;
+    while (bits < 32 && (value >> bits) != 0) {
+        bits++;
+    }
+    return bits;
+}
+
+static inline uint32_t read_bits(const uint64_t* words, size_t index, uint32_t bits) {
+    if (bits == 0) {
+        return 0;
+    }
+    size_t bit = index * bits;
+    size_t word = bit >> 6;
+    uint32_t shift = bit & 63;
+    uint64_t value = words[word] >> shift;
+    if (shift + bits > 64) {
+        value |= words[word + 1] << (64 - shift);
+    }
+    return (uint32_t) (value & (((uint64_t) 1 << bits) - 1));
+}
+
+static inline void write_bits(uint64_t* words, size_t index, uint32_t bits, uint32_t value) {
+    if (bits == 0) {
+        return;
+    }
+    size_t bit = index * bits;
+    size_t word = bit >> 6;
+    uint32_t shift = bit & 63;
+    words[word] |= (uint64_t) value << shift;
+    if (shift + bits > 64) {
+        words[word + 1] |= (uint64_t) value >> (64 - shift);
+    }
+}
+
+static size_t anchor_words(uint32_t encoding, size_t count) {
+    if (encoding != ENCODING_DELTA) {
+        return 0;
+    }
+    size_t anchors = (count + DELTA_ANCHOR_VALUES - 1) / DELTA_ANCHOR_VALUES;
+    return (anchors * sizeof(int32_t) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+}
+
+static PackedSegment* allocate_packed(uint32_t encoding, uint32_t bits, size_t count) {
+    size_t words = anchor_words(encoding, count) + (count * bits + 63) / 64 + 1;
+    size_t size = sizeof(PackedSegment) + words * sizeof(uint64_t);
+    PackedSegment* packed = calloc(1, size);
+    if (packed == NULL) {
+        return NULL;
+    }
+    packed->encoding = encoding;
+    packed->bits = bits;
+    packed->num_values = count;
+    packed->size = size;
+    return packed;
+}
+
+
+PackedSegment* pack_segment(const int* values, size_t count, int min, int max) {
+    if (count == 0) {
+        return NULL;
+    }
+
+    // Frame of reference needs the bits of the value range
+    uint32_t for_bits = bits_needed((uint32_t) ((int64_t) max - min));
+
+    // Deltas need the bits of the largest step, if the values never decrease
+    uint32_t delta_bits = 33;
+    uint32_t largest_step = 0;
+    size_t i;
+    for (i = 1; i < count && values[i] >= values[i - 1]; i++) {
+        uint32_t step = (uint32_t) ((int64_t) values[i] - values[i - 1]);
+        if (step > largest_step) {
+            largest_step = step;
+        }
+    }
+    if (i == count) {
+        delta_bits = bits_needed(largest_step);
+    }
+
+    // Anchors cost a quarter bit per value on top of the deltas
+    if (delta_bits * 4 + 1 < for_bits * 4 && delta_bits <= MAX_PACKED_BITS) {
+        PackedSegment* packed = allocate_packed(ENCODING_DELTA, delta_bits, count);
+        if (packed == NULL) {
+            return NULL;
+        }
+        int32_t* anchors = (int32_t*) packed->words;
+        uint64_t* words = packed->words + anchor_words(ENCODING_DELTA, count);
+        for (i = 0; i < count; i++) {
+            if (i % DELTA_ANCHOR_VALUES == 0) {
+                anchors[i / DELTA_ANCHOR_VALUES] = values[i];
+            } else {
+                write_bits(words, i, delta_bits, (uint32_t) ((int64_t) values[i] - values[i - 1]));
+            }
+        }
+        return packed;
+    }
+
+    if (for_bits > MAX_PACKED_BITS) {
+        return NULL;
+    }
+    PackedSegment* packed = allocate_packed(ENCODING_FOR, for_bits, count);
+    if (packed == NULL) {
+        return NULL;
+    }
+    packed->base = min;
+    for (i = 0; i < count; i++) {
+        write_bits(packed->words, i, for_bits, (uint32_t) ((int64_t) values[i] - min));
+    }
+    return packed;
+}
+
+
+void unpack_segment(const PackedSegment* packed, int* out) {
+    size_t count = packed->num_values;
+    uint32_t bits = packed->bits;
+
+    if (packed->encoding == ENCODING_FOR) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = (int) ((int64_t) packed->base + read_bits(packed->words, i, bits));
+        }
+        return;
+    }
+
+    const int32_t* anchors = (const int32_t*) packed->words;
+    const uint64_t* words = packed->words + anchor_words(ENCODING_DELTA, count);
+    int64_t value = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i % DELTA_ANCHOR_VALUES == 0) {
+            value = anchors[i / DELTA_ANCHOR_VALUES];
+        } else {
+            value += read_bits(words, i, bits);
+        }
+        out[i] = (int) value;
+    }
+}
+
+int packed_value(const PackedSegment* packed, size_t index) {
+    if (packed->encoding == ENCODING_FOR) {
+        return (int) ((int64_t) packed->base + read_bits(packed->words, index, packed->bits));
+    }
+
+    // Add up the deltas since the closest anchor
+    const int32_t* anchors = (const int32_t*) packed->words;
+    const uint64_t* words = packed->words + anchor_words(ENCODING_DELTA, packed->num_values);
+    size_t anchor = index / DELTA_ANCHOR_VALUES;
+    int64_t value = anchors[anchor];
+    for (size_t i = anchor * DELTA_ANCHOR_VALUES + 1; i <= index; i++) {
+        value += read_bits(words, i, packed->bits);
+    }
+    return (int) value;
+}
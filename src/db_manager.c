@@ -1,11 +1,20 @@
-#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 #include <string.h>
 #include <fcntl.h>
+#include <float.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include "catalog.h"
+#include "checkpoint.h"
+#include "columnar.h"
 #include "cs165_api.h"
+#include "scan.h"
+#include "thread_pool.h"
 #include "utils.h"
+#include "wal.h"
+#include "warmer.h"
 #include <errno.h>
 
 
@@ -14,635 +23,3569 @@ Db* current_db;
 
 
 /*
- * Here you will create a table object. The Status object can be used to return
- * to the caller that there was an error in table creation
+ * Number of words in the dirty page bitmap of a column holding capacity values.
  */
-Table* create_table(Db* db, const char* name, size_t num_columns, Status* ret_status) {
-	if (db != current_db) {
-		log_err("Error creating table. Requested db is not the current db.\n");
-		ret_status->code = ERROR;
-		return NULL;
-	}
+static size_t dirty_words(size_t capacity) {
+	size_t pages = (capacity + DIRTY_PAGE_VALUES - 1) / DIRTY_PAGE_VALUES;
+	return (pages + 63) / 64;
+}
 
-	// If there is no more capacity in the db
-	if (db->tables_size == db->tables_capacity) {
-		size_t new_capacity;
-		if (db->tables_capacity == 0) {
-			// If the original capacity is 0, calloc 1 table
-			new_capacity = 1;
-			db->tables = calloc(new_capacity, sizeof(Table*));
-		} else {
-			// Otherwise, double the capacity and realloc
-			new_capacity = db->tables_capacity * 2;
-			db->tables = realloc(db->tables, new_capacity * sizeof(Table*));
-		}
-		db->tables_capacity = new_capacity;
+/*
+ * Number of entries allocated for the segment array of a column with
+ * num_segments segments, the next power of two.
+ */
+static size_t segment_slots(size_t num_segments) {
+	size_t slots = 1;
+	while (slots < num_segments) {
+		slots *= 2;
 	}
-
-	// Add the table and adjust the size of the db
-	// tables_size acts as the index
-	Table* table = malloc(sizeof(Table));
-	db->tables[db->tables_size] = table;
-	db->tables_size++;
-
-	// Initialize the table fields
-	strcpy(table->name, name);
-	// table->name[strlen(name)] = '\0';
-	table->columns = calloc(num_columns, sizeof(Column*));
-	table->col_count = num_columns;
-	table->col_idx = 0;
-	table->table_length = 0;
-	table->table_capacity = DEFAULT_COL_SIZE;
-
-	ret_status->code = OK;
-	return table;
+	return slots;
 }
 
+/*
+ * Map segment seg of a mapped column from its data file. Segments past
+ * private_from get a private copy-on-write mapping.
+ */
+static int* map_segment(Column* column, size_t seg, void* addr, int flags) {
+	flags |= seg >= column->private_from ? MAP_PRIVATE : MAP_SHARED;
+	return mmap(addr, SEGMENT_BYTES, PROT_READ | PROT_WRITE, flags, column->fd, seg * SEGMENT_BYTES);
+}
 
 /*
- * Similarly, this method is meant to create a database.
+ * Add segments to a column until it has num_segments of them. Heap columns
+ * allocate the new segments, mapped columns extend their data file and map
+ * them, right behind the previous segment where possible so that the kernel
+ * can merge the mappings.
  */
-Status create_db(const char* db_name) {
-	Status ret_status;
+static int add_segments(Column* column, size_t num_segments) {
+	size_t old_segments = column->num_segments;
+	if (num_segments <= old_segments) {
+		return 0;
+	}
 
-	if (current_db) {
-		for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
-			Table* table = current_db->tables[tbl];
-			for (size_t col = 0; col < table->col_count; col++) {
-				Column* column = table->columns[col];
-				free(column->data);
-				free(column->index);
-				free(column);
-			}
-			free(table->columns);
-			free(table);
+	// Grow the dirty page bitmap along with the column
+	size_t old_words = dirty_words(old_segments * SEGMENT_VALUES);
+	size_t new_words = dirty_words(num_segments * SEGMENT_VALUES);
+	if (new_words > old_words) {
+		uint64_t* dirty_pages = realloc(column->dirty_pages, new_words * sizeof(uint64_t));
+		if (dirty_pages == NULL) {
+			return -1;
 		}
-		free(current_db->tables);
-		free(current_db);
+		memset(dirty_pages + old_words, 0, (new_words - old_words) * sizeof(uint64_t));
+		column->dirty_pages = dirty_pages;
 	}
 
-	current_db = malloc(sizeof(Db));
-	strcpy(current_db->name, db_name);
-	current_db->tables = NULL;
-	current_db->tables_size = 0;
-	current_db->tables_capacity = 0;
+	// The segment array doubles, so only a pointer per segment is ever copied
+	if (old_segments == 0 || num_segments > segment_slots(old_segments)) {
+		int** segments = realloc(column->segments, segment_slots(num_segments) * sizeof(int*));
+		if (segments == NULL) {
+			return -1;
+		}
+		column->segments = segments;
+		ZoneMap* zones = realloc(column->zones, segment_slots(num_segments) * sizeof(ZoneMap));
+		if (zones == NULL) {
+			return -1;
+		}
+		column->zones = zones;
+		PackedSegment** packed = realloc(column->packed, segment_slots(num_segments) * sizeof(PackedSegment*));
+		if (packed == NULL) {
+			return -1;
+		}
+		column->packed = packed;
+	}
 
-	ret_status.code = OK;
-	return ret_status;
+	if (column->fd >= 0 && ftruncate(column->fd, num_segments * SEGMENT_BYTES) == -1) {
+		log_err("Extending persistence file failed\n");
+		return -1;
+	}
+	for (size_t seg = old_segments; seg < num_segments; seg++) {
+		int* segment;
+		if (column->fd < 0) {
+			segment = calloc(SEGMENT_VALUES, sizeof(int));
+			if (segment == NULL) {
+				return -1;
+			}
+		} else {
+			void* hint = seg > 0 && column->segments[seg - 1] ? column->segments[seg - 1] + SEGMENT_VALUES : NULL;
+			segment = map_segment(column, seg, hint, 0);
+			if (segment == MAP_FAILED) {
+				log_err("Mmapping file failed\n");
+				return -1;
+			}
+		}
+		column->segments[seg] = segment;
+		column->packed[seg] = NULL;
+		column->zones[seg].min = INT_MAX;
+		column->zones[seg].max = INT_MIN;
+		column->num_segments = seg + 1;
+	}
+	return 0;
 }
 
 
 /*
- * Create column
+ * Give up the plain values of a segment, once it is packed.
  */
-Column* create_column(Table* table, char* name, int sorted, Status* ret_status) {
-	(void) sorted;
-
-	if (table->col_idx == table->col_count) {
-		log_err("Error creating column. Table is full\n");
-		ret_status->code = ERROR;
-		return NULL;
+static void release_segment(Column* column, size_t seg) {
+	if (column->fd < 0) {
+		free(column->segments[seg]);
+	} else if (column->segments[seg]) {
+		munmap(column->segments[seg], SEGMENT_BYTES);
 	}
-
-	// Add the column
-	Column* column = malloc(sizeof(Column));
-	table->columns[table->col_idx] = column;
-	table->col_idx++;
-
-	// Initialize column fields
-	strcpy(column->name, name);
-	// column->name[strlen(name)] = '\0';
-	column->data = calloc(DEFAULT_COL_SIZE, sizeof(int));
-	column->index = NULL;
-	column->length = 0;
-
-	ret_status->code = OK;
-	return column;
+	column->segments[seg] = NULL;
 }
 
-
-// Insert into table
-Status relational_insert(Table* table, int* values) {
-	Status ret_status;
-
-	// Increase table capacity if required
-	if (table->table_length == table->table_capacity) {
-		size_t new_capacity = table->table_capacity * 2;
-		for (size_t i = 0; i < table->col_count; i++) {
-			table->columns[i]->data = realloc(table->columns[i]->data, new_capacity * sizeof(int));
+/*
+ * Give the packed segments from segment from on their plain values back, so
+ * that they can be modified in place. They are considered for packing again
+ * once persisted, and the .packed file is rewritten without them.
+ */
+static int unseal_segments(Column* column, size_t from) {
+	for (size_t seg = from; seg < column->sealed_segments; seg++) {
+		if (column->packed[seg] == NULL) {
+			continue;
 		}
-		table->table_capacity = new_capacity;
+		int* segment;
+		if (column->fd < 0) {
+			segment = malloc(SEGMENT_BYTES);
+		} else {
+			segment = map_segment(column, seg, NULL, 0);
+			if (segment == MAP_FAILED) {
+				log_err("Mmapping file failed\n");
+				segment = NULL;
+			}
+		}
+		if (segment == NULL) {
+			return -1;
+		}
+		unpack_segment(column->packed[seg], segment);
+		free(column->packed[seg]);
+		column->packed[seg] = NULL;
+		column->segments[seg] = segment;
+		column->packed_rewrite = true;
 	}
-
-	for (size_t i = 0; i < table->col_count; i++) {
-		table->columns[i]->data[table->table_length] = values[i];
-		table->columns[i]->length++;
+	if (from < column->sealed_segments) {
+		column->sealed_segments = from;
 	}
-	table->table_length++;
-
-	free(values);
-
-	ret_status.code = OK;
-	return ret_status;
+	return 0;
 }
 
+/*
+ * Free a column along with its storage, unmapping it if it is file backed.
+ */
+static void release_column(Column* column) {
+	for (size_t seg = 0; seg < column->num_segments; seg++) {
+		release_segment(column, seg);
+		free(column->packed[seg]);
+	}
+	if (column->fd >= 0) {
+		close(column->fd);
+	}
+	free(column->segments);
+	free(column->packed);
+	free(column->zones);
+	free(column->dirty_pages);
+	free(column->checkpoint_dirty_pages);
+	free_column_index(column->index);
+	free(column->catalog_entry);
+	free(column);
+}
 
-Result* select_column(SelectOperator select_operator, ClientContext* context, Status* ret_status) {
-	Result* result = malloc(sizeof(Result));
-	result->num_tuples = 0;
-	result->capacity = DEFAULT_COL_SIZE;
-	result->data_type = INDEX;
-	result->payload = NULL;
-
-	if (context->batch == NULL) {
-		size_t* indexes = calloc(DEFAULT_COL_SIZE, sizeof(size_t));
 
-		if (select_operator.indexes == NULL) {
-			for (size_t i = 0; i < select_operator.column->length; i++) {
-				if (
-					(select_operator.column->data[i] >= select_operator.comparator.p_low) &&
-					(select_operator.column->data[i] < select_operator.comparator.p_high)
-				) {
-					if (result->num_tuples == result->capacity) {
-						result->capacity = result->capacity * 2;
-						indexes = realloc(indexes, result->capacity * sizeof(size_t));
-					}
-					indexes[result->num_tuples] = i;
-					result->num_tuples++;
-				}
-			}
+void read_column(Column* column, size_t first, size_t count, int* out) {
+	size_t end = first + count;
+	for (size_t start = first; start < end; ) {
+		size_t seg = start >> SEGMENT_SHIFT;
+		size_t stop = (seg + 1) << SEGMENT_SHIFT < end ? (seg + 1) << SEGMENT_SHIFT : end;
+		if (column->segments[seg]) {
+			memcpy(out, column->segments[seg] + (start & SEGMENT_MASK), (stop - start) * sizeof(int));
 		} else {
-			for (size_t i = 0; i < select_operator.indexes->num_tuples; i++) {
-				size_t index = *((size_t*) select_operator.indexes->payload + i);
-				int element = *((int*) select_operator.values->payload + i);
-				if (
-					(element >= select_operator.comparator.p_low) &&
-					(element < select_operator.comparator.p_high)
-				) {
-					if (result->num_tuples == result->capacity) {
-						result->capacity = result->capacity * 2;
-						indexes = realloc(indexes, result->capacity * sizeof(size_t));
-					}
-					indexes[result->num_tuples] = index;
-					result->num_tuples++;
-				}
+			for (size_t i = start; i < stop; i++) {
+				out[i - start] = packed_value(column->packed[seg], i & SEGMENT_MASK);
 			}
 		}
-		
-		result->payload = indexes;
-	} else {
-		if (context->batch->column == NULL) {
-			context->batch->column = select_operator.column;
-		}
-
-		if (context->batch->batch_size == context->batch->batch_capacity) {
-			int new_capacity = context->batch->batch_capacity * 2;
-			context->batch->results = realloc(context->batch->results, new_capacity * sizeof(Result*));
-			context->batch->lower_bounds = realloc(context->batch->lower_bounds, new_capacity * sizeof(long int*));
-			context->batch->upper_bounds = realloc(context->batch->upper_bounds, new_capacity * sizeof(long int*));
-			context->batch->batch_capacity = new_capacity;
-		}
-
-		context->batch->results[context->batch->batch_size] = result;
-		context->batch->lower_bounds[context->batch->batch_size] = select_operator.comparator.p_low;
-		context->batch->upper_bounds[context->batch->batch_size] = select_operator.comparator.p_high;
-		context->batch->batch_size++;
-
-		log_test("Batched "); // "... Select succeeded"
+		out += stop - start;
+		start = stop;
 	}
+}
 
-	ret_status->code = OK;
-	return result;
+const int* segment_values(const Column* column, size_t seg, int** scratch) {
+	if (column->segments[seg]) {
+		return column->segments[seg];
+	}
+	if (*scratch == NULL) {
+		*scratch = malloc(SEGMENT_BYTES);
+	}
+	unpack_segment(column->packed[seg], *scratch);
+	return *scratch;
 }
 
-Result* fetch(Column* column, Result* indexes, Status* ret_status) {
-	Result* result = malloc(sizeof(Result));
-	result->num_tuples = indexes->num_tuples;
-	result->capacity = indexes->num_tuples;
-	result->data_type = INT;
 
-	int* values = calloc(indexes->num_tuples, sizeof(int));
-	for (size_t i = 0; i < indexes->num_tuples; i++) {
-		size_t index = *((size_t*) indexes->payload + i);
-		values[i] = column->data[index];
+/*
+ * Turn the shared mappings of segments from on of a mapped column into
+ * private ones before rows are moved in place. Shared pages are written back
+ * to the file whenever the kernel likes and a checkpoint child reads them,
+ * while the file must keep what the catalog says until the column is
+ * persisted. A private mapping starts out with the file's pages, so the
+ * values stay the same.
+ */
+static int privatize_segments(Column* column, size_t from) {
+	if (column->fd < 0 || from >= column->private_from) {
+		return 0;
 	}
-
-	ret_status->code = OK;
-	result->payload = values;
-	return result;
+	size_t to = column->private_from < column->num_segments ? column->private_from : column->num_segments;
+	column->private_from = from;
+	for (size_t seg = from; seg < to; seg++) {
+		if (column->segments[seg] && map_segment(column, seg, column->segments[seg], MAP_FIXED) == MAP_FAILED) {
+			log_err("Mmapping file failed\n");
+			return -1;
+		}
+	}
+	return 0;
 }
 
-void begin_batch(ClientContext* context, Status* ret_status) {
-	if (context->batch != NULL) {
-		log_err("There is already a batched query in progress\n");
-		ret_status->code = ERROR;
+/*
+ * Record that values [from, to) were modified in place. Values at or past the
+ * persisted high-water mark don't need tracking, they are always written.
+ * While a checkpoint runs, its length is the mark it will leave behind.
+ * Packed segments are immutable, their values must not be modified.
+ */
+void mark_column_dirty(Column* column, size_t from, size_t to) {
+	size_t high_water = column->persisted_length > column->checkpoint_length ?
+		column->persisted_length : column->checkpoint_length;
+	if (to > high_water) {
+		to = high_water;
+	}
+	if (from >= to) {
 		return;
 	}
-
-	context->batch = malloc(sizeof(SharedSelect));
-	context->batch->column = NULL;
-	context->batch->results = calloc(DEFAULT_BATCH_SIZE, sizeof(Result*));
-	context->batch->lower_bounds = calloc(DEFAULT_BATCH_SIZE, sizeof(long int*));
-	context->batch->upper_bounds = calloc(DEFAULT_BATCH_SIZE, sizeof(long int*));
-	context->batch->batch_size = 0;
-	context->batch->batch_capacity = DEFAULT_BATCH_SIZE;
-
-	ret_status->code = OK;
-	return;
+	for (size_t page = from / DIRTY_PAGE_VALUES; page <= (to - 1) / DIRTY_PAGE_VALUES; page++) {
+		column->dirty_pages[page / 64] |= (uint64_t) 1 << (page % 64);
+	}
 }
 
-void execute_batch(ClientContext* context, Status* ret_status) {
-	if (context->batch == NULL) {
-		log_err("There is no batched query currently in progress\n");
-		ret_status->code = ERROR;
-		return;
+/*
+ * Find the next run of dirty pages at or after page, below the high-water
+ * mark. Returns the first page of the run and sets end past its last page,
+ * or returns end_page when no dirty pages are left.
+ */
+static size_t next_dirty_run(Column* column, size_t page, size_t end_page, size_t* end) {
+	while (page < end_page && !(column->dirty_pages[page / 64] & ((uint64_t) 1 << (page % 64)))) {
+		page++;
 	}
-
-	SharedSelect* batch = context->batch;
-	Column* column = batch->column;
-
-	// Initialize an array of indexes for the batched query
-	size_t* indexes[batch->batch_size];
-	for (int q = 0; q < batch->batch_size; q++) {
-		indexes[q] = calloc(DEFAULT_COL_SIZE, sizeof(size_t));
+	*end = page;
+	while (*end < end_page && (column->dirty_pages[*end / 64] & ((uint64_t) 1 << (*end % 64)))) {
+		(*end)++;
 	}
+	return page;
+}
 
-	// Execute the batched query
-	for (size_t i = 0; i < column->length; i++) {
-		for (int q = 0; q < batch->batch_size; q++) {
-			if (
-				(column->data[i] >= batch->lower_bounds[q]) &&
-				(column->data[i] < batch->upper_bounds[q])
-			) {
-				if (batch->results[q]->num_tuples == batch->results[q]->capacity) {
-					size_t new_capacity = batch->results[q]->capacity * 2;
-					indexes[q] = realloc(indexes[q], new_capacity * sizeof(size_t));
-					batch->results[q]->capacity = new_capacity;
-				}
-				size_t result_index = batch->results[q]->num_tuples;
-				indexes[q][result_index] = i;
-				batch->results[q]->num_tuples++;
+static int write_fully(int fd, const void* buf, size_t len, off_t offset) {
+	const char* bytes = buf;
+	while (len > 0) {
+		ssize_t written = pwrite(fd, bytes, len, offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
 			}
+			return -1;
 		}
+		bytes += written;
+		len -= written;
+		offset += written;
 	}
+	return 0;
+}
 
-	// Pass the payloads off to the respective results
-	for (int q = 0; q < batch->batch_size; q++) {
-		batch->results[q]->payload = indexes[q];
+/*
+ * Write values [from, to) of a column to disk a segment at a time, so that
+ * a background checkpoint can pace itself between them. Mapped columns
+ * flush the range of their mapping, heap columns pwrite it to fd.
+ */
+static int write_range(Column* column, int fd, size_t from, size_t to) {
+	for (size_t start = from; start < to; ) {
+		size_t seg = start >> SEGMENT_SHIFT;
+		size_t end = (seg + 1) << SEGMENT_SHIFT < to ? (seg + 1) << SEGMENT_SHIFT : to;
+		if (column->segments[seg] == NULL) {
+			// Packed segments never change, their values are on disk already
+			start = end;
+			continue;
+		}
+		int* values = column->segments[seg] + (start & SEGMENT_MASK);
+		size_t bytes = (end - start) * sizeof(int);
+		if (column->fd >= 0 && seg < column->private_from) {
+			if (msync(values, bytes, MS_SYNC) == -1) {
+				log_err("Msync file failed\n");
+				return -1;
+			}
+		} else if (write_fully(fd, values, bytes, start * sizeof(int)) == -1) {
+			log_err("Writing to file failed\n");
+			return -1;
+		}
+		checkpoint_throttle(bytes);
+		start = end;
 	}
+	return 0;
+}
 
-	// Free the batched query and set the context batch to null
-	free(batch->results);
-	free(batch->lower_bounds);
-	free(batch->upper_bounds);
-	free(batch);
-	context->batch = NULL;
+// The zone maps of a column are stored next to its data file behind this header
+typedef struct ZoneFileHeader {
+	// CRC-32 of the zone maps
+	uint32_t checksum;
+	uint32_t reserved;
+	uint64_t num_zones;
+} ZoneFileHeader;
 
-	ret_status->code = OK;
-	return;
+static void zone_file_path(char* path, Table* table, Column* column) {
+	sprintf(path, "%s/%s.%s.zones", MAINDIR, table->name, column->name);
 }
 
-char* print_result(PrintOperator print_operator, Status* ret_status) {
-	char row[BUF_SIZE];
-	size_t len = 0;
-	Result* result = NULL;
-
-	// TODO: send an array of ints instead of chars
+/*
+ * Write the zone maps of the persisted segments of a column. They go out
+ * before the catalog, so a file out of step with the catalog describes more
+ * rows than it: its zone maps are then wider than needed, which is harmless,
+ * or there are more of them and they are recomputed at startup.
+ */
+static int persist_zones(Table* table, Column* column) {
+	char path[MAX_SIZE_NAME * 2 + strlen(MAINDIR) + 16];
+	zone_file_path(path, table, column);
+
+	ZoneFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.num_zones = segment_count(table->table_length);
+	header.checksum = crc32(column->zones, header.num_zones * sizeof(ZoneMap), 0);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		log_err("Opening zone map file failed\n");
+		return -1;
+	}
+	size_t bytes = header.num_zones * sizeof(ZoneMap);
+	if (write_fully(fd, &header, sizeof(header), 0) == -1 ||
+			write_fully(fd, column->zones, bytes, sizeof(header)) == -1 ||
+			fdatasync(fd) == -1) {
+		close(fd);
+		log_err("Writing zone map file failed\n");
+		return -1;
+	}
+	close(fd);
+	checkpoint_throttle(sizeof(header) + bytes);
+	return 0;
+}
 
-	for (size_t i = 0; i < print_operator.results[0]->num_tuples; i++) {
-		for (int r = 0; r < print_operator.num_results; r++) {
-			result = print_operator.results[r];
-			if (result->data_type == INT) {
-				len += sprintf(row, "%d", *((int*) result->payload + i)) + 1;
-			} else if (result->data_type == LONG) {
-				len += sprintf(row, "%ld", *((long int*) result->payload + i)) + 1;
-			} else if (result->data_type == FLOAT) {
-				len += sprintf(row, "%.2f", *((float*) result->payload + i)) + 1;
-			}
+/*
+ * Compute the zone map of a segment from its first count values.
+ */
+static void compute_zone(Column* column, size_t seg, size_t count, int** scratch) {
+	const int* values = segment_values(column, seg, scratch);
+	ZoneMap* zone = &column->zones[seg];
+	zone->min = INT_MAX;
+	zone->max = INT_MIN;
+	for (size_t i = 0; i < count; i++) {
+		int value = values[i];
+		if (value < zone->min) {
+			zone->min = value;
+		}
+		if (value > zone->max) {
+			zone->max = value;
 		}
 	}
+}
 
-	char* response = malloc((len + 1) * sizeof(char));
-	memset(response, 0, len + 1);
-	char sep = ',';
+/*
+ * Read the zone maps of a freshly loaded column, recomputing them from the
+ * values when the file is missing or damaged.
+ */
+static void load_zones(Table* table, Column* column) {
+	size_t num_zones = segment_count(table->table_length);
+	char path[MAX_SIZE_NAME * 2 + strlen(MAINDIR) + 16];
+	zone_file_path(path, table, column);
+
+	bool loaded = false;
+	int fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		ZoneFileHeader header;
+		if (pread(fd, &header, sizeof(header), 0) == sizeof(header) && header.num_zones >= num_zones &&
+				header.num_zones <= column->num_segments) {
+			size_t bytes = header.num_zones * sizeof(ZoneMap);
+			loaded = pread(fd, column->zones, bytes, sizeof(header)) == (ssize_t) bytes &&
+				crc32(column->zones, bytes, 0) == header.checksum;
+		}
+		close(fd);
+	}
 
-	for (size_t j = 0; j < print_operator.results[0]->num_tuples; j++) {
-		for (int r = 0; r < print_operator.num_results; r++) {
-			result = print_operator.results[r];
-			sep = (r == print_operator.num_results - 1) ? '\n': ',';
-			
-			if (result->data_type == INT) {
-				sprintf(response, "%s%d%c", response, *((int*) result->payload + j), sep);
-			} else if (result->data_type == LONG) {
-				sprintf(response, "%s%ld%c", response, *((long int*) result->payload + j), sep);
-			} else if (result->data_type == FLOAT) {
-				sprintf(response, "%s%.2f%c", response, *((float*) result->payload + j), sep);
-			}
+	if (!loaded) {
+		log_info("Rebuilding zone maps of %s.%s\n", table->name, column->name);
+		int* scratch = NULL;
+		for (size_t seg = 0; seg < num_zones; seg++) {
+			compute_zone(column, seg, segment_length(table->table_length, seg), &scratch);
 		}
+		free(scratch);
 	}
+}
 
-	response[len] = '\0';
+// Every packed segment in a column's .packed file is preceded by this header
+typedef struct PackedRecordHeader {
+	// CRC-32 of the segment number and the packed segment
+	uint32_t checksum;
+	uint32_t segment;
+} PackedRecordHeader;
 
-	free(print_operator.results);
-	ret_status->code = OK;
-	return response;
+static void packed_file_path(char* path, Table* table, Column* column) {
+	sprintf(path, "%s/%s.%s.packed", MAINDIR, table->name, column->name);
 }
 
+static uint32_t packed_record_checksum(PackedRecordHeader* header, PackedSegment* packed) {
+	return crc32(packed, packed->size, crc32(&header->segment, sizeof(header->segment), 0));
+}
 
-Result* add_values(Result* first, Result* second, Status* ret_status) {
-	Result* result = malloc(sizeof(Result));
-	result->num_tuples = first->num_tuples;
-	result->capacity = first->num_tuples;
-	result->data_type = INT;
-
-	int* values = calloc(result->num_tuples, sizeof(int));
-	for (size_t i = 0; i < result->num_tuples; i++) {
-		values[i] = *((int*) first->payload + i) + *((int*) second->payload + i);
+/*
+ * Append the segments packed since the last time to the column's .packed
+ * file. The file starts over while it holds nothing the column needs, so
+ * that records of an earlier column of the same name are never picked up.
+ */
+static int persist_packed(Table* table, Column* column) {
+	// A rewrite writes every packed segment again
+	size_t first = column->packed_rewrite ? 0 : column->packed_persisted;
+	bool needed = false;
+	bool pending = false;
+	for (size_t seg = 0; seg < column->sealed_segments; seg++) {
+		if (column->packed[seg]) {
+			needed |= seg < first;
+			pending |= seg >= first;
+		}
+	}
+	if (!pending) {
+		column->packed_persisted = column->sealed_segments;
+		column->packed_rewrite = false;
+		return 0;
+	}
+
+	char path[MAX_SIZE_NAME * 2 + strlen(MAINDIR) + 16];
+	packed_file_path(path, table, column);
+	int fd = open(path, O_WRONLY | O_CREAT | (needed ? 0 : O_TRUNC), 0600);
+	if (fd < 0) {
+		log_err("Opening packed segment file failed\n");
+		return -1;
+	}
+
+	off_t offset = lseek(fd, 0, SEEK_END);
+	for (size_t seg = first; seg < column->sealed_segments; seg++) {
+		PackedSegment* packed = column->packed[seg];
+		if (packed == NULL) {
+			continue;
+		}
+		PackedRecordHeader header;
+		header.segment = seg;
+		header.checksum = packed_record_checksum(&header, packed);
+		if (write_fully(fd, &header, sizeof(header), offset) == -1 ||
+				write_fully(fd, packed, packed->size, offset + sizeof(header)) == -1) {
+			close(fd);
+			log_err("Writing packed segment file failed\n");
+			return -1;
+		}
+		offset += sizeof(header) + packed->size;
+		checkpoint_throttle(sizeof(header) + packed->size);
+	}
+	if (fdatasync(fd) == -1) {
+		close(fd);
+		log_err("Syncing packed segment file failed\n");
+		return -1;
+	}
+	close(fd);
+
+	column->packed_persisted = column->sealed_segments;
+	column->packed_rewrite = false;
+	return 0;
+}
+
+/*
+ * Read back the packed segments of a column being loaded and drop their
+ * plain values. Only full segments below the table length are taken.
+ */
+static void load_packed(Table* table, Column* column, CatalogColumn* entry) {
+	size_t full_segments = table->table_length / SEGMENT_VALUES;
+	column->sealed_segments = entry->sealed_segments < full_segments ? entry->sealed_segments : full_segments;
+	column->packed_persisted = column->sealed_segments;
+	if (entry->encoding != COLUMN_ENCODING_PACKED) {
+		return;
+	}
+
+	char path[MAX_SIZE_NAME * 2 + strlen(MAINDIR) + 16];
+	packed_file_path(path, table, column);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		log_err("Opening packed segment file failed\n");
+		return;
+	}
+	struct stat st;
+	char* buffer = NULL;
+	size_t size = 0;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		size = st.st_size;
+		buffer = malloc(size);
+		if (pread(fd, buffer, size, 0) != (ssize_t) size) {
+			size = 0;
+		}
+	}
+	close(fd);
+
+	size_t offset = 0;
+	while (offset + sizeof(PackedRecordHeader) + sizeof(PackedSegment) <= size) {
+		PackedRecordHeader* header = (PackedRecordHeader*) (buffer + offset);
+		PackedSegment* packed = (PackedSegment*) (header + 1);
+		if (packed->size < sizeof(PackedSegment) || packed->size > size - offset - sizeof(PackedRecordHeader) ||
+				packed_record_checksum(header, packed) != header->checksum) {
+			break;
+		}
+		size_t seg = header->segment;
+		if (seg < full_segments && packed->num_values == SEGMENT_VALUES) {
+			free(column->packed[seg]);
+			column->packed[seg] = malloc(packed->size);
+			memcpy(column->packed[seg], packed, packed->size);
+			release_segment(column, seg);
+			if (seg + 1 > column->sealed_segments) {
+				column->sealed_segments = column->packed_persisted = seg + 1;
+			}
+		}
+		offset += sizeof(PackedRecordHeader) + packed->size;
+	}
+	free(buffer);
+}
+
+/*
+ * Return the disk space of the plain values of the packed segments among
+ * [from, packed_persisted) to the file system. Only done once a catalog
+ * referring to the .packed file is in place.
+ */
+static void punch_packed(Table* table, Column* column, size_t from) {
+	if (from >= column->packed_persisted) {
+		return;
+	}
+	int fd = column->fd;
+	if (fd < 0) {
+		char path[MAX_SIZE_NAME * 2 + strlen(MAINDIR) + 8];
+		sprintf(path, "%s/%s.%s.data", MAINDIR, table->name, column->name);
+		fd = open(path, O_RDWR);
+		if (fd < 0) {
+			return;
+		}
+	}
+	for (size_t seg = from; seg < column->packed_persisted; seg++) {
+		if (column->packed[seg]) {
+			fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, seg * SEGMENT_BYTES, SEGMENT_BYTES);
+		}
+	}
+	if (column->fd < 0) {
+		close(fd);
+	}
+}
+
+/*
+ * Write the changes of a column to its persistence file: the values appended
+ * since the last time it was persisted plus any pages modified in place.
+ * Mapped columns already live in their file, so only those ranges of the
+ * mapping have to be flushed; heap columns write them with pwrite.
+ */
+static int persist_column(Table* table, Column* column) {
+	size_t length = table->table_length;
+	size_t persisted = column->persisted_length < length ? column->persisted_length : length;
+	size_t end_page = (persisted + DIRTY_PAGE_VALUES - 1) / DIRTY_PAGE_VALUES;
+	size_t run_end;
+
+	int fd = column->fd;
+	if (column->fd < 0) {
+		// Set the path name
+		char path[MAX_SIZE_NAME * 2 + strlen(MAINDIR) + 8];
+		sprintf(path, "%s/%s.%s.data", MAINDIR, table->name, column->name);
+
+		// Open/create the file, a column that was never persisted starts from scratch
+		int flags = O_RDWR | O_CREAT | (column->persisted_length == 0 ? O_TRUNC : 0);
+		fd = open(path, flags, 0600);
+		if (fd < 0) {
+			log_err("Opening persistence file failed\n");
+			return -1;
+		}
+	}
+
+	// Write the pages modified in place
+	for (size_t page = next_dirty_run(column, 0, end_page, &run_end); page < end_page;
+			page = next_dirty_run(column, run_end, end_page, &run_end)) {
+		size_t from = page * DIRTY_PAGE_VALUES;
+		size_t to = run_end * DIRTY_PAGE_VALUES < persisted ? run_end * DIRTY_PAGE_VALUES : persisted;
+		if (write_range(column, fd, from, to) == -1) {
+			if (column->fd < 0) {
+				close(fd);
+			}
+			return -1;
+		}
+	}
+
+	// Append the values past the high-water mark, msync wants a page aligned
+	// start so mapped columns round it down
+	size_t from = column->fd >= 0 ? persisted / DIRTY_PAGE_VALUES * DIRTY_PAGE_VALUES : persisted;
+	if (write_range(column, fd, from, length) == -1) {
+		if (column->fd < 0) {
+			close(fd);
+		}
+		return -1;
+	}
+
+	if (column->fd < 0 || column->private_from < column->num_segments) {
+		// Flush the file to disk
+		if (fdatasync(fd) == -1) {
+			if (column->fd < 0) {
+				close(fd);
+			}
+			log_err("Syncing file failed\n");
+			return -1;
+		}
+	}
+	if (column->fd < 0) {
+		close(fd);
+	}
+
+	if (persist_packed(table, column) == -1 || persist_zones(table, column) == -1) {
+		return -1;
+	}
+
+	column->persisted_length = length;
+	memset(column->dirty_pages, 0, dirty_words(table->table_capacity) * sizeof(uint64_t));
+	return 0;
+}
+
+
+/*
+ * A column to persist or pack on the worker pool.
+ */
+typedef struct ColumnTask {
+	Table* table;
+	Column* column;
+	// Packed segments from here on had their plain values on disk until now
+	size_t punch_from;
+	int result;
+} ColumnTask;
+
+/*
+ * Lists every column of the current database as a task.
+ */
+static ColumnTask* column_tasks(size_t* num_tasks) {
+	*num_tasks = 0;
+	for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
+		*num_tasks += current_db->tables[tbl]->col_count;
+	}
+
+	ColumnTask* tasks = calloc(*num_tasks, sizeof(ColumnTask));
+	size_t i = 0;
+	for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
+		Table* table = current_db->tables[tbl];
+		for (size_t col = 0; col < table->col_count; col++, i++) {
+			tasks[i].table = table;
+			tasks[i].column = table->columns[col];
+		}
+	}
+	return tasks;
+}
+
+static void persist_column_task(void* context, size_t index) {
+	ColumnTask* task = (ColumnTask*) context + index;
+	task->punch_from = task->column->packed_persisted;
+	// Columns that were never loaded haven't changed
+	task->result = task->column->catalog_entry ? 0 : persist_column(task->table, task->column);
+}
+
+/*
+ * Pack the full segments of a column persisted since it was last packed.
+ * Segments that don't pack well enough stay plain for good.
+ */
+static void compress_column_task(void* context, size_t index) {
+	Column* column = ((ColumnTask*) context + index)->column;
+	if (column->catalog_entry) {
+		return;
+	}
+	size_t full_segments = column->persisted_length / SEGMENT_VALUES;
+	for (size_t seg = column->sealed_segments; seg < full_segments; seg++) {
+		PackedSegment* packed = pack_segment(column->segments[seg], SEGMENT_VALUES,
+			column->zones[seg].min, column->zones[seg].max);
+		if (packed) {
+			column->packed[seg] = packed;
+			release_segment(column, seg);
+		}
+	}
+	if (full_segments > column->sealed_segments) {
+		column->sealed_segments = full_segments;
+	}
+}
+
+void compress_columns() {
+	if (!COLUMN_COMPRESSION || !current_db) {
+		return;
+	}
+	size_t num_columns;
+	ColumnTask* tasks = column_tasks(&num_columns);
+	parallel_for(num_columns, compress_column_task, tasks);
+	free(tasks);
+}
+
+Status persist_database(uint64_t checkpoint_lsn) {
+	Status ret_status;
+
+	// Create new directory for database
+	struct stat st;
+	if (stat(MAINDIR, &st) == -1) {
+		mkdir(MAINDIR, 0777);
+	}
+
+	// Store columns of every table as files, one task per column
+	size_t num_columns;
+	ColumnTask* tasks = column_tasks(&num_columns);
+	parallel_for(num_columns, persist_column_task, tasks);
+	ret_status.code = OK;
+	for (size_t i = 0; i < num_columns; i++) {
+		if (tasks[i].result == -1) {
+			ret_status.code = ERROR;
+		}
+	}
+
+	// Only once the columns are on disk can the catalog point at them
+	// and the log records they contain be dropped
+	if (ret_status.code == OK) {
+		ret_status = write_catalog(checkpoint_lsn);
+	}
+	if (ret_status.code == OK) {
+		for (size_t i = 0; i < num_columns; i++) {
+			punch_packed(tasks[i].table, tasks[i].column, tasks[i].punch_from);
+		}
+	}
+	free(tasks);
+	return ret_status;
+}
+
+bool database_has_changes() {
+	if (!current_db) {
+		return false;
+	}
+	for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
+		Table* table = current_db->tables[tbl];
+		for (size_t col = 0; col < table->col_count; col++) {
+			Column* column = table->columns[col];
+			if (column->catalog_entry) {
+				continue;
+			}
+			if (column->persisted_length != table->table_length ||
+					column->packed_persisted != column->sealed_segments || column->packed_rewrite) {
+				return true;
+			}
+			size_t words = dirty_words(column->persisted_length);
+			for (size_t word = 0; word < words; word++) {
+				if (column->dirty_pages[word]) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+void checkpoint_started() {
+	for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
+		Table* table = current_db->tables[tbl];
+		for (size_t col = 0; col < table->col_count; col++) {
+			// The checkpoint writes these pages, later changes go to a fresh bitmap
+			Column* column = table->columns[col];
+			if (column->catalog_entry) {
+				continue;
+			}
+			column->checkpoint_length = table->table_length;
+			column->checkpoint_dirty_pages = column->dirty_pages;
+			column->dirty_pages = calloc(dirty_words(table->table_capacity), sizeof(uint64_t));
+			column->packed_rewrite = false;
+		}
+	}
+}
+
+void checkpoint_finished(bool success) {
+	if (!current_db) {
+		return;
+	}
+	for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
+		Table* table = current_db->tables[tbl];
+		for (size_t col = 0; col < table->col_count; col++) {
+			Column* column = table->columns[col];
+			// Columns created since the checkpoint started were not part of it
+			if (column->checkpoint_dirty_pages == NULL) {
+				continue;
+			}
+			if (success) {
+				if (column->checkpoint_length > column->persisted_length) {
+					column->persisted_length = column->checkpoint_length;
+				}
+				// Segments are only packed before a checkpoint starts
+				column->packed_persisted = column->sealed_segments;
+			} else {
+				size_t words = dirty_words(column->persisted_length);
+				for (size_t word = 0; word < words; word++) {
+					column->dirty_pages[word] |= column->checkpoint_dirty_pages[word];
+				}
+				// The .packed file may have been left half written
+				column->packed_rewrite = true;
+			}
+			free(column->checkpoint_dirty_pages);
+			column->checkpoint_dirty_pages = NULL;
+			column->checkpoint_length = 0;
+		}
+	}
+}
+
+
+/*
+ * Here you will create a table object. The Status object can be used to return
+ * to the caller that there was an error in table creation
+ */
+Table* create_table(Db* db, const char* name, size_t num_columns, Status* ret_status) {
+	if (db != current_db) {
+		log_err("Error creating table. Requested db is not the current db.\n");
+		ret_status->code = ERROR;
+		return NULL;
+	}
+
+	// If there is no more capacity in the db
+	if (db->tables_size == db->tables_capacity) {
+		size_t new_capacity;
+		if (db->tables_capacity == 0) {
+			// If the original capacity is 0, calloc 1 table
+			new_capacity = 1;
+			db->tables = calloc(new_capacity, sizeof(Table*));
+		} else {
+			// Otherwise, double the capacity and realloc
+			new_capacity = db->tables_capacity * 2;
+			db->tables = realloc(db->tables, new_capacity * sizeof(Table*));
+		}
+		db->tables_capacity = new_capacity;
+	}
+
+	// Add the table and adjust the size of the db
+	// tables_size acts as the index
+	Table* table = malloc(sizeof(Table));
+	db->tables[db->tables_size] = table;
+	db->tables_size++;
+
+	// Initialize the table fields
+	strcpy(table->name, name);
+	// table->name[strlen(name)] = '\0';
+	table->columns = calloc(num_columns, sizeof(Column*));
+	table->col_count = num_columns;
+	table->col_idx = 0;
+	table->table_length = 0;
+	table->table_capacity = 0;
+
+	ret_status->code = OK;
+	return table;
+}
+
+
+/*
+ * Similarly, this method is meant to create a database.
+ */
+Status create_db(const char* db_name) {
+	Status ret_status;
+
+	if (current_db) {
+		for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
+			Table* table = current_db->tables[tbl];
+			for (size_t col = 0; col < table->col_count; col++) {
+				release_column(table->columns[col]);
+			}
+			free(table->columns);
+			free(table);
+		}
+		free(current_db->tables);
+		free(current_db);
+	}
+
+	current_db = malloc(sizeof(Db));
+	strcpy(current_db->name, db_name);
+	current_db->tables = NULL;
+	current_db->tables_size = 0;
+	current_db->tables_capacity = 0;
+
+	ret_status.code = OK;
+	return ret_status;
+}
+
+
+/*
+ * Create column
+ */
+Column* create_column(Table* table, char* name, int sorted, Status* ret_status) {
+	(void) sorted;
+
+	if (table->col_idx == table->col_count) {
+		log_err("Error creating column. Table is full\n");
+		ret_status->code = ERROR;
+		return NULL;
+	}
+
+	// Add the column
+	Column* column = malloc(sizeof(Column));
+	table->columns[table->col_idx] = column;
+	table->col_idx++;
+
+	// Initialize column fields
+	strcpy(column->name, name);
+	// column->name[strlen(name)] = '\0';
+	column->segments = NULL;
+	column->num_segments = 0;
+	column->zones = NULL;
+	column->packed = NULL;
+	column->sealed_segments = 0;
+	column->packed_persisted = 0;
+	column->packed_rewrite = false;
+	column->index = NULL;
+	column->length = 0;
+	column->fd = -1;
+	column->private_from = SIZE_MAX;
+	column->persisted_length = 0;
+	column->dirty_pages = NULL;
+	column->checkpoint_length = 0;
+	column->checkpoint_dirty_pages = NULL;
+	column->catalog_entry = NULL;
+	column->accesses = 0;
+	stats_reset(&column->stats);
+
+	// Columns added to a table with rows get segments for all of them
+	if (add_segments(column, table->table_capacity / SEGMENT_VALUES) == -1) {
+		log_err("Error creating column. Out of memory\n");
+		ret_status->code = ERROR;
+		return column;
+	}
+
+	ret_status->code = OK;
+	return column;
+}
+
+
+/*
+ * Give every column of a table segments for at least num_rows rows.
+ */
+static int reserve_rows(Table* table, size_t num_rows) {
+	if (num_rows <= table->table_capacity) {
+		return 0;
+	}
+	size_t num_segments = segment_count(num_rows);
+	for (size_t i = 0; i < table->col_count; i++) {
+		if (add_segments(table->columns[i], num_segments) == -1) {
+			return -1;
+		}
+	}
+	table->table_capacity = num_segments * SEGMENT_VALUES;
+	return 0;
+}
+
+/*
+ * Widen the zone maps of a segment by the rows appended to it.
+ */
+typedef struct AppendZones {
+	Table* table;
+	size_t from;
+	size_t to;
+} AppendZones;
+
+static void append_zones_task(void* context, size_t index) {
+	AppendZones* append = (AppendZones*) context;
+	size_t seg = (append->from >> SEGMENT_SHIFT) + index;
+	size_t first = seg << SEGMENT_SHIFT > append->from ? seg << SEGMENT_SHIFT : append->from;
+	size_t last = (seg + 1) << SEGMENT_SHIFT < append->to ? (seg + 1) << SEGMENT_SHIFT : append->to;
+	for (size_t col = 0; col < append->table->col_count; col++) {
+		Column* column = append->table->columns[col];
+		ZoneMap* zone = &column->zones[seg];
+		const int* values = column->segments[seg];
+		for (size_t i = first & SEGMENT_MASK; i < (first & SEGMENT_MASK) + (last - first); i++) {
+			if (values[i] < zone->min) {
+				zone->min = values[i];
+			}
+			if (values[i] > zone->max) {
+				zone->max = values[i];
+			}
+		}
+	}
+}
+
+/*
+ * Add the rows appended to a column to its statistics.
+ */
+static void append_stats_task(void* context, size_t index) {
+	AppendZones* append = (AppendZones*) context;
+	Column* column = append->table->columns[index];
+	for (size_t start = append->from; start < append->to; ) {
+		size_t seg = start >> SEGMENT_SHIFT;
+		size_t end = (seg + 1) << SEGMENT_SHIFT < append->to ? (seg + 1) << SEGMENT_SHIFT : append->to;
+		stats_add(&column->stats, column->segments[seg] + (start & SEGMENT_MASK), end - start);
+		start = end;
+	}
+}
+
+/*
+ * Make the rows written past the end of a table up to length part of it.
+ */
+static void commit_rows(Table* table, size_t length) {
+	if (length <= table->table_length) {
+		return;
+	}
+	AppendZones zones = { table, table->table_length, length };
+	size_t num_segments = segment_count(length) - (table->table_length >> SEGMENT_SHIFT);
+	parallel_for(num_segments, append_zones_task, &zones);
+
+	// Columns are added to their statistics on the workers once there's a segment's worth
+	if (length - table->table_length >= SEGMENT_VALUES) {
+		parallel_for(table->col_count, append_stats_task, &zones);
+	} else {
+		for (size_t col = 0; col < table->col_count; col++) {
+			append_stats_task(&zones, col);
+		}
+	}
+	for (size_t col = 0; col < table->col_count; col++) {
+		table->columns[col]->length = length;
+	}
+	table->table_length = length;
+}
+
+/*
+ * A column slice to copy past the end of its table.
+ */
+typedef struct AppendCopy {
+	Table* table;
+	const int* const* values;
+	size_t num_rows;
+} AppendCopy;
+
+static void append_copy_task(void* context, size_t index) {
+	AppendCopy* copy = (AppendCopy*) context;
+	Column* column = copy->table->columns[index];
+	const int* values = copy->values[index];
+	size_t row = copy->table->table_length;
+	for (size_t done = 0; done < copy->num_rows; ) {
+		size_t offset = (row + done) & SEGMENT_MASK;
+		size_t count = SEGMENT_VALUES - offset < copy->num_rows - done ? SEGMENT_VALUES - offset : copy->num_rows - done;
+		memcpy(column->segments[(row + done) >> SEGMENT_SHIFT] + offset, values + done, count * sizeof(int));
+		done += count;
+	}
+}
+
+Status append_rows(Table* table, const int* const* values, size_t num_rows) {
+	Status ret_status = load_columns(table);
+	if (ret_status.code != OK) {
+		return ret_status;
+	}
+	if (reserve_rows(table, table->table_length + num_rows) == -1) {
+		ret_status.code = ERROR;
+		return ret_status;
+	}
+
+	// Columns are copied on the workers once there's a segment's worth
+	AppendCopy copy = { table, values, num_rows };
+	if (num_rows >= SEGMENT_VALUES) {
+		parallel_for(table->col_count, append_copy_task, &copy);
+	} else {
+		for (size_t col = 0; col < table->col_count; col++) {
+			append_copy_task(&copy, col);
+		}
+	}
+	commit_rows(table, table->table_length + num_rows);
+	return ret_status;
+}
+
+// Insert into table
+Status relational_insert(Table* table, int* values) {
+	const int* columns[table->col_count + 1];
+	for (size_t i = 0; i < table->col_count; i++) {
+		columns[i] = &values[i];
+	}
+	Status ret_status = append_rows(table, columns, 1);
+	free(values);
+	return ret_status;
+}
+
+
+
+/*
+ * Pairs of the values of rows [from, to) of a column with the rows' offsets
+ * from from, for sort_pairs(). NULL if they don't fit.
+ */
+static uint64_t* column_pairs(Column* column, size_t from, size_t to) {
+	if (to - from > UINT32_MAX) {
+		log_err("Too many rows to sort\n");
+		return NULL;
+	}
+	uint64_t* pairs = malloc((to - from) * sizeof(uint64_t));
+	if (pairs == NULL) {
+		return NULL;
+	}
+	int* scratch = NULL;
+	for (size_t start = from; start < to; ) {
+		size_t seg = start >> SEGMENT_SHIFT;
+		size_t end = (seg + 1) << SEGMENT_SHIFT < to ? (seg + 1) << SEGMENT_SHIFT : to;
+		const int* values = segment_values(column, seg, &scratch);
+		for (size_t row = start; row < end; row++) {
+			pairs[row - from] = sort_pair(values[row & SEGMENT_MASK], row - from);
+		}
+		start = end;
+	}
+	free(scratch);
+	return pairs;
+}
+
+/*
+ * The first of rows [0, length) of a column sorted on its values whose value
+ * is at least value, or length. The zone maps of the sorted segments are in
+ * order, so they narrow the search down to a single segment.
+ */
+static size_t clustered_lower_bound(Column* column, size_t length, long int value) {
+	size_t num_segments = segment_count(length);
+	size_t low = 0;
+	size_t high = num_segments;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (column->zones[middle].max < value) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if (low == num_segments) {
+		return length;
+	}
+
+	size_t seg = low;
+	int* scratch = NULL;
+	const int* values = segment_values(column, seg, &scratch);
+	low = 0;
+	high = segment_length(length, seg);
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (values[middle] < value) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	free(scratch);
+	return (seg << SEGMENT_SHIFT) + low;
+}
+
+/*
+ * Rows [from, to) of a table to reorder: row from + i receives the row at
+ * offset pair_payload(pairs[i]) from from.
+ */
+typedef struct Permutation {
+	Table* table;
+	const uint64_t* pairs;
+	size_t from;
+	size_t to;
+} Permutation;
+
+static void permute_column_task(void* context, size_t index) {
+	Permutation* permutation = (Permutation*) context;
+	Column* column = permutation->table->columns[index];
+	size_t from = permutation->from;
+	size_t to = permutation->to;
+
+	int* values = malloc((to - from) * sizeof(int));
+	read_column(column, from, to - from, values);
+	int* scratch = NULL;
+	for (size_t start = from; start < to; ) {
+		size_t seg = start >> SEGMENT_SHIFT;
+		size_t end = (seg + 1) << SEGMENT_SHIFT < to ? (seg + 1) << SEGMENT_SHIFT : to;
+		int* segment = column->segments[seg];
+		for (size_t row = start; row < end; row++) {
+			segment[row & SEGMENT_MASK] = values[pair_payload(permutation->pairs[row - from])];
+		}
+		compute_zone(column, seg, segment_length(to, seg), &scratch);
+		start = end;
+	}
+	mark_column_dirty(column, from, to);
+	free(scratch);
+	free(values);
+}
+
+/*
+ * Sort the rows appended past the clustered index of a table into place.
+ * Only the new rows are sorted; the sorted rows from the first one with a
+ * value above the smallest new value are merged with them, and the table is
+ * rewritten from there. Returns the first row that moved.
+ */
+static int cluster_rows(Table* table, Column* column, size_t* moved_from) {
+	size_t sorted = column->index->length;
+	size_t length = table->table_length;
+	uint64_t* added = column_pairs(column, sorted, length);
+	if (added == NULL) {
+		return -1;
+	}
+	sort_pairs(added, length - sorted);
+
+	// Rows with a value equal to a new one stay ahead of it
+	size_t from = clustered_lower_bound(column, sorted, (long int) pair_key(added[0]) + 1);
+	uint64_t* pairs = added;
+	if (from < sorted) {
+		uint64_t* kept = column_pairs(column, from, sorted);
+		pairs = kept ? malloc((length - from) * sizeof(uint64_t)) : NULL;
+		if (pairs == NULL) {
+			free(kept);
+			free(added);
+			return -1;
+		}
+		size_t i = 0;
+		size_t j = 0;
+		for (size_t k = 0; k < length - from; k++) {
+			if (j == length - sorted || (i < sorted - from && pair_key(kept[i]) <= pair_key(added[j]))) {
+				pairs[k] = kept[i++];
+			} else {
+				pairs[k] = sort_pair(pair_key(added[j]), pair_payload(added[j]) + (sorted - from));
+				j++;
+			}
+		}
+		free(kept);
+		free(added);
+	}
+
+	// Packed segments in the way get their plain values back first, mapped
+	// ones are moved on private pages
+	for (size_t col = 0; col < table->col_count; col++) {
+		if (privatize_segments(table->columns[col], from >> SEGMENT_SHIFT) == -1 ||
+				unseal_segments(table->columns[col], from >> SEGMENT_SHIFT) == -1) {
+			free(pairs);
+			return -1;
+		}
+	}
+	Permutation permutation = { table, pairs, from, length };
+	parallel_for(table->col_count, permute_column_task, &permutation);
+	free(pairs);
+
+	column->index->length = length;
+	*moved_from = from;
+	return 0;
+}
+
+/*
+ * Bring an unclustered index up to rows [0, length) of its column.
+ */
+static int extend_index(Column* column, size_t length) {
+	ColumnIndex* index = column->index;
+	size_t indexed = index->length;
+	if (indexed >= length) {
+		return 0;
+	}
+	uint64_t* pairs = column_pairs(column, indexed, length);
+	if (pairs == NULL) {
+		return -1;
+	}
+	sort_pairs(pairs, length - indexed);
+	int result = index_merge(index, pairs, length - indexed, indexed);
+	free(pairs);
+	return result;
+}
+
+Status update_indexes(Table* table, size_t pending) {
+	Status ret_status;
+	ret_status.code = OK;
+
+	// The clustered index goes first, as it moves rows under the others
+	size_t moved_from = table->table_length;
+	for (size_t col = 0; col < table->col_count; col++) {
+		Column* column = table->columns[col];
+		if (column->index && (column->index->flags & INDEX_CLUSTERED) &&
+				column->index->length + pending < table->table_length) {
+			ret_status = load_columns(table);
+			if (ret_status.code != OK) {
+				return ret_status;
+			}
+			if (cluster_rows(table, column, &moved_from) == -1) {
+				log_err("Sorting %s on %s failed\n", table->name, column->name);
+				ret_status.code = ERROR;
+				return ret_status;
+			}
+		}
+	}
+
+	// Unclustered indexes of columns not loaded yet are built on loading
+	for (size_t col = 0; col < table->col_count; col++) {
+		Column* column = table->columns[col];
+		if (column->index == NULL || (column->index->flags & INDEX_CLUSTERED) || column->catalog_entry) {
+			continue;
+		}
+		if (column->index->length > moved_from) {
+			index_clear(column->index);
+		} else if (column->index->length + pending >= table->table_length) {
+			continue;
+		}
+		if (extend_index(column, table->table_length) == -1) {
+			log_err("Building index on %s.%s failed\n", table->name, column->name);
+			ret_status.code = ERROR;
+			return ret_status;
+		}
+	}
+	return ret_status;
+}
+
+Status merge_pending_rows() {
+	Status ret_status;
+	ret_status.code = OK;
+	for (size_t tbl = 0; current_db && tbl < current_db->tables_size && ret_status.code == OK; tbl++) {
+		ret_status = update_indexes(current_db->tables[tbl], 0);
+	}
+	return ret_status;
+}
+
+Status create_index(Table* table, Column* column, uint32_t type, uint32_t flags) {
+	Status ret_status;
+	ret_status.code = ERROR;
+
+	if (column->index) {
+		log_err("Column %s already has an index\n", column->name);
+		return ret_status;
+	}
+	for (size_t col = 0; col < table->col_count && (flags & INDEX_CLUSTERED); col++) {
+		ColumnIndex* index = table->columns[col]->index;
+		if (index && (index->flags & INDEX_CLUSTERED)) {
+			log_err("Table %s already has a clustered index\n", table->name);
+			return ret_status;
+		}
+	}
+
+	// The indexes already there catch up first, so that all cover the same rows
+	ret_status = update_indexes(table, 0);
+	if (ret_status.code != OK) {
+		return ret_status;
+	}
+	ret_status = load_column(table, column);
+	if (ret_status.code != OK) {
+		return ret_status;
+	}
+	column->index = create_column_index(type, flags);
+	return update_indexes(table, 0);
+}
+
+typedef enum ZoneMatch {
+	ZONE_NONE,
+	ZONE_SOME,
+	ZONE_ALL
+} ZoneMatch;
+
+/*
+ * Whether none, some or all of the values of a segment lie in [low, high).
+ */
+static ZoneMatch match_zone(const ZoneMap* zone, long int low, long int high) {
+	if (zone->min > zone->max || zone->max < low || zone->min >= high) {
+		return ZONE_NONE;
+	}
+	if (zone->min >= low && zone->max < high) {
+		return ZONE_ALL;
+	}
+	return ZONE_SOME;
+}
+
+// Bytes of a position of an INDEX or INDEX32 result
+static size_t position_width(DataType form) {
+	return form == INDEX32 ? sizeof(uint32_t) : sizeof(size_t);
+}
+
+/*
+ * The smallest form for num_tuples positions below limit: a bitmap of limit
+ * bits or a list of 32-bit positions when they fit, 64-bit ones otherwise.
+ */
+static DataType preferred_form(size_t num_tuples, size_t limit) {
+	size_t width = limit <= (size_t) UINT32_MAX + 1 ? sizeof(uint32_t) : sizeof(size_t);
+	size_t bitmap_bytes = (limit + 63) / 64 * sizeof(uint64_t);
+	if (bitmap_bytes < num_tuples * width) {
+		return BITMAP;
+	}
+	return width == sizeof(uint32_t) ? INDEX32 : INDEX;
+}
+
+/*
+ * Give a result an empty payload of the given form, a bitmap covering
+ * positions [0, limit).
+ */
+static void init_positions(Result* result, DataType form, size_t limit) {
+	free(result->payload);
+	result->data_type = form;
+	result->num_tuples = 0;
+	if (form == BITMAP) {
+		result->capacity = limit;
+		result->payload = calloc((limit + 63) / 64 + 1, sizeof(uint64_t));
+	} else {
+		result->capacity = DEFAULT_COL_SIZE;
+		result->payload = malloc(DEFAULT_COL_SIZE * position_width(form));
+	}
+}
+
+// One past the largest position of a result, 0 if it has none
+static size_t position_limit(const Result* result) {
+	if (result->data_type == BITMAP) {
+		return result->capacity;
+	} else if (result->num_tuples == 0) {
+		return 0;
+	} else if (result->data_type == INDEX32) {
+		return (size_t) ((uint32_t*) result->payload)[result->num_tuples - 1] + 1;
+	}
+	return ((size_t*) result->payload)[result->num_tuples - 1] + 1;
+}
+
+/*
+ * Settle a select result on the smallest form for the positions it ended up
+ * with, converting it if need be.
+ */
+static void finish_positions(Result* result) {
+	size_t limit = position_limit(result);
+	DataType form = preferred_form(result->num_tuples, limit);
+	if (form == result->data_type) {
+		return;
+	}
+
+	void* payload;
+	size_t capacity;
+	PositionCursor cursor;
+	position_cursor_init(&cursor, result);
+	if (form == BITMAP) {
+		uint64_t* words = calloc((limit + 63) / 64 + 1, sizeof(uint64_t));
+		for (size_t i = 0; i < result->num_tuples; i++) {
+			size_t position = next_position(&cursor);
+			words[position >> 6] |= (uint64_t) 1 << (position & 63);
+		}
+		payload = words;
+		capacity = limit;
+	} else {
+		capacity = result->num_tuples > 0 ? result->num_tuples : 1;
+		payload = malloc(capacity * position_width(form));
+		for (size_t i = 0; i < result->num_tuples; i++) {
+			if (form == INDEX32) {
+				((uint32_t*) payload)[i] = (uint32_t) next_position(&cursor);
+			} else {
+				((size_t*) payload)[i] = next_position(&cursor);
+			}
+		}
+	}
+	free(result->payload);
+	result->payload = payload;
+	result->capacity = capacity;
+	result->data_type = form;
+}
+
+/*
+ * Make room for count more positions in a list result.
+ */
+static void reserve_positions(Result* result, size_t count) {
+	if (result->num_tuples + count > result->capacity) {
+		while (result->num_tuples + count > result->capacity) {
+			result->capacity = result->capacity * 2;
+		}
+		result->payload = realloc(result->payload, result->capacity * position_width(result->data_type));
+	}
+}
+
+/*
+ * Append the positions [first, first + count) to a result.
+ */
+static void append_position_range(Result* result, size_t first, size_t count) {
+	if (result->data_type == BITMAP) {
+		uint64_t* words = (uint64_t*) result->payload;
+		for (size_t position = first; position < first + count; ) {
+			size_t bit = position & 63;
+			size_t bits = 64 - bit < first + count - position ? 64 - bit : first + count - position;
+			words[position >> 6] |= (bits == 64 ? ~(uint64_t) 0 : (((uint64_t) 1 << bits) - 1)) << bit;
+			position += bits;
+		}
+		result->num_tuples += count;
+		return;
+	}
+
+	reserve_positions(result, count);
+	for (size_t i = 0; i < count; i++) {
+		if (result->data_type == INDEX32) {
+			((uint32_t*) result->payload)[result->num_tuples + i] = (uint32_t) (first + i);
+		} else {
+			((size_t*) result->payload)[result->num_tuples + i] = first + i;
+		}
+	}
+	result->num_tuples += count;
+}
+
+// Operators spread over the workers once they cover this many values
+#define PARALLEL_SCAN_VALUES (4 * SEGMENT_VALUES)
+
+/*
+ * Number of morsels to split num_units units of unit_values values each
+ * into: a few per worker, or a single one when there are no workers or too
+ * little work to be worth spreading. Morsel i covers units [morsel_start(i), morsel_start(i + 1)).
+ */
+static size_t morsel_count(size_t num_units, size_t unit_values) {
+	if (thread_pool_size() == 1 || num_units * unit_values < PARALLEL_SCAN_VALUES) {
+		return 1;
+	}
+	size_t num_morsels = thread_pool_size() * 4;
+	return num_morsels < num_units ? num_morsels : num_units;
+}
+
+static size_t morsel_start(size_t morsel, size_t num_morsels, size_t num_units) {
+	return morsel * num_units / num_morsels;
+}
+
+/*
+ * A morsel of a select result: entries [begin, end) of a list or words
+ * [begin, end) of a bitmap, holding its positions offset to offset + count.
+ */
+typedef struct PositionMorsel {
+	size_t begin;
+	size_t end;
+	size_t offset;
+	size_t count;
+} PositionMorsel;
+
+/*
+ * Split the positions of a select result into morsels, as many as are worth
+ * spreading over the workers. Returns them, their number in num_morsels.
+ */
+static PositionMorsel* split_positions(const Result* positions, size_t* num_morsels) {
+	bool bitmap = positions->data_type == BITMAP;
+	size_t num_units = bitmap ? (positions->capacity + 63) / 64 : positions->num_tuples;
+	*num_morsels = morsel_count(num_units, bitmap ? 64 : 1);
+
+	PositionMorsel* morsels = malloc(*num_morsels * sizeof(PositionMorsel));
+	size_t offset = 0;
+	for (size_t m = 0; m < *num_morsels; m++) {
+		PositionMorsel* morsel = &morsels[m];
+		morsel->begin = morsel_start(m, *num_morsels, num_units);
+		morsel->end = morsel_start(m + 1, *num_morsels, num_units);
+		morsel->offset = offset;
+		morsel->count = morsel->end - morsel->begin;
+		if (bitmap && *num_morsels == 1) {
+			morsel->count = positions->num_tuples;
+		} else if (bitmap) {
+			morsel->count = 0;
+			for (size_t word = morsel->begin; word < morsel->end; word++) {
+				morsel->count += __builtin_popcountll(((uint64_t*) positions->payload)[word]);
+			}
+		}
+		offset += morsel->count;
+	}
+	return morsels;
+}
+
+// A cursor over the positions of a morsel
+static void morsel_cursor(PositionCursor* cursor, const Result* positions, const PositionMorsel* morsel) {
+	position_cursor_init(cursor, positions);
+	cursor->next = morsel->begin;
+	if (positions->data_type == BITMAP) {
+		cursor->bits = morsel->begin < morsel->end ? ((uint64_t*) positions->payload)[morsel->begin] : 0;
+	}
+}
+
+/*
+ * Append the positions of parts, in order, to a result of the same form.
+ * Parts of a bitmap share its payload, parts of a list are freed.
+ */
+static void gather_positions(Result* result, Result* parts, size_t num_parts) {
+	for (size_t i = 0; i < num_parts; i++) {
+		if (result->data_type == BITMAP) {
+			result->num_tuples += parts[i].num_tuples;
+			continue;
+		}
+		reserve_positions(result, parts[i].num_tuples);
+		size_t width = position_width(result->data_type);
+		memcpy((char*) result->payload + result->num_tuples * width, parts[i].payload, parts[i].num_tuples * width);
+		result->num_tuples += parts[i].num_tuples;
+		free(parts[i].payload);
+	}
+}
+
+// Unclustered indexes only pay off over a scan for selects estimated to
+// match at most this fraction of the rows, as their positions are sorted
+#define INDEX_MAX_SELECTIVITY 0.05
+
+/*
+ * Whether a select is answered from the index of its column: a clustered
+ * index always, an unclustered one if the select is selective enough. The
+ * rows inserts left past the index are scanned on top.
+ */
+static bool use_index(Column* column, long int low, long int high) {
+	ColumnIndex* index = column->index;
+	if (index == NULL || index->length + INDEX_PENDING_ROWS < column->length) {
+		return false;
+	}
+	return (index->flags & INDEX_CLUSTERED) ||
+		stats_selectivity(&column->stats, low, high) <= INDEX_MAX_SELECTIVITY;
+}
+
+static int compare_positions(const void* first, const void* second) {
+	size_t a = *(const size_t*) first;
+	size_t b = *(const size_t*) second;
+	return (a > b) - (a < b);
+}
+
+/*
+ * Give a select of a column an empty result of the form suiting the number
+ * of matches its statistics estimate, with room for them if it is a list.
+ */
+static void init_select(Column* column, long int low, long int high, Result* result) {
+	double selectivity = column->stats.count == column->length ? stats_selectivity(&column->stats, low, high) : 0;
+	size_t estimate = (size_t) (selectivity * column->length);
+	init_positions(result, preferred_form(estimate, column->length), column->length);
+	if (result->data_type != BITMAP) {
+		reserve_positions(result, estimate);
+	}
+}
+
+/*
+ * Append the positions of count values in [low, high) to a result, the
+ * first of them at position base. A bitmap needs base to be a multiple of 64.
+ */
+static void select_block(const int* values, size_t count, long int low, long int high, size_t base, Result* result) {
+	if (result->data_type == BITMAP) {
+		result->num_tuples += select_range_bitmap(values, count, low, high, (uint64_t*) result->payload + (base >> 6));
+		return;
+	}
+
+	// The list kernels may write a position for every value
+	reserve_positions(result, count);
+	if (result->data_type == INDEX32) {
+		result->num_tuples += select_range32(values, count, low, high, (uint32_t) base,
+			(uint32_t*) result->payload + result->num_tuples);
+	} else {
+		result->num_tuples += select_range(values, count, low, high, base,
+			(size_t*) result->payload + result->num_tuples);
+	}
+}
+
+/*
+ * Append the positions of the values of a column in [low, high) to a
+ * result, looked up in the column's index rather than scanned. They come out
+ * in ascending order, as a scan would produce them.
+ */
+static void select_index(Column* column, long int low, long int high, Result* result) {
+	ColumnIndex* index = column->index;
+	if (index->flags & INDEX_CLUSTERED) {
+		size_t first = clustered_lower_bound(column, index->length, low);
+		size_t last = clustered_lower_bound(column, index->length, high);
+		if (last > first) {
+			append_position_range(result, first, last - first);
+		}
+	} else {
+		size_t first = index_lower_bound(index, low);
+		size_t last = index_lower_bound(index, high);
+		if (last > first) {
+			size_t count = last - first;
+			reserve_positions(result, count);
+			size_t* indexes = (size_t*) result->payload + result->num_tuples;
+			memcpy(indexes, index->positions + first, count * sizeof(size_t));
+			qsort(indexes, count, sizeof(size_t), compare_positions);
+			result->num_tuples += count;
+		}
+	}
+
+	// The rows past the index come after all of its positions
+	int* scratch = NULL;
+	for (size_t start = index->length; start < column->length; ) {
+		size_t seg = start >> SEGMENT_SHIFT;
+		size_t end = (seg + 1) << SEGMENT_SHIFT < column->length ? (seg + 1) << SEGMENT_SHIFT : column->length;
+		const int* values = segment_values(column, seg, &scratch);
+		select_block(values + (start & SEGMENT_MASK), end - start, low, high, start, result);
+		start = end;
+	}
+	free(scratch);
+}
+
+/*
+ * Append the positions of the values in [low, high) of segments [first,
+ * last) of a column to a result, scanning the ones the zone maps can't decide.
+ */
+static void scan_segments(Column* column, long int low, long int high, size_t first, size_t last, Result* result) {
+	int* scratch = NULL;
+	for (size_t seg = first; seg < last; seg++) {
+		size_t count = segment_length(column->length, seg);
+		size_t base = seg << SEGMENT_SHIFT;
+
+		// Skip or take whole the segments the zone map decides
+		ZoneMatch match = match_zone(&column->zones[seg], low, high);
+		if (match == ZONE_NONE) {
+			continue;
+		} else if (match == ZONE_ALL) {
+			append_position_range(result, base, count);
+			continue;
+		}
+		select_block(segment_values(column, seg, &scratch), count, low, high, base, result);
+	}
+	free(scratch);
+}
+
+/*
+ * A scan of a column split into morsels of whole segments, each appending
+ * to its own part of the result.
+ */
+typedef struct ScanMorsels {
+	Column* column;
+	long int low;
+	long int high;
+	size_t num_morsels;
+	Result* parts;
+} ScanMorsels;
+
+static void scan_morsel_task(void* context, size_t index) {
+	ScanMorsels* scan = (ScanMorsels*) context;
+	size_t num_segments = segment_count(scan->column->length);
+	scan_segments(scan->column, scan->low, scan->high,
+		morsel_start(index, scan->num_morsels, num_segments),
+		morsel_start(index + 1, scan->num_morsels, num_segments), &scan->parts[index]);
+}
+
+/*
+ * Append the positions of the values of a column in [low, high) to a
+ * result, spreading the scan over the workers. The form of the result is
+ * picked from the estimated number of matches.
+ */
+static void scan_column(Column* column, long int low, long int high, Result* result) {
+	init_select(column, low, high, result);
+
+	size_t num_segments = segment_count(column->length);
+	size_t num_morsels = morsel_count(num_segments, SEGMENT_VALUES);
+	if (num_morsels == 1) {
+		scan_segments(column, low, high, 0, num_segments, result);
+		return;
+	}
+
+	// Segments cover whole bitmap words, so the parts of a bitmap can share it
+	Result parts[num_morsels];
+	for (size_t m = 0; m < num_morsels; m++) {
+		parts[m] = *result;
+		if (result->data_type != BITMAP) {
+			parts[m].payload = NULL;
+			init_positions(&parts[m], result->data_type, column->length);
+		}
+	}
+	ScanMorsels scan = { column, low, high, num_morsels, parts };
+	parallel_for(num_morsels, scan_morsel_task, &scan);
+	gather_positions(result, parts, num_morsels);
+}
+
+/*
+ * A select over the positions of a previous one split into morsels. A list
+ * morsel writes where its positions sit in the input, to be compacted after.
+ */
+typedef struct SelectMorsels {
+	Result* positions;
+	const int* values;
+	long int low;
+	long int high;
+	PositionMorsel* morsels;
+	size_t* selected;
+	Result* result;
+} SelectMorsels;
+
+static void select_morsel_task(void* context, size_t index) {
+	SelectMorsels* select = (SelectMorsels*) context;
+	PositionMorsel* morsel = &select->morsels[index];
+	const int* values = select->values + morsel->offset;
+	if (select->positions->data_type == BITMAP) {
+		select->selected[index] = select_bitmap_subset(values, (uint64_t*) select->positions->payload + morsel->begin,
+			morsel->end - morsel->begin, select->low, select->high, (uint64_t*) select->result->payload + morsel->begin);
+	} else if (select->positions->data_type == INDEX32) {
+		select->selected[index] = select_range_positions32(values, (uint32_t*) select->positions->payload + morsel->begin,
+			morsel->count, select->low, select->high, (uint32_t*) select->result->payload + morsel->begin);
+	} else {
+		select->selected[index] = select_range_positions(values, (size_t*) select->positions->payload + morsel->begin,
+			morsel->count, select->low, select->high, (size_t*) select->result->payload + morsel->begin);
+	}
+}
+
+/*
+ * Keep the positions of a previous select whose values, fetched in the same
+ * order, lie in [low, high). The result takes the form of the positions.
+ */
+static void select_positions(Result* positions, Result* values, long int low, long int high, Result* result) {
+	init_positions(result, positions->data_type, positions->capacity);
+	if (positions->data_type != BITMAP) {
+		reserve_positions(result, positions->num_tuples);
+	}
+
+	size_t num_morsels;
+	PositionMorsel* morsels = split_positions(positions, &num_morsels);
+	size_t selected[num_morsels];
+	SelectMorsels select = { positions, (int*) values->payload, low, high, morsels, selected, result };
+	parallel_for(num_morsels, select_morsel_task, &select);
+
+	size_t width = position_width(result->data_type);
+	for (size_t m = 0; m < num_morsels; m++) {
+		if (result->data_type != BITMAP) {
+			memmove((char*) result->payload + result->num_tuples * width,
+				(char*) result->payload + morsels[m].begin * width, selected[m] * width);
+		}
+		result->num_tuples += selected[m];
+	}
+	free(morsels);
+}
+
+/*
+ * Narrow [*low, *high) to the ints comparing to bound as type says.
+ */
+static void narrow_range(ComparatorType type, long int bound, long int* low, long int* high) {
+	long int from = LONG_MIN;
+	long int to = LONG_MAX;
+	if (type == LESS_THAN) {
+		to = bound;
+	} else if (type == LESS_THAN_OR_EQUAL) {
+		to = bound + 1;
+	} else if (type == GREATER_THAN) {
+		from = bound + 1;
+	} else if (type == GREATER_THAN_OR_EQUAL) {
+		from = bound;
+	} else if (type == EQUAL) {
+		from = bound;
+		to = bound + 1;
+	}
+	*low = from > *low ? from : *low;
+	*high = to < *high ? to : *high;
+}
+
+/*
+ * The values a comparator admits as [*low, *high), open sides stretching
+ * to the ends of long. Selects run on these ranges, the scan kernels pick
+ * the cheapest predicate for them.
+ */
+static void comparator_range(Comparator comparator, long int* low, long int* high) {
+	*low = LONG_MIN;
+	*high = LONG_MAX;
+	narrow_range(comparator.type1, comparator.p_low, low, high);
+	narrow_range(comparator.type2, comparator.p_high, low, high);
+}
+
+static Plan* new_plan(PlanType type, Column* column, Plan* first, Plan* second) {
+	Plan* plan = malloc(sizeof(Plan));
+	plan->type = type;
+	plan->column = column;
+	plan->low = 0;
+	plan->high = 0;
+	plan->first = first;
+	plan->second = second;
+	return plan;
+}
+
+static Plan* copy_plan(const Plan* plan) {
+	if (plan == NULL) {
+		return NULL;
+	}
+	Plan* copy = new_plan(plan->type, plan->column, copy_plan(plan->first), copy_plan(plan->second));
+	copy->low = plan->low;
+	copy->high = plan->high;
+	return copy;
+}
+
+static void free_plan(Plan* plan) {
+	if (plan == NULL) {
+		return;
+	}
+	free_plan(plan->first);
+	free_plan(plan->second);
+	free(plan);
+}
+
+// The select a plan starts from
+static const Plan* plan_select(const Plan* plan) {
+	while (plan->type != PLAN_SELECT) {
+		plan = plan->first;
+	}
+	return plan;
+}
+
+static bool same_select(const Plan* first, const Plan* second) {
+	return first->column == second->column && first->low == second->low && first->high == second->high;
+}
+
+// Fetches, sums and differences of a plan
+static size_t plan_steps(const Plan* plan) {
+	if (plan->type == PLAN_SELECT) {
+		return 0;
+	}
+	return 1 + plan_steps(plan->first) + (plan->second ? plan_steps(plan->second) : 0);
+}
+
+void free_result(Result* result) {
+	if (result == NULL) {
+		return;
+	}
+	free(result->payload);
+	free_plan(result->plan);
+	free(result);
+}
+
+Result* select_column(SelectOperator select_operator, ClientContext* context, Status* ret_status) {
+	Result* result = malloc(sizeof(Result));
+	result->num_tuples = 0;
+	result->capacity = DEFAULT_COL_SIZE;
+	result->plan = NULL;
+	result->data_type = INDEX;
+	result->payload = NULL;
+
+	if (context->batch == NULL) {
+		long int low;
+		long int high;
+		comparator_range(select_operator.comparator, &low, &high);
+		if (select_operator.indexes == NULL && !use_index(select_operator.column, low, high)) {
+			// Scans are put off until it is known what is done with them
+			result->plan = new_plan(PLAN_SELECT, select_operator.column, NULL, NULL);
+			result->plan->low = low;
+			result->plan->high = high;
+			ret_status->code = OK;
+			return result;
+		}
+
+		result->payload = calloc(DEFAULT_COL_SIZE, sizeof(size_t));
+		if (select_operator.indexes == NULL) {
+			select_index(select_operator.column, low, high, result);
+		} else {
+			select_positions(select_operator.indexes, select_operator.values, low, high, result);
+		}
+		finish_positions(result);
+	} else {
+		if (context->batch->column == NULL) {
+			context->batch->column = select_operator.column;
+		}
+
+		if (context->batch->batch_size == context->batch->batch_capacity) {
+			int new_capacity = context->batch->batch_capacity * 2;
+			context->batch->results = realloc(context->batch->results, new_capacity * sizeof(Result*));
+			context->batch->lower_bounds = realloc(context->batch->lower_bounds, new_capacity * sizeof(long int*));
+			context->batch->upper_bounds = realloc(context->batch->upper_bounds, new_capacity * sizeof(long int*));
+			context->batch->batch_capacity = new_capacity;
+		}
+
+		context->batch->results[context->batch->batch_size] = result;
+		comparator_range(select_operator.comparator, &context->batch->lower_bounds[context->batch->batch_size],
+			&context->batch->upper_bounds[context->batch->batch_size]);
+		context->batch->batch_size++;
+
+		log_test("Batched "); // "... Select succeeded"
+	}
+
+	ret_status->code = OK;
+	return result;
+}
+
+/*
+ * A fetch split into morsels of the positions, each writing the values of
+ * its own.
+ */
+typedef struct FetchMorsels {
+	Column* column;
+	Result* indexes;
+	PositionMorsel* morsels;
+	int* values;
+} FetchMorsels;
+
+static void fetch_morsel_task(void* context, size_t index) {
+	FetchMorsels* fetch = (FetchMorsels*) context;
+	PositionMorsel* morsel = &fetch->morsels[index];
+	PositionCursor cursor;
+	morsel_cursor(&cursor, fetch->indexes, morsel);
+	int* values = fetch->values + morsel->offset;
+	for (size_t i = 0; i < morsel->count; i++) {
+		values[i] = column_value(fetch->column, next_position(&cursor));
+	}
+}
+
+Result* fetch(Column* column, Result* indexes, Status* ret_status) {
+	Result* result = malloc(sizeof(Result));
+	result->num_tuples = indexes->num_tuples;
+	result->capacity = indexes->num_tuples;
+	result->plan = NULL;
+	result->data_type = INT;
+	ret_status->code = OK;
+	if (indexes->plan != NULL) {
+		// Put off along with the select it takes positions from
+		result->plan = new_plan(PLAN_FETCH, column, copy_plan(indexes->plan), NULL);
+		result->payload = NULL;
+		return result;
+	}
+
+	int* values = calloc(indexes->num_tuples, sizeof(int));
+	size_t num_morsels;
+	PositionMorsel* morsels = split_positions(indexes, &num_morsels);
+	FetchMorsels fetch = { column, indexes, morsels, values };
+	parallel_for(num_morsels, fetch_morsel_task, &fetch);
+	free(morsels);
+
+	result->payload = values;
+	return result;
+}
+
+void begin_batch(ClientContext* context, Status* ret_status) {
+	if (context->batch != NULL) {
+		log_err("There is already a batched query in progress\n");
+		ret_status->code = ERROR;
+		return;
+	}
+
+	context->batch = malloc(sizeof(SharedSelect));
+	context->batch->column = NULL;
+	context->batch->results = calloc(DEFAULT_BATCH_SIZE, sizeof(Result*));
+	context->batch->lower_bounds = calloc(DEFAULT_BATCH_SIZE, sizeof(long int*));
+	context->batch->upper_bounds = calloc(DEFAULT_BATCH_SIZE, sizeof(long int*));
+	context->batch->batch_size = 0;
+	context->batch->batch_capacity = DEFAULT_BATCH_SIZE;
+
+	ret_status->code = OK;
+	return;
+}
+
+// Values of a segment a shared scan takes at a time, small enough to stay
+// in L1 while every query selects from them
+#define BATCH_BLOCK 4096
+
+// Segments partly overlapped by at least BATCH_ROUTE_QUERIES batched
+// queries, plus BATCH_ROUTE_MATCH_QUERIES for every query a value is
+// expected to match, route their values to the queries they match rather
+// than running every query's kernel. Routing costs about as much per value
+// as a few hundred kernels, and more per match.
+#define BATCH_ROUTE_QUERIES 256
+#define BATCH_ROUTE_MATCH_QUERIES 100
+
+/*
+ * The batched queries partly overlapping a segment, arranged to find the
+ * ones a value matches in O(log Q + matches). Their bounds, sorted without
+ * duplicates, cut the values into intervals each matching the same
+ * queries. The intervals are the leaves of a segment tree laid out as a
+ * heap, node i having children 2i and 2i + 1 and leaf j being node
+ * num_leaves + j. Each query is listed at the O(log Q) nodes whose leaves its
+ * range covers exactly, so a value matches the queries listed on the path
+ * from its leaf to the root. Node i lists queries [node_start[i],
+ * node_start[i + 1]) of node_queries. The path skips the nodes listing none,
+ * jumps[i] being the first of node i and its ancestors listing some, 0 if
+ * there is none.
+ */
+typedef struct RouteTable {
+	long int* bounds;
+	size_t num_bounds;
+	size_t num_leaves;
+	size_t* node_start;
+	int* node_queries;
+	size_t* jumps;
+} RouteTable;
+
+static int compare_bounds(const void* first, const void* second) {
+	long int a = *(const long int*) first;
+	long int b = *(const long int*) second;
+	return (a > b) - (a < b);
+}
+
+/*
+ * Index of the first of num_bounds > 0 bounds above value, num_bounds if
+ * there is none. The halving compiles to conditional moves, values landing
+ * between bounds at random.
+ */
+static size_t upper_bound(const long int* bounds, size_t num_bounds, long int value) {
+	const long int* first = bounds;
+	while (num_bounds > 1) {
+		size_t half = num_bounds / 2;
+		first = first[half] <= value ? first + half : first;
+		num_bounds -= half;
+	}
+	return first - bounds + (*first <= value);
+}
+
+/*
+ * Call visit for the nodes of a segment tree of num_leaves leaves covering
+ * exactly leaves [first, last).
+ */
+#define FOR_COVERING_NODES(num_leaves, first, last, node, visit) do { \
+	size_t left = (first) + (num_leaves); \
+	size_t right = (last) + (num_leaves); \
+	while (left < right) { \
+		if (left & 1) { \
+			size_t node = left++; \
+			visit; \
+		} \
+		if (right & 1) { \
+			size_t node = --right; \
+			visit; \
+		} \
+		left >>= 1; \
+		right >>= 1; \
+	} \
+} while (0)
+
+static void build_routes(RouteTable* routes, SharedSelect* batch, const int* partial, int num_partial) {
+	routes->bounds = malloc(2 * num_partial * sizeof(long int));
+	size_t num_bounds = 0;
+	for (int p = 0; p < num_partial; p++) {
+		routes->bounds[num_bounds++] = batch->lower_bounds[partial[p]];
+		routes->bounds[num_bounds++] = batch->upper_bounds[partial[p]];
+	}
+	qsort(routes->bounds, num_bounds, sizeof(long int), compare_bounds);
+	routes->num_bounds = 0;
+	for (size_t i = 0; i < num_bounds; i++) {
+		if (routes->num_bounds == 0 || routes->bounds[i] != routes->bounds[routes->num_bounds - 1]) {
+			routes->bounds[routes->num_bounds++] = routes->bounds[i];
+		}
+	}
+
+	routes->num_leaves = 1;
+	while (routes->num_leaves + 1 < routes->num_bounds) {
+		routes->num_leaves *= 2;
+	}
+	size_t num_nodes = 2 * routes->num_leaves;
+	routes->node_start = calloc(num_nodes + 1, sizeof(size_t));
+
+	// Count the queries of every node, then list them
+	size_t* leaves = malloc(2 * num_partial * sizeof(size_t));
+	for (int p = 0; p < num_partial; p++) {
+		int q = partial[p];
+		leaves[2 * p] = upper_bound(routes->bounds, routes->num_bounds, batch->lower_bounds[q]) - 1;
+		leaves[2 * p + 1] = upper_bound(routes->bounds, routes->num_bounds, batch->upper_bounds[q]) - 1;
+		FOR_COVERING_NODES(routes->num_leaves, leaves[2 * p], leaves[2 * p + 1], node,
+			routes->node_start[node + 1]++);
+	}
+	for (size_t node = 0; node < num_nodes; node++) {
+		routes->node_start[node + 1] += routes->node_start[node];
+	}
+	routes->node_queries = malloc((routes->node_start[num_nodes] + 1) * sizeof(int));
+	size_t* filled = calloc(num_nodes, sizeof(size_t));
+	for (int p = 0; p < num_partial; p++) {
+		FOR_COVERING_NODES(routes->num_leaves, leaves[2 * p], leaves[2 * p + 1], node,
+			routes->node_queries[routes->node_start[node] + filled[node]++] = partial[p]);
+	}
+	free(filled);
+	free(leaves);
+
+	// Parents come before their children
+	routes->jumps = malloc(num_nodes * sizeof(size_t));
+	routes->jumps[0] = 0;
+	for (size_t node = 1; node < num_nodes; node++) {
+		bool listing = routes->node_start[node + 1] > routes->node_start[node];
+		routes->jumps[node] = listing ? node : routes->jumps[node >> 1];
+	}
+}
+
+static void free_routes(RouteTable* routes) {
+	free(routes->bounds);
+	free(routes->node_start);
+	free(routes->node_queries);
+	free(routes->jumps);
+}
+
+// Append a single position to a result
+static void append_position(Result* result, size_t position) {
+	if (result->data_type == BITMAP) {
+		((uint64_t*) result->payload)[position >> 6] |= (uint64_t) 1 << (position & 63);
+	} else {
+		reserve_positions(result, 1);
+		if (result->data_type == INDEX32) {
+			((uint32_t*) result->payload)[result->num_tuples] = (uint32_t) position;
+		} else {
+			((size_t*) result->payload)[result->num_tuples] = position;
+		}
+	}
+	result->num_tuples++;
+}
+
+/*
+ * Append the positions of count values, the first at position base, to the
+ * results of the partial queries they match, looked up in a route table.
+ */
+static void route_values(SharedSelect* batch, const int* partial, int num_partial,
+		const int* values, size_t count, size_t base, Result** results) {
+	RouteTable routes;
+	build_routes(&routes, batch, partial, num_partial);
+
+	// Look up a block of values before walking their paths, so that the
+	// lookups overlap rather than wait on the walks' branches
+	size_t nodes[BATCH_BLOCK];
+	for (size_t block = 0; block < count; block += BATCH_BLOCK) {
+		size_t num = count - block < BATCH_BLOCK ? count - block : BATCH_BLOCK;
+		for (size_t i = 0; i < num; i++) {
+			size_t bound = upper_bound(routes.bounds, routes.num_bounds, values[block + i]);
+			size_t leaf = bound == 0 || bound == routes.num_bounds ? 0 : routes.num_leaves + bound - 1;
+			nodes[i] = routes.jumps[leaf];
+		}
+		for (size_t i = 0; i < num; i++) {
+			for (size_t node = nodes[i]; node > 0; node = routes.jumps[node >> 1]) {
+				for (size_t j = routes.node_start[node]; j < routes.node_start[node + 1]; j++) {
+					append_position(results[routes.node_queries[j]], base + block + i);
+				}
+			}
+		}
+	}
+	free_routes(&routes);
+}
+
+/*
+ * Append the positions of the values of segments [first, last) of a
+ * batched select's column to results, one per query. The segments are
+ * taken a block at a time, each query running its kernel over the block in
+ * turn, so that the values are read from memory once for all of them. Many
+ * selective queries are routed to instead, selectivities giving the
+ * estimated fraction of the rows each matches.
+ */
+static void scan_batch(SharedSelect* batch, const double* selectivities, size_t first, size_t last, Result** results) {
+	Column* column = batch->column;
+	int partial[batch->batch_size + 1];
+	int* scratch = NULL;
+	for (size_t seg = first; seg < last; seg++) {
+		size_t count = segment_length(column->length, seg);
+		size_t base = seg << SEGMENT_SHIFT;
+
+		// Queries covering the whole segment take it as is, only the ones
+		// partly overlapping it compare its values
+		int num_partial = 0;
+		for (int q = 0; q < batch->batch_size; q++) {
+			ZoneMatch match = match_zone(&column->zones[seg], batch->lower_bounds[q], batch->upper_bounds[q]);
+			if (match == ZONE_ALL) {
+				append_position_range(results[q], base, count);
+			} else if (match == ZONE_SOME) {
+				partial[num_partial++] = q;
+			}
+		}
+		if (num_partial == 0) {
+			continue;
+		}
+
+		const int* values = segment_values(column, seg, &scratch);
+		double matches = 0;
+		for (int p = 0; p < num_partial; p++) {
+			matches += selectivities[partial[p]];
+		}
+		if (num_partial >= BATCH_ROUTE_QUERIES + matches * BATCH_ROUTE_MATCH_QUERIES) {
+			route_values(batch, partial, num_partial, values, count, base, results);
+			continue;
+		}
+		for (size_t block = 0; block < count; block += BATCH_BLOCK) {
+			size_t num = count - block < BATCH_BLOCK ? count - block : BATCH_BLOCK;
+			for (int p = 0; p < num_partial; p++) {
+				int q = partial[p];
+				select_block(values + block, num, batch->lower_bounds[q], batch->upper_bounds[q],
+					base + block, results[q]);
+			}
+		}
+	}
+	free(scratch);
+}
+
+/*
+ * A shared scan split into morsels of whole segments, each appending to its
+ * own part of every query's result. Part m of query q is parts[q *
+ * num_morsels + m].
+ */
+typedef struct BatchMorsels {
+	SharedSelect* batch;
+	const double* selectivities;
+	size_t num_morsels;
+	Result* parts;
+} BatchMorsels;
+
+static void batch_morsel_task(void* context, size_t index) {
+	BatchMorsels* scan = (BatchMorsels*) context;
+	SharedSelect* batch = scan->batch;
+	size_t num_segments = segment_count(batch->column->length);
+	Result* results[batch->batch_size + 1];
+	for (int q = 0; q < batch->batch_size; q++) {
+		results[q] = &scan->parts[q * scan->num_morsels + index];
+	}
+	scan_batch(batch, scan->selectivities, morsel_start(index, scan->num_morsels, num_segments),
+		morsel_start(index + 1, scan->num_morsels, num_segments), results);
+}
+
+void execute_batch(ClientContext* context, Status* ret_status) {
+	if (context->batch == NULL) {
+		log_err("There is no batched query currently in progress\n");
+		ret_status->code = ERROR;
+		return;
+	}
+
+	SharedSelect* batch = context->batch;
+	Column* column = batch->column;
+
+	// Every result starts in the form and with the room its estimate calls
+	// for, the form is settled once it is filled
+	double selectivities[batch->batch_size + 1];
+	for (int q = 0; q < batch->batch_size; q++) {
+		init_select(column, batch->lower_bounds[q], batch->upper_bounds[q], batch->results[q]);
+		selectivities[q] = column->stats.count == column->length ?
+			stats_selectivity(&column->stats, batch->lower_bounds[q], batch->upper_bounds[q]) : 0;
+	}
+
+	// Execute the batched query
+	size_t num_segments = column ? segment_count(column->length) : 0;
+	size_t num_morsels = morsel_count(num_segments, SEGMENT_VALUES);
+	if (num_morsels == 1) {
+		scan_batch(batch, selectivities, 0, num_segments, batch->results);
+	} else {
+		// Segments cover whole bitmap words, so the parts of a bitmap can share it
+		Result* parts = malloc(batch->batch_size * num_morsels * sizeof(Result));
+		for (int q = 0; q < batch->batch_size; q++) {
+			for (size_t m = 0; m < num_morsels; m++) {
+				Result* part = &parts[q * num_morsels + m];
+				*part = *batch->results[q];
+				if (part->data_type != BITMAP) {
+					part->payload = NULL;
+					init_positions(part, part->data_type, column->length);
+				}
+			}
+		}
+		BatchMorsels scan = { batch, selectivities, num_morsels, parts };
+		parallel_for(num_morsels, batch_morsel_task, &scan);
+		for (int q = 0; q < batch->batch_size; q++) {
+			gather_positions(batch->results[q], &parts[q * num_morsels], num_morsels);
+		}
+		free(parts);
+	}
+
+	for (int q = 0; q < batch->batch_size; q++) {
+		finish_positions(batch->results[q]);
+	}
+
+	// Free the batched query and set the context batch to null
+	free(batch->results);
+	free(batch->lower_bounds);
+	free(batch->upper_bounds);
+	free(batch);
+	context->batch = NULL;
+
+	ret_status->code = OK;
+	return;
+}
+
+/*
+ * Write value i of a print operand followed by sep into out, or only count
+ * its characters if size is 0. Position results print their positions,
+ * taken through the operand's cursor so that every form prints the same.
+ */
+static int print_value(char* out, size_t size, const Result* result, size_t i, PositionCursor* cursor, char sep) {
+	if (result->data_type == INT) {
+		return snprintf(out, size, "%d%c", *((int*) result->payload + i), sep);
+	} else if (result->data_type == LONG) {
+		return snprintf(out, size, "%ld%c", *((long int*) result->payload + i), sep);
+	} else if (result->data_type == FLOAT) {
+		return snprintf(out, size, "%.2f%c", *((float*) result->payload + i), sep);
+	}
+	return snprintf(out, size, "%zu%c", next_position(cursor), sep);
+}
+
+char* print_result(PrintOperator print_operator, Status* ret_status) {
+	size_t len = 0;
+	size_t num_rows = print_operator.results[0]->num_tuples;
+	PositionCursor cursors[print_operator.num_results];
+
+	// TODO: send an array of ints instead of chars
+
+	// The first pass sizes the response, the second writes it
+	for (int r = 0; r < print_operator.num_results; r++) {
+		position_cursor_init(&cursors[r], print_operator.results[r]);
+	}
+	for (size_t i = 0; i < num_rows; i++) {
+		for (int r = 0; r < print_operator.num_results; r++) {
+			len += print_value(NULL, 0, print_operator.results[r], i, &cursors[r], ',');
+		}
+	}
+
+	char* response = malloc((len + 1) * sizeof(char));
+	size_t written = 0;
+	for (int r = 0; r < print_operator.num_results; r++) {
+		position_cursor_init(&cursors[r], print_operator.results[r]);
+	}
+	for (size_t j = 0; j < num_rows; j++) {
+		for (int r = 0; r < print_operator.num_results; r++) {
+			char sep = (r == print_operator.num_results - 1) ? '\n': ',';
+			written += print_value(response + written, len + 1 - written,
+				print_operator.results[r], j, &cursors[r], sep);
+		}
+	}
+
+	response[len] = '\0';
+
+	free(print_operator.results);
+	ret_status->code = OK;
+	return response;
+}
+
+
+/*
+ * Element-wise sums or differences of two results split into morsels.
+ */
+typedef struct ArithmeticMorsels {
+	const int* first;
+	const int* second;
+	int* values;
+	size_t count;
+	size_t num_morsels;
+	bool subtract;
+} ArithmeticMorsels;
+
+static void arithmetic_morsel_task(void* context, size_t index) {
+	ArithmeticMorsels* arithmetic = (ArithmeticMorsels*) context;
+	size_t begin = morsel_start(index, arithmetic->num_morsels, arithmetic->count);
+	size_t end = morsel_start(index + 1, arithmetic->num_morsels, arithmetic->count);
+	if (arithmetic->subtract) {
+		for (size_t i = begin; i < end; i++) {
+			arithmetic->values[i] = arithmetic->first[i] - arithmetic->second[i];
+		}
+	} else {
+		for (size_t i = begin; i < end; i++) {
+			arithmetic->values[i] = arithmetic->first[i] + arithmetic->second[i];
+		}
+	}
+}
+
+static Result* combine_values(Result* first, Result* second, bool subtract) {
+	Result* result = malloc(sizeof(Result));
+	result->num_tuples = first->num_tuples;
+	result->capacity = first->num_tuples;
+	result->plan = NULL;
+	result->data_type = INT;
+	if (first->plan != NULL) {
+		result->plan = new_plan(subtract ? PLAN_SUBTRACT : PLAN_ADD, NULL, copy_plan(first->plan), copy_plan(second->plan));
+		result->payload = NULL;
+		return result;
+	}
+	result->payload = calloc(result->num_tuples, sizeof(int));
+
+	ArithmeticMorsels arithmetic = {
+		(int*) first->payload, (int*) second->payload, (int*) result->payload,
+		result->num_tuples, morsel_count(result->num_tuples, 1), subtract
+	};
+	parallel_for(arithmetic.num_morsels, arithmetic_morsel_task, &arithmetic);
+	return result;
+}
+
+Result* add_values(Result* first, Result* second, Status* ret_status) {
+	ret_status->code = OK;
+	return combine_values(first, second, false);
+}
+
+
+Result* subtract_values(Result* first, Result* second, Status* ret_status) {
+	ret_status->code = OK;
+	return combine_values(first, second, true);
+}
+
+
+/*
+ * A sum, smallest or largest value of a column or result split into
+ * morsels, of whole segments of a column or entries of a result, each
+ * aggregating its own. Sums and integer extremes are kept as longs, float
+ * extremes as floats; floats are summed truncated, as they always have been.
+ */
+typedef struct AggregateMorsels {
+	GeneralizedColumn values;
+	AggregateType type;
+	size_t num_units;
+	size_t num_morsels;
+	long int* totals;
+	float* float_totals;
+} AggregateMorsels;
+
+// Aggregate num > 0 values into total, extremes in a local of the value type
+#define AGGREGATE_VALUES(total, type, values, num, value_type) do { \
+	if ((type) == _SUM) { \
+		long int sum = 0; \
+		for (size_t i = 0; i < (num); i++) { \
+			sum += (long int) (values)[i]; \
+		} \
+		(total) = sum; \
+	} else if ((type) == _MIN) { \
+		value_type min = (values)[0]; \
+		for (size_t i = 1; i < (num); i++) { \
+			min = (values)[i] < min ? (values)[i] : min; \
+		} \
+		(total) = min; \
+	} else { \
+		value_type max = (values)[0]; \
+		for (size_t i = 1; i < (num); i++) { \
+			max = (values)[i] > max ? (values)[i] : max; \
+		} \
+		(total) = max; \
+	} \
+} while (0)
+
+static long int combine_totals(AggregateType type, long int first, long int second) {
+	if (type == _SUM) {
+		return first + second;
+	}
+	return (type == _MIN) == (second < first) ? second : first;
+}
+
+static void aggregate_morsel_task(void* context, size_t index) {
+	AggregateMorsels* aggregate = (AggregateMorsels*) context;
+	size_t begin = morsel_start(index, aggregate->num_morsels, aggregate->num_units);
+	size_t end = morsel_start(index + 1, aggregate->num_morsels, aggregate->num_units);
+	long int* total = &aggregate->totals[index];
+	aggregate->float_totals[index] = 0;
+
+	if (aggregate->values.column_type == COLUMN) {
+		Column* column = aggregate->values.column_pointer.column;
+		int* scratch = NULL;
+		for (size_t seg = begin; seg < end; seg++) {
+			const int* segment = segment_values(column, seg, &scratch);
+			size_t count = segment_length(column->length, seg);
+			long int segment_total;
+			AGGREGATE_VALUES(segment_total, aggregate->type, segment, count, int);
+			*total = seg == begin ? segment_total : combine_totals(aggregate->type, *total, segment_total);
+		}
+		free(scratch);
+		return;
+	}
+
+	Result* result = aggregate->values.column_pointer.result;
+	if (result->data_type == INT) {
+		AGGREGATE_VALUES(*total, aggregate->type, (int*) result->payload + begin, end - begin, int);
+	} else if (result->data_type == LONG) {
+		AGGREGATE_VALUES(*total, aggregate->type, (long int*) result->payload + begin, end - begin, long int);
+	} else if (result->data_type == FLOAT && aggregate->type == _SUM) {
+		AGGREGATE_VALUES(*total, aggregate->type, (float*) result->payload + begin, end - begin, float);
+	} else if (result->data_type == FLOAT) {
+		AGGREGATE_VALUES(aggregate->float_totals[index], aggregate->type, (float*) result->payload + begin, end - begin, float);
+	} else {
+		*total = 0;
+	}
+}
+
+/*
+ * The sum, smallest or largest of the values of a column or result, spread
+ * over the workers. Float extremes go to float_total. No values aggregate
+ * to 0.
+ */
+static long int aggregate_values(GeneralizedColumn values, AggregateType type, float* float_total) {
+	AggregateMorsels aggregate = { values, type, 0, 1, NULL, NULL };
+	if (values.column_type == COLUMN) {
+		aggregate.num_units = segment_count(values.column_pointer.column->length);
+		aggregate.num_morsels = morsel_count(aggregate.num_units, SEGMENT_VALUES);
+	} else {
+		aggregate.num_units = values.column_pointer.result->num_tuples;
+		aggregate.num_morsels = morsel_count(aggregate.num_units, 1);
+	}
+	*float_total = 0;
+	if (aggregate.num_units == 0) {
+		return 0;
+	}
+
+	long int totals[aggregate.num_morsels];
+	float float_totals[aggregate.num_morsels];
+	aggregate.totals = totals;
+	aggregate.float_totals = float_totals;
+	parallel_for(aggregate.num_morsels, aggregate_morsel_task, &aggregate);
+
+	long int total = totals[0];
+	*float_total = float_totals[0];
+	for (size_t m = 1; m < aggregate.num_morsels; m++) {
+		total = combine_totals(type, total, totals[m]);
+		if ((type == _MIN) == (float_totals[m] < *float_total)) {
+			*float_total = float_totals[m];
+		}
+	}
+	return total;
+}
+
+// Most fetches, sums and differences one pipeline runs
+#define PIPELINE_MAX_STEPS 8
+
+// Values a pipeline takes at a time, small enough to stay in L1
+#define PIPELINE_BLOCK 1024
+
+/*
+ * An aggregate of a plan run as a single pass over the column selected
+ * from, split into morsels of whole segments. The plan is laid out as the
+ * columns fetched and operations applied in postfix order. Each morsel
+ * selects a block of a segment at a time and works it through the steps
+ * in buffers of a block, aggregating what comes out into its total.
+ */
+typedef struct Pipeline {
+	Column* column;
+	long int low;
+	long int high;
+	PlanType steps[PIPELINE_MAX_STEPS];
+	Column* columns[PIPELINE_MAX_STEPS];
+	size_t num_steps;
+	AggregateType type;
+	size_t num_morsels;
+	long int* totals;
+	size_t* counts;
+} Pipeline;
+
+static void add_pipeline_steps(Pipeline* pipeline, const Plan* plan) {
+	if (plan->type != PLAN_FETCH) {
+		add_pipeline_steps(pipeline, plan->first);
+		add_pipeline_steps(pipeline, plan->second);
+	}
+	pipeline->steps[pipeline->num_steps] = plan->type;
+	pipeline->columns[pipeline->num_steps] = plan->column;
+	pipeline->num_steps++;
+}
+
+static void pipeline_morsel_task(void* context, size_t index) {
+	Pipeline* pipeline = (Pipeline*) context;
+	size_t num_segments = segment_count(pipeline->column->length);
+	size_t begin = morsel_start(index, pipeline->num_morsels, num_segments);
+	size_t end = morsel_start(index + 1, pipeline->num_morsels, num_segments);
+
+	int* scratch[PIPELINE_MAX_STEPS + 1] = { NULL };
+	const int* segments[PIPELINE_MAX_STEPS];
+	uint32_t offsets[PIPELINE_BLOCK];
+	int buffers[PIPELINE_MAX_STEPS][PIPELINE_BLOCK];
+	long int total = 0;
+	size_t count = 0;
+	for (size_t seg = begin; seg < end; seg++) {
+		ZoneMatch match = match_zone(&pipeline->column->zones[seg], pipeline->low, pipeline->high);
+		if (match == ZONE_NONE) {
+			continue;
+		}
+
+		// Blocks of a segment the zone map takes whole need no select
+		size_t length = segment_length(pipeline->column->length, seg);
+		const int* keys = NULL;
+		if (match == ZONE_SOME) {
+			keys = segment_values(pipeline->column, seg, &scratch[PIPELINE_MAX_STEPS]);
+		}
+		for (size_t s = 0; s < pipeline->num_steps; s++) {
+			if (pipeline->steps[s] != PLAN_FETCH) {
+				continue;
+			} else if (keys != NULL && pipeline->columns[s] == pipeline->column) {
+				segments[s] = keys;
+			} else {
+				segments[s] = segment_values(pipeline->columns[s], seg, &scratch[s]);
+			}
+		}
+
+		for (size_t block = 0; block < length; block += PIPELINE_BLOCK) {
+			size_t num = length - block < PIPELINE_BLOCK ? length - block : PIPELINE_BLOCK;
+			if (keys != NULL) {
+				num = select_range32(keys + block, num, pipeline->low, pipeline->high, 0, offsets);
+				if (num == 0) {
+					continue;
+				}
+			}
+
+			// Operands on a stack, fetched ones pointing into the segment
+			// when the whole block is taken
+			const int* stack[PIPELINE_MAX_STEPS];
+			size_t depth = 0;
+			for (size_t s = 0; s < pipeline->num_steps; s++) {
+				if (pipeline->steps[s] == PLAN_FETCH && keys == NULL) {
+					stack[depth++] = segments[s] + block;
+				} else if (pipeline->steps[s] == PLAN_FETCH) {
+					const int* values = segments[s] + block;
+					for (size_t i = 0; i < num; i++) {
+						buffers[depth][i] = values[offsets[i]];
+					}
+					stack[depth] = buffers[depth];
+					depth++;
+				} else {
+					depth--;
+					const int* first = stack[depth - 1];
+					const int* second = stack[depth];
+					int* out = buffers[depth - 1];
+					if (pipeline->steps[s] == PLAN_SUBTRACT) {
+						for (size_t i = 0; i < num; i++) {
+							out[i] = first[i] - second[i];
+						}
+					} else {
+						for (size_t i = 0; i < num; i++) {
+							out[i] = first[i] + second[i];
+						}
+					}
+					stack[depth - 1] = out;
+				}
+			}
+
+			long int block_total;
+			AGGREGATE_VALUES(block_total, pipeline->type, stack[0], num, int);
+			total = count == 0 ? block_total : combine_totals(pipeline->type, total, block_total);
+			count += num;
+		}
+	}
+	for (size_t s = 0; s <= PIPELINE_MAX_STEPS; s++) {
+		free(scratch[s]);
 	}
+	pipeline->totals[index] = total;
+	pipeline->counts[index] = count;
+}
 
-	ret_status->code = OK;
-	result->payload = values;
+/*
+ * The sum, average, smallest or largest of the values a plan describes, of
+ * the type calculate_sum() and the others give for fetched values.
+ */
+static Result* run_pipeline(const Plan* plan, AggregateType type) {
+	const Plan* select = plan_select(plan);
+	Pipeline pipeline = { select->column, select->low, select->high, { 0 }, { NULL }, 0,
+		type == _AVG ? _SUM : type, 1, NULL, NULL };
+	add_pipeline_steps(&pipeline, plan);
+
+	size_t num_segments = segment_count(select->column->length);
+	pipeline.num_morsels = morsel_count(num_segments, SEGMENT_VALUES);
+	long int totals[pipeline.num_morsels];
+	size_t counts[pipeline.num_morsels];
+	pipeline.totals = totals;
+	pipeline.counts = counts;
+	parallel_for(pipeline.num_morsels, pipeline_morsel_task, &pipeline);
+
+	long int total = 0;
+	size_t count = 0;
+	for (size_t m = 0; m < pipeline.num_morsels; m++) {
+		if (counts[m] > 0) {
+			total = count == 0 ? totals[m] : combine_totals(pipeline.type, total, totals[m]);
+			count += counts[m];
+		}
+	}
+
+	Result* result = malloc(sizeof(Result));
+	result->num_tuples = 1;
+	result->capacity = 1;
+	result->plan = NULL;
+	if (type == _SUM) {
+		result->data_type = LONG;
+		result->payload = malloc(sizeof(long int));
+		*((long int*) result->payload) = total;
+	} else if (type == _AVG) {
+		result->data_type = FLOAT;
+		result->payload = malloc(sizeof(float));
+		*((float*) result->payload) = total / (float) count;
+	} else {
+		result->data_type = INT;
+		result->payload = malloc(sizeof(int));
+		*((int*) result->payload) = (int) total;
+	}
 	return result;
 }
 
+// Whether an aggregate runs as a pipeline rather than over computed values
+static bool is_pipeline(GeneralizedColumn values) {
+	return values.column_type == RESULT && values.column_pointer.result->plan != NULL &&
+		values.column_pointer.result->plan->type != PLAN_SELECT;
+}
+
+/*
+ * A result holding the smallest or largest of some values, of the type of
+ * the values.
+ */
+static Result* extreme_value(GeneralizedColumn values, AggregateType type) {
+	if (is_pipeline(values)) {
+		return run_pipeline(values.column_pointer.result->plan, type);
+	}
 
-Result* subtract_values(Result* first, Result* second, Status* ret_status) {
 	Result* result = malloc(sizeof(Result));
-	result->num_tuples = first->num_tuples;
-	result->capacity = first->num_tuples;
-	result->data_type = INT;
+	result->num_tuples = 1;
+	result->capacity = 1;
+	result->plan = NULL;
 
-	int* values = calloc(result->num_tuples, sizeof(int));
-	for (size_t i = 0; i < result->num_tuples; i++) {
-		values[i] = *((int*) first->payload + i) - *((int*) second->payload + i);
+	float float_total;
+	long int total = aggregate_values(values, type, &float_total);
+	DataType data_type = values.column_type == COLUMN ? INT : values.column_pointer.result->data_type;
+	if (data_type == INT) {
+		result->data_type = INT;
+		result->payload = malloc(sizeof(int));
+		*((int*) result->payload) = (int) total;
+	} else if (data_type == LONG) {
+		result->data_type = LONG;
+		result->payload = malloc(sizeof(long int));
+		*((long int*) result->payload) = total;
+	} else if (data_type == FLOAT) {
+		result->data_type = FLOAT;
+		result->payload = malloc(sizeof(float));
+		*((float*) result->payload) = float_total;
 	}
-
-	ret_status->code = OK;
-	result->payload = values;
 	return result;
 }
 
-
 Result* calculate_sum(GeneralizedColumn values, Status* ret_status) {
+	if (is_pipeline(values)) {
+		ret_status->code = OK;
+		return run_pipeline(values.column_pointer.result->plan, _SUM);
+	}
+
 	Result* result = malloc(sizeof(Result));
 	result->num_tuples = 1;
 	result->capacity = 1;
+	result->plan = NULL;
 	result->data_type = LONG;
 	result->payload = malloc(sizeof(long int));
 
-	long int sum = 0;
-	if (values.column_type == COLUMN) {
-		Column* column_vals = values.column_pointer.column;
-		for (size_t i = 0; i < column_vals->length; i++) {
-			sum += (long int) column_vals->data[i];
-		}
-	} else if (values.column_type == RESULT) {
-		Result* result_vals = values.column_pointer.result;
-		if (result_vals->data_type == INT) {
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				sum += (long int) *((int*) result_vals->payload + i);
+	float float_total;
+	ret_status->code = OK;
+	*((long int*) result->payload) = aggregate_values(values, _SUM, &float_total);
+	return result;
+}
+
+Result* calculate_average(GeneralizedColumn values, Status* ret_status) {
+	if (is_pipeline(values)) {
+		ret_status->code = OK;
+		return run_pipeline(values.column_pointer.result->plan, _AVG);
+	}
+
+	Result* result = malloc(sizeof(Result));
+	result->num_tuples = 1;
+	result->capacity = 1;
+	result->plan = NULL;
+	result->data_type = FLOAT;
+	result->payload = malloc(sizeof(float));
+
+	size_t count = values.column_type == COLUMN ?
+		values.column_pointer.column->length : values.column_pointer.result->num_tuples;
+	float float_total;
+	ret_status->code = OK;
+	*((float*) result->payload) = aggregate_values(values, _SUM, &float_total) / (float) count;
+	return result;
+}
+
+Result* calculate_max(GeneralizedColumn values, Status* ret_status) {
+	ret_status->code = OK;
+	return extreme_value(values, _MAX);
+}
+
+Result* calculate_min(GeneralizedColumn values, Status* ret_status) {
+	ret_status->code = OK;
+	return extreme_value(values, _MIN);
+}
+
+
+// Load database from file
+/*
+ * Parse an integer at p, skipping blanks before it. Returns the first
+ * character after it, or NULL if there is no integer at p.
+ */
+static inline const char* parse_value(const char* p, const char* end, int* value) {
+	while (p < end && (*p == ' ' || *p == '\t')) {
+		p++;
+	}
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+')) {
+		p++;
+	}
+	const char* digits = p;
+	uint32_t result = 0;
+	while (p < end && (unsigned char) (*p - '0') < 10) {
+		result = result * 10 + (*p - '0');
+		p++;
+	}
+	if (p == digits) {
+		return NULL;
+	}
+	*value = (int) (negative ? 0u - result : result);
+	return p;
+}
+
+// Loads are split into chunks of at least this many bytes for the workers
+#define LOAD_CHUNK_BYTES (1 << 20)
+
+/*
+ * A newline aligned part of a file being loaded. Its rows go to the table
+ * rows from first_row on.
+ */
+typedef struct LoadChunk {
+	Table* table;
+	const char* begin;
+	const char* end;
+	size_t first_row;
+	// Rows in the chunk and rows parsed before a malformed one, if any
+	size_t num_rows;
+	size_t parsed;
+	bool malformed;
+} LoadChunk;
+
+/*
+ * Count the rows of a chunk, that is its lines with anything but line
+ * endings on them.
+ */
+static void count_rows_task(void* context, size_t index) {
+	LoadChunk* chunk = (LoadChunk*) context + index;
+	size_t rows = 0;
+	bool blank = true;
+	for (const char* p = chunk->begin; p < chunk->end; p++) {
+		if (*p == '\n') {
+			rows += !blank;
+			blank = true;
+		} else if (*p != '\r') {
+			blank = false;
+		}
+	}
+	chunk->num_rows = rows + !blank;
+}
+
+/*
+ * Parse the rows of a chunk straight into the segments of its table.
+ */
+static void parse_rows_task(void* context, size_t index) {
+	LoadChunk* chunk = (LoadChunk*) context + index;
+	Table* table = chunk->table;
+	const char* p = chunk->begin;
+	const char* end = chunk->end;
+	for (chunk->parsed = 0; chunk->parsed < chunk->num_rows; chunk->parsed++) {
+		size_t row = chunk->first_row + chunk->parsed;
+		size_t seg = row >> SEGMENT_SHIFT;
+		size_t offset = row & SEGMENT_MASK;
+
+		// Skip blank lines
+		while (p < end && (*p == '\n' || *p == '\r')) {
+			p++;
+		}
+		for (size_t col = 0; col < table->col_count; col++) {
+			p = parse_value(p, end, &table->columns[col]->segments[seg][offset]);
+			char expected = col + 1 < table->col_count ? ',' : '\n';
+			if (p && p < end && *p == '\r' && expected == '\n') {
+				p++;
 			}
-		} else if (result_vals->data_type == LONG) {
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				sum += *((long int*) result_vals->payload + i);
+			if (p == NULL || (p < end && *p != expected) || (p == end && expected == ',')) {
+				chunk->malformed = true;
+				return;
 			}
-		} else if (result_vals->data_type == FLOAT) {
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				sum += (long int) *((float*) result_vals->payload + i);
+			if (p < end) {
+				p++;
 			}
 		}
 	}
+}
 
-	ret_status->code = OK;
-	*((long int*) result->payload) = sum;
-	return result;
+/*
+ * The table a load file header names as db.table.column,..., with its
+ * columns loaded. NULL if it doesn't name a table of the current database.
+ */
+static Table* load_target(const char* header, size_t length) {
+	char names[BUF_SIZE];
+	length = length < BUF_SIZE ? length : BUF_SIZE - 1;
+	memcpy(names, header, length);
+	names[length] = '\0';
+
+	char* cursor = names;
+	char* db_name = strsep(&cursor, ".");
+	char* table_name = strsep(&cursor, ".");
+	if (!current_db || table_name == NULL || strcmp(current_db->name, db_name) != 0) {
+		return NULL;
+	}
+	Table* table = NULL;
+	for (size_t i = 0; i < current_db->tables_size; i++) {
+		if (strcmp(current_db->tables[i]->name, table_name) == 0) {
+			table = current_db->tables[i];
+		}
+	}
+	if (table == NULL || load_columns(table).code != OK) {
+		return NULL;
+	}
+	return table;
+}
+
+/*
+ * Append the rows in [begin, end) to a table, parsing them on the workers
+ * a chunk each, every row going straight into the segments of the table.
+ * On a malformed row the rows before it are kept.
+ */
+static Status load_rows(Table* table, const char* begin, const char* end) {
+	Status ret_status;
+
+	// Split the rows into newline aligned chunks, a few per worker
+	size_t num_chunks = thread_pool_size() * 4;
+	if ((size_t) (end - begin) / num_chunks < LOAD_CHUNK_BYTES) {
+		num_chunks = (end - begin) / LOAD_CHUNK_BYTES + 1;
+	}
+	LoadChunk* chunks = calloc(num_chunks, sizeof(LoadChunk));
+	for (size_t i = 0; i < num_chunks; i++) {
+		chunks[i].table = table;
+		chunks[i].begin = i == 0 ? begin : chunks[i - 1].end;
+		chunks[i].end = i + 1 == num_chunks ? end : begin + (end - begin) / num_chunks * (i + 1);
+		if (chunks[i].end < chunks[i].begin) {
+			chunks[i].end = chunks[i].begin;
+		}
+		const char* newline = memchr(chunks[i].end, '\n', end - chunks[i].end);
+		if (i + 1 < num_chunks && chunks[i].end < end) {
+			chunks[i].end = newline ? newline + 1 : end;
+		}
+	}
+
+	// Count the rows first, so that every chunk knows where its rows go
+	// and can parse them straight into place
+	parallel_for(num_chunks, count_rows_task, chunks);
+	size_t first_row = table->table_length;
+	for (size_t i = 0; i < num_chunks; i++) {
+		chunks[i].first_row = first_row;
+		first_row += chunks[i].num_rows;
+	}
+	ret_status.code = OK;
+	if (reserve_rows(table, first_row) == -1) {
+		free(chunks);
+		ret_status.code = ERROR;
+		return ret_status;
+	}
+	parallel_for(num_chunks, parse_rows_task, chunks);
+
+	// Keep the rows up to the first malformed one
+	size_t length = first_row;
+	for (size_t i = 0; i < num_chunks; i++) {
+		if (chunks[i].malformed) {
+			log_err("Malformed row %zu in load data\n", chunks[i].first_row + chunks[i].parsed + 1);
+			length = chunks[i].first_row + chunks[i].parsed;
+			ret_status.code = ERROR;
+			break;
+		}
+	}
+	free(chunks);
+
+	commit_rows(table, length);
+	return ret_status;
+}
+
+/*
+ * The table a columnar file is for, with its columns loaded. Sets *targets
+ * to the table column each column of the file goes to. NULL if the file
+ * doesn't match a table of the current database column for column.
+ */
+static Table* columnar_target(const ColumnarHeader* header, const ColumnarColumn* columns, Column*** targets) {
+	if (header->version != COLUMNAR_VERSION || !current_db ||
+			strncmp(current_db->name, header->db_name, MAX_SIZE_NAME) != 0) {
+		return NULL;
+	}
+	Table* table = NULL;
+	for (size_t i = 0; i < current_db->tables_size; i++) {
+		if (strncmp(current_db->tables[i]->name, header->table_name, MAX_SIZE_NAME) == 0) {
+			table = current_db->tables[i];
+		}
+	}
+	if (table == NULL || header->num_columns != table->col_count || load_columns(table).code != OK) {
+		return NULL;
+	}
+
+	*targets = calloc(table->col_count, sizeof(Column*));
+	for (size_t i = 0; i < table->col_count; i++) {
+		for (size_t col = 0; col < table->col_count && columns[i].data_type == INT; col++) {
+			Column* column = table->columns[col];
+			if (strncmp(column->name, columns[i].name, MAX_SIZE_NAME) == 0) {
+				(*targets)[i] = column;
+			}
+		}
+		for (size_t j = 0; j < i && (*targets)[i]; j++) {
+			if ((*targets)[j] == (*targets)[i]) {
+				(*targets)[i] = NULL;
+			}
+		}
+		if ((*targets)[i] == NULL) {
+			log_err("Column %.*s of load file doesn't match table %s\n", MAX_SIZE_NAME, columns[i].name, table->name);
+			free(*targets);
+			return NULL;
+		}
+	}
+	return table;
+}
+
+/*
+ * Load a mapped columnar file, appending its columns as they are.
+ */
+static Status load_columnar(const char* data, size_t size) {
+	Status ret_status;
+	ret_status.code = ERROR;
+
+	const ColumnarHeader* header = (const ColumnarHeader*) data;
+	const ColumnarColumn* columns = (const ColumnarColumn*) (header + 1);
+	size_t columns_end = sizeof(ColumnarHeader) + header->num_columns * sizeof(ColumnarColumn);
+	if (size < sizeof(ColumnarHeader) || header->num_columns > MAX_COLUMNAR_COLUMNS ||
+			columns_end > size || header->num_rows > (size - columns_end) / sizeof(int) ||
+			header->num_rows * header->num_columns > (size - columns_end) / sizeof(int)) {
+		log_err("Columnar load file is truncated\n");
+		return ret_status;
+	}
+
+	Column** targets;
+	Table* table = columnar_target(header, columns, &targets);
+	if (table == NULL) {
+		return ret_status;
+	}
+
+	// Hand the columns of the file over in the order of the table
+	const int* values[table->col_count + 1];
+	for (size_t i = 0; i < table->col_count; i++) {
+		for (size_t col = 0; col < table->col_count; col++) {
+			if (table->columns[col] == targets[i]) {
+				values[col] = (const int*) (data + columns_end) + i * header->num_rows;
+			}
+		}
+	}
+	free(targets);
+	return append_rows(table, values, header->num_rows);
+}
+
+/*
+ * Read exactly size bytes of a streamed load, false if it ends or fails first.
+ */
+static bool read_exactly(LoadReader reader, void* source, char* buffer, size_t size) {
+	for (size_t done = 0; done < size; ) {
+		ssize_t bytes = reader(source, buffer + done, size - done);
+		if (bytes <= 0) {
+			return false;
+		}
+		done += bytes;
+	}
+	return true;
+}
+
+// Read and drop the rest of a streamed load
+static void drain_stream(LoadReader reader, void* source) {
+	char buffer[BUF_SIZE];
+	while (reader(source, buffer, sizeof(buffer)) > 0);
+}
+
+/*
+ * Load a streamed columnar file, receiving every column straight into its
+ * segments. The rows only become part of the table once all have arrived.
+ */
+static Status load_columnar_stream(LoadReader reader, void* source) {
+	Status ret_status;
+	ret_status.code = ERROR;
+
+	ColumnarHeader header;
+	if (!read_exactly(reader, source, (char*) &header, sizeof(header)) ||
+			header.num_columns > MAX_COLUMNAR_COLUMNS) {
+		drain_stream(reader, source);
+		return ret_status;
+	}
+	ColumnarColumn* columns = malloc(header.num_columns * sizeof(ColumnarColumn));
+	Column** targets = NULL;
+	Table* table = NULL;
+	if (read_exactly(reader, source, (char*) columns, header.num_columns * sizeof(ColumnarColumn))) {
+		table = columnar_target(&header, columns, &targets);
+	}
+	free(columns);
+	if (table == NULL || reserve_rows(table, table->table_length + header.num_rows) == -1) {
+		free(targets);
+		drain_stream(reader, source);
+		return ret_status;
+	}
+
+	size_t row = table->table_length;
+	bool received = true;
+	for (size_t i = 0; i < header.num_columns && received; i++) {
+		for (size_t done = 0; done < header.num_rows && received; ) {
+			size_t offset = (row + done) & SEGMENT_MASK;
+			size_t count = SEGMENT_VALUES - offset < header.num_rows - done ? SEGMENT_VALUES - offset : header.num_rows - done;
+			int* values = targets[i]->segments[(row + done) >> SEGMENT_SHIFT] + offset;
+			received = read_exactly(reader, source, (char*) values, count * sizeof(int));
+			done += count;
+		}
+	}
+	free(targets);
+	drain_stream(reader, source);
+	if (!received) {
+		log_err("Columnar load data is truncated\n");
+		return ret_status;
+	}
+	commit_rows(table, row + header.num_rows);
+	ret_status.code = OK;
+	return ret_status;
+}
+
+/*
+ * Load a file on the server, either a columnar file or a CSV file whose
+ * header names the columns of a table. The file is mapped and read in place.
+ */
+Status load_table(const char* file_name) {
+	Status ret_status;
+
+	int fd = open(file_name, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) == -1) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		log_err("Unable to open file\n");
+		ret_status.code = ERROR;
+		return ret_status;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		log_err("Empty file\n");
+		ret_status.code = ERROR;
+		return ret_status;
+	}
+	const char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		log_err("Mmapping file failed\n");
+		ret_status.code = ERROR;
+		return ret_status;
+	}
+	madvise((void*) data, st.st_size, MADV_SEQUENTIAL);
+	const char* end = data + st.st_size;
+
+	if ((size_t) st.st_size >= sizeof(uint32_t) && *(const uint32_t*) data == COLUMNAR_MAGIC) {
+		ret_status = load_columnar(data, st.st_size);
+		munmap((void*) data, st.st_size);
+		return ret_status;
+	}
+
+	const char* header_end = memchr(data, '\n', st.st_size);
+	if (header_end == NULL) {
+		header_end = end;
+	}
+	Table* table = load_target(data, header_end - data);
+	if (table == NULL) {
+		ret_status.code = ERROR;
+	} else {
+		ret_status = load_rows(table, header_end < end ? header_end + 1 : end, end);
+	}
+
+	munmap((void*) data, st.st_size);
+	return ret_status;
+}
+
+/*
+ * Load CSV data that arrives in pieces. Whole lines are parsed as soon as
+ * LOAD_BUFFER_BYTES of them are in, the rest of the last line waits for the
+ * next piece. Once something went wrong the remaining data is read and
+ * dropped, so that the source is left at its end either way.
+ */
+static Status load_csv_stream(LoadReader reader, void* source) {
+	Status ret_status;
+	ret_status.code = OK;
+
+	char* buffer = malloc(LOAD_BUFFER_BYTES);
+	size_t filled = 0;
+	Table* table = NULL;
+	bool header = true;
+	bool failed = false;
+	bool at_end = false;
+	while (!at_end) {
+		ssize_t bytes = reader(source, buffer + filled, LOAD_BUFFER_BYTES - filled);
+		if (bytes < 0) {
+			// The source itself broke, there is nothing left to drain
+			ret_status.code = ERROR;
+			break;
+		}
+		at_end = bytes == 0;
+		filled += bytes;
+		if (failed) {
+			filled = 0;
+			continue;
+		}
+		if (filled < LOAD_BUFFER_BYTES && !at_end) {
+			continue;
+		}
+
+		// Parse up to the last line ending, or everything once at the end
+		const char* begin = buffer;
+		const char* end = buffer + filled;
+		const char* last_line = end;
+		if (!at_end) {
+			last_line = memrchr(buffer, '\n', filled);
+			if (last_line == NULL) {
+				log_err("Load data line longer than %d bytes\n", LOAD_BUFFER_BYTES);
+				failed = true;
+				filled = 0;
+				continue;
+			}
+			last_line++;
+		}
+		if (header) {
+			const char* header_end = memchr(begin, '\n', last_line - begin);
+			header_end = header_end ? header_end : last_line;
+			table = load_target(begin, header_end - begin);
+			header = false;
+			begin = header_end < last_line ? header_end + 1 : last_line;
+		}
+		if (table == NULL || load_rows(table, begin, last_line).code != OK) {
+			failed = true;
+		}
+
+		// Keep the start of the unfinished line for the next piece
+		filled = end - last_line;
+		memmove(buffer, last_line, filled);
+	}
+	free(buffer);
+
+	if (failed || header) {
+		ret_status.code = ERROR;
+	}
+	return ret_status;
 }
 
-Result* calculate_average(GeneralizedColumn values, Status* ret_status) {
-	Result* result = malloc(sizeof(Result));
-	result->num_tuples = 1;
-	result->capacity = 1;
-	result->data_type = FLOAT;
-	result->payload = malloc(sizeof(float));
+/*
+ * A streamed load whose first bytes have already been read.
+ */
+typedef struct PrefixedSource {
+	LoadReader reader;
+	void* source;
+	const char* prefix;
+	size_t prefix_size;
+} PrefixedSource;
+
+static ssize_t read_prefixed(void* context, char* buffer, size_t size) {
+	PrefixedSource* prefixed = (PrefixedSource*) context;
+	if (prefixed->prefix_size == 0) {
+		return prefixed->reader(prefixed->source, buffer, size);
+	}
+	size_t bytes = prefixed->prefix_size < size ? prefixed->prefix_size : size;
+	memcpy(buffer, prefixed->prefix, bytes);
+	prefixed->prefix += bytes;
+	prefixed->prefix_size -= bytes;
+	return bytes;
+}
 
-	long int sum = 0;
-	float avg;
-	if (values.column_type == COLUMN) {
-		Column* column_vals = values.column_pointer.column;
-		for (size_t i = 0; i < column_vals->length; i++) {
-			sum += (long int) column_vals->data[i];
-		}
-		avg = sum / (float) column_vals->length;
-	} else if (values.column_type == RESULT) {
-		Result* result_vals = values.column_pointer.result;
-		if (result_vals->data_type == INT) {
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				sum += (long int) *((int*) result_vals->payload + i);
-			}
-		} else if (result_vals->data_type == LONG) {
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				sum += *((long int*) result_vals->payload + i);
-			}
-		} else if (result_vals->data_type == FLOAT) {
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				sum += (long int) *((float*) result_vals->payload + i);
-			}
-		}
-		avg = sum / (float) result_vals->num_tuples;
+Status load_stream(LoadReader reader, void* source) {
+	// Tell columnar data from CSV by its first bytes
+	uint32_t magic = 0;
+	size_t filled = 0;
+	ssize_t bytes = 1;
+	while (filled < sizeof(magic) && bytes > 0) {
+		bytes = reader(source, (char*) &magic + filled, sizeof(magic) - filled);
+		filled += bytes > 0 ? bytes : 0;
 	}
+	PrefixedSource prefixed = { reader, source, (const char*) &magic, filled };
+	if (bytes < 0) {
+		Status ret_status;
+		ret_status.code = ERROR;
+		return ret_status;
+	}
+	if (filled == sizeof(magic) && magic == COLUMNAR_MAGIC) {
+		return load_columnar_stream(read_prefixed, &prefixed);
+	}
+	return load_csv_stream(read_prefixed, &prefixed);
+}
 
-	ret_status->code = OK;
-	*((float*) result->payload) = avg;
-	return result;
+static int write_export_file(void* sink, const char* buffer, size_t size) {
+	return fwrite(buffer, 1, size, (FILE*) sink) == size ? 0 : -1;
 }
 
-Result* calculate_max(GeneralizedColumn values, Status* ret_status) {
-	Result* result = malloc(sizeof(Result));
-	result->num_tuples = 1;
-	result->capacity = 1;
+/*
+ * Write a table as a columnar file, one segment at a time. Packed segments
+ * are decoded on the way.
+ */
+static Status export_table(Table* table, ExportWriter writer, void* sink) {
+	Status ret_status = load_columns(table);
+	if (ret_status.code != OK) {
+		return ret_status;
+	}
 
-	if (values.column_type == COLUMN) {
-		Column* column_vals = values.column_pointer.column;
-		int max = column_vals->data[0];
-		for (size_t i = 0; i < column_vals->length; i++) {
-			if (column_vals->data[i] > max) {
-				max = column_vals->data[i];
-			}
-		}
-		result->data_type = INT;
-		result->payload = malloc(sizeof(int));
-		*((int*) result->payload) = max;
-	} else if (values.column_type == RESULT) {
-		Result* result_vals = values.column_pointer.result;
-		if (result_vals->data_type == INT) {
-			int max = *((int*) result_vals->payload);
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				if (*((int*) result_vals->payload + i) > max) {
-					max = *((int*) result_vals->payload + i);
-				}
-			}
-			result->data_type = INT;
-			result->payload = malloc(sizeof(int));
-			*((int*) result->payload) = max;
-		} else if (result_vals->data_type == LONG) {
-			long int max = *((long int*) result_vals->payload);
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				if (*((long int*) result_vals->payload + i) > max) {
-					max = *((long int*) result_vals->payload + i);
-				}
-			}
-			result->data_type = LONG;
-			result->payload = malloc(sizeof(long int));
-			*((long int*) result->payload) = max;
-		} else if (result_vals->data_type == FLOAT) {
-			float max = *((float*) result_vals->payload);
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				if (*((float*) result_vals->payload + i) > max) {
-					max = *((float*) result_vals->payload + i);
-				}
-			}
-			result->data_type = FLOAT;
-			result->payload = malloc(sizeof(float));
-			*((float*) result->payload) = max;
+	ColumnarHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = COLUMNAR_MAGIC;
+	header.version = COLUMNAR_VERSION;
+	header.num_rows = table->table_length;
+	header.num_columns = table->col_count;
+	copy_name(header.db_name, current_db->name);
+	copy_name(header.table_name, table->name);
+	ColumnarColumn* columns = calloc(table->col_count, sizeof(ColumnarColumn));
+	for (size_t col = 0; col < table->col_count; col++) {
+		copy_name(columns[col].name, table->columns[col]->name);
+		columns[col].data_type = INT;
+	}
+	int written = writer(sink, (const char*) &header, sizeof(header));
+	if (written == 0) {
+		written = writer(sink, (const char*) columns, table->col_count * sizeof(ColumnarColumn));
+	}
+	free(columns);
+
+	int* scratch = NULL;
+	for (size_t col = 0; col < table->col_count && written == 0; col++) {
+		Column* column = table->columns[col];
+		for (size_t seg = 0; seg < segment_count(table->table_length) && written == 0; seg++) {
+			const int* values = segment_values(column, seg, &scratch);
+			written = writer(sink, (const char*) values, segment_length(table->table_length, seg) * sizeof(int));
 		}
 	}
+	free(scratch);
 
-	ret_status->code = OK;
-	return result;
+	if (written != 0) {
+		log_err("Writing export data failed\n");
+		ret_status.code = ERROR;
+	}
+	return ret_status;
 }
 
-Result* calculate_min(GeneralizedColumn values, Status* ret_status) {
-	Result* result = malloc(sizeof(Result));
-	result->num_tuples = 1;
-	result->capacity = 1;
 
-	if (values.column_type == COLUMN) {
-		Column* column_vals = values.column_pointer.column;
-		int min = column_vals->data[0];
-		for (size_t i = 0; i < column_vals->length; i++) {
-			if (column_vals->data[i] < min) {
-				min = column_vals->data[i];
-			}
+/*
+ * Attach a column to its persistence file. In COLUMN_MMAP mode the column is
+ * served straight from a mapping of the file, otherwise the file is copied
+ * into the column's heap buffer.
+ */
+static int open_column_file(Table* table, Column* column, CatalogColumn* entry) {
+	// Set the path name
+	char path[MAX_SIZE_NAME * 3 + strlen(MAINDIR) + 8];
+	sprintf(path, "%s/%s.%s.data", MAINDIR, table->name, column->name);
+
+	// Open the persistence file
+	int fd = open(path, O_RDWR, 0600);
+	if (fd < 0) {
+		log_err("Opening persistence file\n");
+		return -1;
+	}
+
+	size_t num_segments = table->table_capacity / SEGMENT_VALUES;
+	if (!COLUMN_MMAP) {
+		// Write data from file to the column's segments, reading ahead of the copy
+		posix_fadvise(fd, entry->file_offset, table->table_length * sizeof(int), POSIX_FADV_SEQUENTIAL);
+		posix_fadvise(fd, entry->file_offset, table->table_length * sizeof(int), POSIX_FADV_WILLNEED);
+		if (add_segments(column, num_segments) == -1) {
+			close(fd);
+			return -1;
 		}
-		result->data_type = INT;
-		result->payload = malloc(sizeof(int));
-		*((int*) result->payload) = min;
-	} else if (values.column_type == RESULT) {
-		Result* result_vals = values.column_pointer.result;
-		if (result_vals->data_type == INT) {
-			int min = *((int*) result_vals->payload);
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				if (*((int*) result_vals->payload + i) < min) {
-					min = *((int*) result_vals->payload + i);
-				}
-			}
-			result->data_type = INT;
-			result->payload = malloc(sizeof(int));
-			*((int*) result->payload) = min;
-		} else if (result_vals->data_type == LONG) {
-			long int min = *((long int*) result_vals->payload);
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				if (*((long int*) result_vals->payload + i) < min) {
-					min = *((long int*) result_vals->payload + i);
-				}
+		load_packed(table, column, entry);
+		for (size_t seg = 0; seg < segment_count(table->table_length); seg++) {
+			if (column->segments[seg] == NULL) {
+				continue;
 			}
-			result->data_type = LONG;
-			result->payload = malloc(sizeof(long int));
-			*((long int*) result->payload) = min;
-		} else if (result_vals->data_type == FLOAT) {
-			float min = *((float*) result_vals->payload);
-			for (size_t i = 0; i < result_vals->num_tuples; i++) {
-				if (*((float*) result_vals->payload + i) < min) {
-					min = *((float*) result_vals->payload + i);
-				}
+			size_t length = segment_length(table->table_length, seg) * sizeof(int);
+			ssize_t bytes = pread(fd, column->segments[seg], length, entry->file_offset + seg * SEGMENT_BYTES);
+			if (bytes != (ssize_t) length) {
+				close(fd);
+				log_err("Reading persistence file failed\n");
+				return -1;
 			}
-			result->data_type = FLOAT;
-			result->payload = malloc(sizeof(float));
-			*((float*) result->payload) = min;
 		}
+		close(fd);
+		load_zones(table, column);
+		return 0;
+	}
 
+	// Make room in the file for appends up to the table capacity
+	if (ftruncate(fd, entry->file_offset + num_segments * SEGMENT_BYTES) == -1) {
+		close(fd);
+		log_err("Extending persistence file failed\n");
+		return -1;
 	}
 
-	ret_status->code = OK;
-	return result;
-}
+	// Serve the column straight from a mapping of the file, pages are faulted
+	// in on demand. The segments are mapped at once and unmapped one by one.
+	column->fd = fd;
+	column->private_from = SIZE_MAX;
+	if (num_segments == 0) {
+		return 0;
+	}
+	int* data = (int*) mmap(0, num_segments * SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, entry->file_offset);
+	if (data == MAP_FAILED) {
+		log_err("Mmapping file failed\n");
+		return -1;
+	}
+	column->segments = malloc(segment_slots(num_segments) * sizeof(int*));
+	column->zones = malloc(segment_slots(num_segments) * sizeof(ZoneMap));
+	column->packed = calloc(segment_slots(num_segments), sizeof(PackedSegment*));
+	column->dirty_pages = calloc(dirty_words(num_segments * SEGMENT_VALUES), sizeof(uint64_t));
+	for (size_t seg = 0; seg < num_segments; seg++) {
+		column->segments[seg] = data + seg * SEGMENT_VALUES;
+	}
+	column->num_segments = num_segments;
+	load_packed(table, column, entry);
 
+	// Start reading the persisted values in before the first scan faults them in
+	for (size_t seg = 0; seg < segment_count(table->table_length); seg++) {
+		if (column->segments[seg]) {
+			madvise(column->segments[seg], segment_length(table->table_length, seg) * sizeof(int), MADV_WILLNEED);
+		}
+	}
+	load_zones(table, column);
+	return 0;
+}
 
-// Load database from file
-// TODO: send the file from client to server
-Status load_table(const char* file_name) {
+Status load_column(Table* table, Column* column) {
 	Status ret_status;
+	ret_status.code = OK;
+	ret_status.error_message = NULL;
+	if (column->catalog_entry == NULL) {
+		return ret_status;
+	}
 
-	FILE* fp;
-	fp = fopen(file_name, "r");
-	if (!fp) {
-		log_err("Unable to open file\n");
+	log_info("Loading column %s.%s\n", table->name, column->name);
+	if (open_column_file(table, column, column->catalog_entry) == -1) {
+		log_err("Loading column %s.%s failed\n", table->name, column->name);
 		ret_status.code = ERROR;
 		return ret_status;
 	}
+	free(column->catalog_entry);
+	column->catalog_entry = NULL;
+
+	// Catalogs of earlier versions have no statistics, they are gathered now
+	if (column->stats.count != table->table_length) {
+		stats_reset(&column->stats);
+		int* scratch = NULL;
+		for (size_t seg = 0; seg < segment_count(table->table_length); seg++) {
+			stats_add(&column->stats, segment_values(column, seg, &scratch), segment_length(table->table_length, seg));
+		}
+		free(scratch);
+	}
 
+	// Unclustered indexes aren't persisted, they are built again from the values
+	if (column->index && !(column->index->flags & INDEX_CLUSTERED) &&
+			extend_index(column, table->table_length) == -1) {
+		log_err("Building index on %s.%s failed\n", table->name, column->name);
+		ret_status.code = ERROR;
+	}
+	return ret_status;
+}
 
-	char buf[BUF_SIZE];
-	if (fgets(buf, BUF_SIZE, fp) == NULL) {
-		log_err("Empty file\n");
+Status load_columns(Table* table) {
+	Status ret_status;
+	ret_status.code = OK;
+	ret_status.error_message = NULL;
+	for (size_t col = 0; col < table->col_count && ret_status.code == OK; col++) {
+		ret_status = load_column(table, table->columns[col]);
 	}
+	return ret_status;
+}
 
-	// Get the table name
-    char* header = buf;
-    // Separate the db name from table name
-    char* db_name = strsep(&header, ".");
-	// If there is no dot
-    if (db_name == NULL) {
-        ret_status.code = ERROR;
-		return ret_status;
-    }
-    // Check that the database is the current active database
-    if (!current_db || strcmp(current_db->name, db_name) != 0) {
-        ret_status.code = ERROR;
-		return ret_status;
-    }
-    // Separate the table name from the rest of the header
-    char* table_name = strsep(&header, ".");
-    if (table_name == NULL) {
-        ret_status.code = ERROR;
+
+/*
+ * Register the database described by the persisted catalog, if there is one,
+ * leaving its columns to be loaded on first use. checkpoint_lsn is set to the
+ * last log record reflected in the column files.
+ */
+static Status load_catalog(uint64_t* checkpoint_lsn) {
+	Status ret_status;
+	*checkpoint_lsn = 0;
+
+	// Check if there's a database to load
+	CatalogHeader* catalog;
+	ret_status = read_catalog(&catalog);
+	if (ret_status.code != OK || catalog == NULL) {
 		return ret_status;
-    }
-    // Check that the table is in the database
-	Table* table = NULL;
-    for (size_t i = 0; i < current_db->tables_size; i++) {
-        if (strcmp(current_db->tables[i]->name, table_name) == 0) {
-            table = current_db->tables[i];
-        }
-    }
-	if (table == NULL) {
+	}
+	*checkpoint_lsn = catalog->checkpoint_lsn;
+
+	if (create_db(catalog->db_name).code != OK) {
+		log_err("Couldn't create db\n");
+		free(catalog);
 		ret_status.code = ERROR;
 		return ret_status;
 	}
 
-	// parse the data
-	while (fgets(buf, BUF_SIZE, fp) != NULL) {
-		char* line = buf;
-		char* token;
-
-		int* values = malloc(table->col_count * sizeof(int));
-		size_t idx = 0;
-
-		while ((token = strsep(&line, ",")) != NULL) {
-            int insert_val = atoi(token);
-            values[idx] = insert_val;
-            idx++;
-        }
-        // check that we received the correct number of input values
-        if (idx != table->col_count) {
-			ret_status.code = ERROR;
+	CatalogTable* entry = catalog_first_table(catalog);
+	for (uint64_t i = 0; i < catalog->num_tables; i++, entry = catalog_next_table(entry)) {
+		Table* table = create_table(current_db, entry->name, entry->col_count, &ret_status);
+		if (ret_status.code != OK) {
+			log_err("Couldn't create table\n");
+			free(catalog);
 			return ret_status;
-        }
+		}
+		table->table_length = entry->length;
+
+		CatalogColumn* columns = catalog_columns(entry);
+		for (uint64_t j = 0; j < entry->col_count; j++) {
+			Column* column = create_column(table, columns[j].name, 0, &ret_status);
+			if (ret_status.code != OK) {
+				log_err("Couldn't create column\n");
+				free(catalog);
+				return ret_status;
+			}
+			column->length = table->table_length;
+			column->persisted_length = table->table_length;
+			column->accesses = columns[j].accesses;
+			column->stats = columns[j].stats;
+
+			// A clustered index covers the persisted rows up to those inserted
+			// after its last merge
+			if (columns[j].index_type != INDEX_NONE) {
+				column->index = create_column_index(columns[j].index_type, columns[j].index_flags);
+				if (column->index->flags & INDEX_CLUSTERED) {
+					column->index->length = columns[j].index_length < table->table_length ?
+						columns[j].index_length : table->table_length;
+				}
+			}
 
-		relational_insert(table, values);
+			// The files are read when the column is first used
+			column->catalog_entry = malloc(sizeof(CatalogColumn));
+			*column->catalog_entry = columns[j];
+		}
+		table->table_capacity = segment_count(table->table_length) * SEGMENT_VALUES;
 	}
 
-	fclose(fp);
-
+	free(catalog);
 	ret_status.code = OK;
 	return ret_status;
 }
@@ -651,128 +3594,41 @@ Status load_table(const char* file_name) {
 Status db_startup() {
 	Status ret_status;
 
-	// Check if there's a database to load
-    struct stat st;
+	// Create the directory for the database on first start
+	struct stat st;
 	if (stat(MAINDIR, &st) == -1) {
-		ret_status.code = OK;
-		return ret_status;
+		mkdir(MAINDIR, 0777);
 	}
 
-	FILE* fp;
-	char meta_path[strlen(MAINDIR) + strlen(METADATA_FILE_NAME) + 2];
-	sprintf(meta_path, "%s/%s", MAINDIR, METADATA_FILE_NAME);
+	thread_pool_start();
+	log_info("Selecting with %s kernels\n", scan_kernel_name());
 
-	fp = fopen(meta_path, "r");
-	if (!fp) {
-		log_err("Unable to open file\n");
-		ret_status.code = ERROR;
+	uint64_t checkpoint_lsn;
+	ret_status = load_catalog(&checkpoint_lsn);
+	if (ret_status.code != OK) {
 		return ret_status;
 	}
 
-	char buf[BUF_SIZE];
-	if (fgets(buf, BUF_SIZE, fp) == NULL) {
-		log_err("Empty file\n");
-		fclose(fp);
-		ret_status.code = ERROR;
+	// Redo everything that happened after the column files were written
+	uint64_t last_lsn;
+	ret_status = wal_replay(checkpoint_lsn, &last_lsn);
+	if (ret_status.code != OK) {
 		return ret_status;
 	}
 
-	char* line = buf;
-	char* db_name = strsep(&line, ",");
-	char* table_count = strsep(&line, ",");
-	int num_tables = atoi(table_count);
-
-	if (create_db(db_name).code != OK) {
-		log_err("Couldn't create db");
-		fclose(fp);
-		ret_status.code = ERROR;
+	// Replayed rows are sorted into the indexes once, not record by record
+	ret_status = merge_pending_rows();
+	if (ret_status.code != OK) {
 		return ret_status;
 	}
 
-	for (int i = 0; i < num_tables; i++) {
-		fgets(buf, BUF_SIZE, fp);
-		line = buf;
-		char* table_name = strsep(&line, ",");
-		char* column_count = strsep(&line, ",");
-		char* table_length = strsep(&line, ",");
-		int num_columns = atoi(column_count);
-		int length = atoi(table_length);
-
-		Status rstatus;
-		Table* table = create_table(current_db, table_name, num_columns, &rstatus);
-		if (rstatus.code != OK) {
-			log_err("Couldn't create table");
-			fclose(fp);
-			ret_status.code = ERROR;
-			return ret_status;
-		}
-		table->table_length = length;
-
-		for (int j = 0; j < num_columns; j++) {
-			fgets(buf, BUF_SIZE, fp);
-			line = buf;
-			int last_char = strlen(line) - 1;
-			line[last_char] = '\0';
-			Column* column = create_column(table, line, 0, &rstatus);
-			if (rstatus.code != OK) {
-				log_err("Couldn't create column");
-				fclose(fp);
-				ret_status.code = ERROR;
-				return ret_status;
-			}
-			column->data = realloc(column->data, table->table_length * sizeof(int));
-			column->length = table->table_length;
-
-			// Set the path name
-			char path[MAX_SIZE_NAME * 3 + strlen(MAINDIR) + 8];
-			sprintf(path, "%s/%s.%s.data", MAINDIR, table->name, column->name);
-
-			// Open the persistence file
-			int fd;
-			fd = open(path, O_RDWR, 0600);
-			if (fd < 0) {
-				log_err("Opening persistence file\n");
-				fclose(fp);
-				ret_status.code = ERROR;
-    			return ret_status;
-			}
-
-			// Map the contents of the file to memory
-			int* data = (int*) mmap(0, table->table_length * sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-			if (data == MAP_FAILED) {
-				close(fd);
-				fclose(fp);
-				log_err("Mmapping file failed\n");
-				ret_status.code = ERROR;
-    			return ret_status;
-			}
-
-			// TODO: set column->data = data
-			// and directly modify memory mapped data
-
-			// Write data from file to column
-			for (size_t i = 0; i < table->table_length; i++) {
-				column->data[i] = data[i];
-			}
-
-			// TODO: sync and unmap in shutdown, not startup
-			
-			// Unmap the file and close the file descriptor
-			if (munmap(data, table->table_length * sizeof(int)) == -1) {
-				close(fd);
-				fclose(fp);
-				log_err("Munmap file failed\n");
-				ret_status.code = ERROR;
-    			return ret_status;
-			}
-
-			close(fd);
-		}
+	ret_status = wal_open(last_lsn);
+	if (ret_status.code != OK) {
+		return ret_status;
 	}
 
-	fclose(fp);
-
-	ret_status.code = OK;
+	checkpoint_start();
+	warmer_start();
 	return ret_status;
 }
 
@@ -780,117 +3636,36 @@ Status db_startup() {
 Status db_shutdown() {
     Status ret_status;
 
-	// If no db currently active, return OK
+	// Let a running checkpoint finish, the final one happens here
+	warmer_stop();
+	checkpoint_stop();
+
+	// If no db currently active, there is nothing to persist
 	if (!current_db) {
-		ret_status.code = OK;
+		thread_pool_stop();
+		ret_status = wal_close(true);
     	return ret_status;
 	}
 
-	// Create new directory for database
-	struct stat st;
-	if (stat(MAINDIR, &st) == -1) {
-		mkdir(MAINDIR, 0777);
+	ret_status = merge_pending_rows();
+	if (ret_status.code != OK) {
+		return ret_status;
 	}
-
-	// Construct metadata file
-	FILE* fp;
-	char meta_path[strlen(MAINDIR) + strlen(METADATA_FILE_NAME) + 2];
-	sprintf(meta_path, "%s/%s", MAINDIR, METADATA_FILE_NAME);
-	fp = fopen(meta_path, "w");
-	if (!fp) {
-		log_err("Unable to create metadata file\n");
-		ret_status.code = ERROR;
+	compress_columns();
+	ret_status = persist_database(wal_last_lsn());
+	if (ret_status.code != OK) {
 		return ret_status;
 	}
-	fprintf(fp, "%s,%zu\n", current_db->name, current_db->tables_size);
-	for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
-		Table* table = current_db->tables[tbl];
-		fprintf(fp, "%s,%zu,%zu\n", table->name, table->col_count, table->table_length);
-		for (size_t col = 0; col < table->col_count; col++) {
-			Column* column = table->columns[col];
-			fprintf(fp, "%s\n", column->name);
-		}
+	ret_status = wal_close(true);
+	if (ret_status.code != OK) {
+		return ret_status;
 	}
-	fclose(fp);
-
 
-	// Loop through the tables in the db
+	// Free the tables in the db
 	for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
 		Table* table = current_db->tables[tbl];
-
-		// Store columns of table as files
 		for (size_t col = 0; col < table->col_count; col++) {
-			Column* column = table->columns[col];
-
-			// Set the path name
-			char path[MAX_SIZE_NAME * 2 + strlen(MAINDIR) + 8];
-			sprintf(path, "%s/%s.%s.data", MAINDIR, table->name, column->name);
-			// char path[MAX_SIZE_NAME * 3 + 16];
-			// sprintf(path, "%s.%s.%s.data", current_db->name, table->name, column->name);
-
-			// Open/create the file
-			int fd;
-			int rflag = -1;
-			fd = open(path, O_RDWR | O_CREAT, 0600);
-			if (fd < 0) {
-				log_err("Opening persistence file failed\n");
-				ret_status.code = ERROR;
-    			return ret_status;
-			}
-
-			// Move the file pointer to the end of the file
-			rflag = lseek(fd, table->table_length * sizeof(int) - 1, SEEK_SET);
-			if (rflag == -1) {
-				close(fd);
-				log_err("Lseek in file failed\n");
-				ret_status.code = ERROR;
-    			return ret_status;
-			}
-
-			// Write an empty string to the end of the file
-			rflag = write(fd, "", 1);
-			if (rflag == -1) {
-				close(fd);
-				log_err("Writing to file failed\n");
-				ret_status.code = ERROR;
-    			return ret_status;
-			}
-
-			// Map the contents of the file to memory
-			int* data = (int*) mmap(0, table->table_length * sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-			if (data == MAP_FAILED) {
-				close(fd);
-				log_err("Mmapping file failed\n");
-				ret_status.code = ERROR;
-    			return ret_status;
-			}
-
-			// Write data from column to file
-			for (size_t i = 0; i < table->table_length; i++) {
-				data[i] = column->data[i];
-			}
-
-			// Sync the contents of the memory with the file and flush the pages to disk
-			if (data != NULL && fd != -1) {
-				rflag = msync(data, table->table_length * sizeof(int), MS_SYNC);
-				if (rflag == -1) {
-					close(fd);
-					log_err("Msync file failed\n");
-					ret_status.code = ERROR;
-    				return ret_status;
-				}
-				rflag = munmap(data, table->table_length * sizeof(int));
-				if (rflag == -1) {
-					close(fd);
-					log_err("Munmap file failed\n");
-					ret_status.code = ERROR;
-    				return ret_status;
-				}
-				close(fd);
-			}
-			free(column->data);
-			free(column->index);
-			free(column);
+			release_column(table->columns[col]);
 		}
 		free(table->columns);
 		free(table);
@@ -899,16 +3674,154 @@ Status db_shutdown() {
 	free(current_db);
 
 	current_db = NULL;
+	thread_pool_stop();
 
 	ret_status.code = OK;
     return ret_status;
 }
 
+/*
+ * The values of a fetch, sum or difference plan over the positions of its
+ * select.
+ */
+static Result* evaluate_plan(const Plan* plan, Result* positions) {
+	Status status;
+	if (plan->type == PLAN_FETCH) {
+		return fetch(plan->column, positions, &status);
+	}
+	Result* first = evaluate_plan(plan->first, positions);
+	Result* second = evaluate_plan(plan->second, positions);
+	Result* values = combine_values(first, second, plan->type == PLAN_SUBTRACT);
+	free_result(first);
+	free_result(second);
+	return values;
+}
+
+// Copy positions into a result, trimmed to the ones it holds
+static void copy_positions(Result* result, const Result* positions) {
+	size_t size;
+	result->data_type = positions->data_type;
+	result->num_tuples = positions->num_tuples;
+	if (positions->data_type == BITMAP) {
+		result->capacity = positions->capacity;
+		size = ((positions->capacity + 63) / 64 + 1) * sizeof(uint64_t);
+	} else {
+		result->capacity = positions->num_tuples > 0 ? positions->num_tuples : 1;
+		size = result->capacity * position_width(positions->data_type);
+	}
+	result->payload = malloc(size);
+	memcpy(result->payload, positions->payload, positions->data_type == BITMAP ? size :
+		positions->num_tuples * position_width(positions->data_type));
+}
+
+// Compute a result from its plan, given the positions of its select
+static void build_result(Result* result, Result* positions) {
+	if (result->plan->type == PLAN_SELECT) {
+		copy_positions(result, positions);
+	} else {
+		Result* values = evaluate_plan(result->plan, positions);
+		result->num_tuples = values->num_tuples;
+		result->capacity = values->capacity;
+		result->data_type = values->data_type;
+		result->payload = values->payload;
+		free(values);
+	}
+	free_plan(result->plan);
+	result->plan = NULL;
+}
+
+/*
+ * Compute a result put off until now, along with every other one of the
+ * client planned on the same select, so that the select runs once for all
+ * of them.
+ */
+static void materialize_result(ClientContext* context, Result* result) {
+	if (result == NULL || result->plan == NULL) {
+		return;
+	}
+	Plan select = *plan_select(result->plan);
+	Result positions = { 0, 0, INDEX, NULL, NULL };
+	scan_column(select.column, select.low, select.high, &positions);
+	finish_positions(&positions);
+
+	build_result(result, &positions);
+	for (int h = 0; h < context->chandles_in_use; h++) {
+		GeneralizedColumn* handle = &context->chandle_table[h].generalized_column;
+		Result* other = handle->column_pointer.result;
+		if (handle->column_type == RESULT && other != NULL && other->plan != NULL &&
+			same_select(plan_select(other->plan), &select)) {
+			build_result(other, &positions);
+		}
+	}
+	free(positions.payload);
+}
+
+// Compute every result of a client put off until now
+static void materialize_results(ClientContext* context) {
+	if (context == NULL) {
+		return;
+	}
+	for (int h = 0; h < context->chandles_in_use; h++) {
+		GeneralizedColumn* handle = &context->chandle_table[h].generalized_column;
+		if (handle->column_type == RESULT) {
+			materialize_result(context, handle->column_pointer.result);
+		}
+	}
+}
+
+/*
+ * Compute the results put off until now that an operator needs the values
+ * of. Chains of fetches, sums and differences over the same select are
+ * planned further, aggregates of them run as a pipeline, and writes compute
+ * every result first, as positions must keep referring to the rows they were
+ * selected from.
+ */
+static void materialize_operands(DbOperator* query) {
+	ClientContext* context = query->context;
+	if (query->type == CREATE || query->type == LOAD || query->type == INSERT) {
+		materialize_results(context);
+	} else if (query->type == SELECT && query->operator_fields.select_operator.indexes != NULL) {
+		materialize_result(context, query->operator_fields.select_operator.indexes);
+		materialize_result(context, query->operator_fields.select_operator.values);
+	} else if (query->type == FETCH) {
+		FetchOperator* fetch = &query->operator_fields.fetch_operator;
+		Plan* plan = fetch->indexes->plan;
+		if (plan != NULL && (plan->type != PLAN_SELECT || fetch->column->length != plan->column->length)) {
+			materialize_result(context, fetch->indexes);
+		}
+	} else if (query->type == PRINT) {
+		for (int r = 0; r < query->operator_fields.print_operator.num_results; r++) {
+			materialize_result(context, query->operator_fields.print_operator.results[r]);
+		}
+	} else if (query->type == ARITHMETIC) {
+		Result* first = query->operator_fields.arithmetic_operator.first;
+		Result* second = query->operator_fields.arithmetic_operator.second;
+		bool planned = first->plan != NULL && second->plan != NULL &&
+			first->plan->type != PLAN_SELECT && second->plan->type != PLAN_SELECT &&
+			same_select(plan_select(first->plan), plan_select(second->plan)) &&
+			plan_steps(first->plan) + plan_steps(second->plan) < PIPELINE_MAX_STEPS;
+		if (!planned) {
+			materialize_result(context, first);
+			materialize_result(context, second);
+		}
+	} else if (query->type == AGGREGATE) {
+		GeneralizedColumn values = query->operator_fields.aggregate_operator.values;
+		if (values.column_type == RESULT && !is_pipeline(values)) {
+			materialize_result(context, values.column_pointer.result);
+		}
+	}
+}
+
 char* execute_db_operator(DbOperator* query, bool* shutdown_flag) {
     // there is a small memory leak here (when combined with other parts of your database.)
     // as practice with something like valgrind and to develop intuition on memory leaks, find and fix the memory leak.
     char* response = NULL;
     Status status;
+    uint64_t lsn = 0;
+
+    if (query) {
+        materialize_operands(query);
+    }
 
     if (!query) {
         log_err("No query\n");
@@ -917,6 +3830,7 @@ char* execute_db_operator(DbOperator* query, bool* shutdown_flag) {
             if (create_db(query->operator_fields.create_operator.name).code != OK) {
                 log_err("Create db failed\n");
             } else {
+            	lsn = wal_log_create_db(query->operator_fields.create_operator.name);
             	log_test("Create db succeeded\n");
 			}
         } else if (query->operator_fields.create_operator.create_type == _TABLE) {
@@ -927,6 +3841,8 @@ char* execute_db_operator(DbOperator* query, bool* shutdown_flag) {
             if (status.code != OK) {
                 log_err("Create table failed\n");
             } else {
+            	lsn = wal_log_create_table(query->operator_fields.create_operator.name,
+            		query->operator_fields.create_operator.col_count);
             	log_test("Create table succeeded\n");
 			}
         } else if (query->operator_fields.create_operator.create_type == _COLUMN){
@@ -937,21 +3853,62 @@ char* execute_db_operator(DbOperator* query, bool* shutdown_flag) {
             if (status.code != OK) {
                 log_err("Create column failed\n");
             } else {
+            	lsn = wal_log_create_column(query->operator_fields.create_operator.table->name,
+            		query->operator_fields.create_operator.name);
             	log_test("Create column succeeded\n");
 			}
+        } else if (query->operator_fields.create_operator.create_type == _INDEX) {
+        	CreateOperator* create = &query->operator_fields.create_operator;
+            if (create_index(create->table, create->column, create->index_type, create->index_flags).code != OK) {
+                log_err("Create index failed\n");
+            } else {
+            	lsn = wal_log_create_index(create->table->name, create->column->name,
+            		create->index_type, create->index_flags);
+            	log_test("Create index succeeded\n");
+			}
         }
     } else if (query->type == LOAD) {
-        if (load_table(query->operator_fields.load_operator.file_name).code != OK) {
+    	// Remember the table lengths so that the loaded rows can be logged
+    	size_t num_tables = current_db ? current_db->tables_size : 0;
+    	size_t* lengths = malloc((num_tables + 1) * sizeof(size_t));
+    	for (size_t i = 0; i < num_tables; i++) {
+    		lengths[i] = current_db->tables[i]->table_length;
+    	}
+        LoadOperator* load = &query->operator_fields.load_operator;
+        Status load_status = load->reader ? load_stream(load->reader, load->source) : load_table(load->file_name);
+        if (load_status.code != OK) {
             log_err("Load failed\n");
         } else {
         	log_test("Load succeeded\n");
 		}
+		// Even a failed load may have appended rows before hitting a bad line
+		for (size_t i = 0; i < num_tables; i++) {
+			Table* table = current_db->tables[i];
+			if (table->table_length > lengths[i]) {
+				lsn = wal_log_append(table, lengths[i], table->table_length - lengths[i]);
+				if (update_indexes(table, 0).code != OK) {
+					log_err("Updating indexes failed\n");
+				}
+			}
+		}
+		free(lengths);
     } else if (query->type == INSERT) {
-        if (relational_insert(query->operator_fields.insert_operator.table, query->operator_fields.insert_operator.values).code != OK) {
+    	InsertOperator* insert = &query->operator_fields.insert_operator;
+    	Table* table = insert->table;
+    	const int* values[table->col_count + 1];
+    	for (size_t col = 0; col < table->col_count; col++) {
+    		values[col] = insert->values + col * insert->num_rows;
+    	}
+        if (append_rows(table, values, insert->num_rows).code != OK) {
             log_err("Insert failed\n");
         } else {
+        	lsn = wal_log_append(table, table->table_length - insert->num_rows, insert->num_rows);
+        	if (update_indexes(table, INDEX_PENDING_ROWS).code != OK) {
+        		log_err("Updating indexes failed\n");
+        	}
         	log_test("Insert succeeded\n");
 		}
+		free(insert->values);
     } else if (query->type == SELECT) {
         Result* indexes = select_column(query->operator_fields.select_operator, query->context, &status);
         if (status.code != OK) {
@@ -1052,11 +4009,50 @@ char* execute_db_operator(DbOperator* query, bool* shutdown_flag) {
         }
         query->operator_fields.aggregate_operator.handle->generalized_column.column_type = RESULT;
         query->operator_fields.aggregate_operator.handle->generalized_column.column_pointer.result = result;
+    } else if (query->type == EXPORT) {
+        ExportOperator* export = &query->operator_fields.export_operator;
+        if (export->writer) {
+            status = export_table(export->table, export->writer, export->sink);
+        } else {
+            // Without a client to stream to, the file is written on the server
+            FILE* file = fopen(export->file_name, "w");
+            status.code = ERROR;
+            if (file == NULL) {
+                log_err("Unable to create export file\n");
+            } else {
+                status = export_table(export->table, write_export_file, file);
+                if (fclose(file) != 0) {
+                    status.code = ERROR;
+                }
+            }
+        }
+        if (status.code != OK) {
+            log_err("Export failed\n");
+        } else {
+            log_test("Export succeeded\n");
+        }
+    } else if (query->type == CHECKPOINT) {
+        response = checkpoint_stats();
+    } else if (query->type == STATS) {
+        StatsOperator* stats = &query->operator_fields.stats_operator;
+        if (stats->column->stats.count != stats->table->table_length &&
+                load_column(stats->table, stats->column).code != OK) {
+            log_err("Loading column failed\n");
+        } else {
+            response = format_stats(&stats->column->stats);
+        }
     } else if (query->type == SHUTDOWN) {
         *shutdown_flag = true;
     } else {
         log_err("Unknown query while executing\n");
     }
+
+    // Don't acknowledge a change before its log records are durable
+    if (WAL_SYNC_COMMIT && lsn > 0 && wal_wait(lsn).code != OK) {
+    	log_err("Logging the change failed, it is lost on a crash\n");
+    	free(response);
+    	response = NULL;
+    }
     free(query);
     return response;
 }
\ No newline at end of file
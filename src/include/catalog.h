@@ -0,0 +1,85 @@
+// catalog.h
+//
+// The catalog describes the persisted database: its tables, their row counts
+// and, for every column, how and where its values are stored. It is a single
+// binary file that is read with one pread and checked against a checksum
+// before anything in it is trusted.
+//
+// Layout: a CatalogHeader, then for every table a CatalogTable immediately
+// followed by one CatalogColumn per column.
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stdint.h>
+#include "cs165_api.h"
+
+#define CATALOG_MAGIC 0x35363143 /* "C165" */
+#define CATALOG_VERSION 2
+
+// Column encodings, segments of a packed column may be in its .packed file
+#define COLUMN_ENCODING_PLAIN 0
+#define COLUMN_ENCODING_PACKED 1
+
+// Text catalog written by earlier versions, read once to migrate
+#define LEGACY_METADATA_FILE_NAME "meta.data"
+
+typedef struct CatalogHeader {
+    uint32_t magic;
+    uint32_t version;
+    // CRC-32 of everything following this field
+    uint32_t checksum;
+    uint32_t reserved;
+    uint64_t size;
+    uint64_t checkpoint_lsn;
+    uint64_t num_tables;
+    char db_name[MAX_SIZE_NAME];
+} CatalogHeader;
+
+typedef struct CatalogTable {
+    char name[MAX_SIZE_NAME];
+    uint64_t length;
+    uint64_t col_count;
+} CatalogTable;
+
+typedef struct CatalogColumn {
+    char name[MAX_SIZE_NAME];
+    uint32_t data_type;
+    uint32_t encoding;
+    // Index descriptor, index_type 0 means the column has no index
+    uint32_t index_type;
+    uint32_t index_flags;
+    // Byte offset of the first value in the column's data file
+    uint64_t file_offset;
+    // Segments that have been considered for packing, see Column
+    uint64_t sealed_segments;
+    // Lookups of the column since it was created, the warmer reads the most
+    // used columns in first
+    uint64_t accesses;
+    // Rows a clustered index keeps in order, the rows past them were inserted
+    // since and are sorted in on startup. Zero in catalogs written before
+    uint64_t index_length;
+    uint64_t reserved;
+    // Statistics of the column's values, new in version 2. A count short of
+    // the table length has them rebuilt when the column is loaded
+    ColumnStats stats;
+} CatalogColumn;
+
+/*
+ * Reads and validates the catalog. *catalog is set to NULL when there is no
+ * persisted database, otherwise it must be released with free().
+ */
+Status read_catalog(CatalogHeader** catalog);
+
+/*
+ * Atomically replaces the catalog with a description of current_db.
+ */
+Status write_catalog(uint64_t checkpoint_lsn);
+
+CatalogTable* catalog_first_table(CatalogHeader* catalog);
+
+CatalogTable* catalog_next_table(CatalogTable* table);
+
+CatalogColumn* catalog_columns(CatalogTable* table);
+
+#endif
@@ -0,0 +1,64 @@
+// checkpoint.h
+//
+// Background checkpoints. Every CHECKPOINT_INTERVAL_SEC a checkpoint thread
+// forks the server, much like Redis' BGSAVE: the child inherits a
+// copy-on-write snapshot of the database, writes the changed columns and a
+// new catalog and exits, while the parent goes on serving queries. Once the
+// child has succeeded the log segments it covers are removed, which bounds
+// both the size of the log and the work left for recovery and shutdown.
+//
+// Mapped columns share their pages with the child instead of being copied.
+// That is safe because the snapshot only covers rows up to the table lengths
+// at fork time and rows are only ever appended past them. Merging new rows
+// into a clustered table moves rows in place, it does so on private
+// copy-on-write mappings which the child gets a snapshot of like heap memory.
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Seconds between two checkpoints, 0 disables background checkpoints
+#ifndef CHECKPOINT_INTERVAL_SEC
+#define CHECKPOINT_INTERVAL_SEC 60
+#endif
+
+// Write bandwidth a checkpoint may use in MB/s, 0 means unlimited
+#ifndef CHECKPOINT_BANDWIDTH_MB
+#define CHECKPOINT_BANDWIDTH_MB 64
+#endif
+
+/*
+ * Held while a client message is processed. Checkpoints fork with it held,
+ * so that a snapshot never contains a half applied operator.
+ */
+extern pthread_mutex_t db_lock;
+
+typedef struct CheckpointStats {
+    uint64_t completed;
+    uint64_t failed;
+    // lsn recorded in the catalog of the last successful checkpoint
+    uint64_t checkpoint_lsn;
+    double last_duration_ms;
+    uint64_t last_bytes;
+    uint64_t total_bytes;
+} CheckpointStats;
+
+// Starts the checkpoint thread
+void checkpoint_start();
+
+// Stops the checkpoint thread, waiting for a running checkpoint to finish
+void checkpoint_stop();
+
+/*
+ * Accounts for bytes written while persisting columns. Inside a checkpoint
+ * this sleeps as needed to stay within CHECKPOINT_BANDWIDTH_MB.
+ */
+void checkpoint_throttle(size_t bytes);
+
+// Describes the checkpoints so far, the string must be released with free()
+char* checkpoint_stats();
+
+#endif
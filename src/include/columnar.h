@@ -0,0 +1,37 @@
+// columnar.h
+//
+// Binary columnar files, the fast way to move a table in and out of the
+// server. A file is a ColumnarHeader, one ColumnarColumn per column and then
+// the values of each column in turn, num_rows native ints per column, so
+// that a load copies them straight into segments and an export writes the
+// segments out as they are.
+//
+// load() tells such a file from a CSV file by its magic number.
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <stdint.h>
+#include "cs165_api.h"
+
+#define COLUMNAR_MAGIC 0x4c4f4343 /* "CCOL" */
+#define COLUMNAR_VERSION 1
+// Bound on the columns of a file, checked before anything is allocated
+#define MAX_COLUMNAR_COLUMNS 4096
+
+typedef struct ColumnarHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_rows;
+    uint64_t num_columns;
+    char db_name[MAX_SIZE_NAME];
+    char table_name[MAX_SIZE_NAME];
+} ColumnarHeader;
+
+typedef struct ColumnarColumn {
+    char name[MAX_SIZE_NAME];
+    uint32_t data_type;
+    uint32_t reserved;
+} ColumnarColumn;
+
+#endif
@@ -0,0 +1,57 @@
+// compression.h
+//
+// Lightweight encodings for full, immutable column segments. A segment is
+// packed with frame-of-reference (every value minus the segment minimum) or,
+// when its values never decrease, with deltas between neighbours; either way
+// the resulting numbers are bit-packed with just as many bits as the largest
+// of them needs. Both support decoding single values for fetches.
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Set to 0 to keep every segment as plain ints
+#ifndef COLUMN_COMPRESSION
+#define COLUMN_COMPRESSION 1
+#endif
+
+// Values between two absolute values stored with a delta encoded segment
+#define DELTA_ANCHOR_VALUES 128
+
+typedef enum SegmentEncoding {
+    ENCODING_FOR = 1,
+    ENCODING_DELTA = 2
+} SegmentEncoding;
+
+/*
+ * A packed segment, laid out the same in memory and on disk. words holds
+ * the bit-packed numbers, preceded for ENCODING_DELTA by one int32 anchor
+ * per DELTA_ANCHOR_VALUES values.
+ */
+typedef struct PackedSegment {
+    uint32_t encoding;
+    uint32_t bits;
+    // Segment minimum for ENCODING_FOR
+    int32_t base;
+    uint32_t num_values;
+    // Bytes of the whole packed segment, header included
+    uint64_t size;
+    uint64_t words[];
+} PackedSegment;
+
+/*
+ * Packs count values given their minimum and maximum. Returns NULL when no
+ * encoding saves enough to be worth decoding, otherwise a segment that must
+ * be released with free().
+ */
+PackedSegment* pack_segment(const int* values, size_t count, int min, int max);
+
+// Decodes all values of a packed segment into out
+void unpack_segment(const PackedSegment* packed, int* out);
+
+// Decodes the value at index of a packed segment
+int packed_value(const PackedSegment* packed, size_t index);
+
+#endif
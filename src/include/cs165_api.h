@@ -25,10 +25,16 @@ SOFTWARE.
 #ifndef CS165_H
 #define CS165_H
 
+#include <limits.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
+#include "compression.h"
+#include "index.h"
+#include "stats.h"
 
 // Limits the size of a name in our database to 64 characters
 #define MAX_SIZE_NAME 64
@@ -36,9 +42,28 @@ SOFTWARE.
 #define BUF_SIZE 1024
 #define DEFAULT_COL_SIZE 1024
 #define DEFAULT_BATCH_SIZE 32
+// Granularity of the in-place modification tracking, one 4 KB page of ints
+#define DIRTY_PAGE_VALUES 1024
+// Columns are stored in fixed-size segments, so that appends never move
+// existing values. A segment is a whole number of pages.
+#define SEGMENT_SHIFT 16
+#define SEGMENT_VALUES ((size_t) 1 << SEGMENT_SHIFT)
+#define SEGMENT_MASK (SEGMENT_VALUES - 1)
+#define SEGMENT_BYTES (SEGMENT_VALUES * sizeof(int))
+// Inserts leave up to this many rows past the indexes of a table, to be
+// merged in one go; selects answered from an index scan them on top
+#define INDEX_PENDING_ROWS SEGMENT_VALUES
+// Load data streamed by a client is parsed in pieces of up to this many bytes
+#define LOAD_BUFFER_BYTES (16 << 20)
 
 #define MAINDIR "data"
-#define METADATA_FILE_NAME "meta.data"
+#define METADATA_FILE_NAME "catalog.data"
+
+// When set, db_startup() serves persisted columns straight from MAP_SHARED
+// mappings of their data files instead of copying them onto the heap.
+#ifndef COLUMN_MMAP
+#define COLUMN_MMAP 1
+#endif
 
 /**
  * EXTRA
@@ -53,20 +78,65 @@ typedef enum DataType {
     INDEX,
     INT,
     LONG,
-    FLOAT
+    FLOAT,
+    // Positions as uint32_t, for tables of at most 2^32 rows
+    INDEX32,
+    // Positions as a bitmap, see Result
+    BITMAP
 } DataType;
 
 // struct Comparator;
-//struct ColumnIndex;
+
+/*
+ * Smallest and largest value stored in a segment, so that scans can skip
+ * segments or take them whole. An empty segment has min > max.
+ */
+typedef struct ZoneMap {
+    int min;
+    int max;
+} ZoneMap;
 
 typedef struct Column {
     char name[MAX_SIZE_NAME];
-    int* data;
-    // You will implement column indexes later.
-    void* index;
-    //struct ColumnIndex *index;
-    //bool clustered;
+    // Values are kept in num_segments segments of SEGMENT_VALUES values each
+    int** segments;
+    size_t num_segments;
+    // Zone map of every segment
+    ZoneMap* zones;
+    // Packed form of every segment, NULL for segments stored as plain ints.
+    // A packed segment has no plain values, its entry in segments is NULL
+    PackedSegment** packed;
+    // Segments [0, sealed_segments) have been considered for packing, those
+    // below packed_persisted have their packed form in the column's .packed file
+    size_t sealed_segments;
+    size_t packed_persisted;
+    // Set when segments in the column's .packed file have since been
+    // unpacked, the file is then rewritten rather than appended to
+    bool packed_rewrite;
+    // Index declared on the column, NULL if there is none
+    ColumnIndex* index;
     size_t length;
+    // Descriptor of the data file backing a mapped column, -1 for heap columns.
+    // Segment i of a mapped column maps the file at offset i * SEGMENT_BYTES
+    int fd;
+    // Segments of a mapped column from here on are private copy-on-write
+    // mappings, their changes reach the file only when persisted
+    size_t private_from;
+    // Number of values already in the data file (append high-water mark)
+    size_t persisted_length;
+    // Bitmap of the pages below the high-water mark modified since then
+    uint64_t* dirty_pages;
+    // Length and dirty pages captured by a background checkpoint in progress
+    size_t checkpoint_length;
+    uint64_t* checkpoint_dirty_pages;
+    // Catalog entry of a column whose files have not been read yet, NULL
+    // once it is loaded. See load_column()
+    struct CatalogColumn* catalog_entry;
+    // Lookups of the column, added up across restarts in the catalog
+    uint64_t accesses;
+    // Statistics of the column's values, covering all rows of its table once
+    // it is loaded. See stats.h
+    ColumnStats stats;
 } Column;
 
 
@@ -90,6 +160,7 @@ typedef struct Table {
     size_t col_count;
     size_t col_idx;
     size_t table_length;
+    // Always a whole number of segments
     size_t table_capacity;
 } Table;
 
@@ -141,11 +212,76 @@ typedef enum ComparatorType {
  */
 typedef struct Result {
     size_t num_tuples;
+    // Entries the payload has room for. A BITMAP result instead covers
+    // positions [0, capacity), bit i % 64 of word i / 64 set for position i
     size_t capacity;
     DataType data_type;
     void *payload;
+    // Set while the result is still to be computed, see Plan
+    struct Plan* plan;
 } Result;
 
+typedef enum PlanType {
+    PLAN_SELECT,
+    PLAN_FETCH,
+    PLAN_ADD,
+    PLAN_SUBTRACT
+} PlanType;
+
+/*
+ * How to compute a result whose evaluation was put off, so that a chain of
+ * a select of a column, fetches of its positions, sums and differences of
+ * those and an aggregate of them can run as one pass over the column without
+ * building the results in between. A result is only computed from its plan
+ * when something other than such a chain uses it; its other fields are
+ * unset until then. Plans hold copies of the plans they build on.
+ */
+typedef struct Plan {
+    PlanType type;
+    // The column selected from or fetched
+    Column* column;
+    // Values a select keeps
+    long int low;
+    long int high;
+    // The select a fetch takes positions from, or the operands of arithmetic
+    struct Plan* first;
+    struct Plan* second;
+} Plan;
+
+/*
+ * Select results hold positions in ascending order, as INDEX, INDEX32 or
+ * BITMAP, whichever is the smallest for the number of positions. A cursor
+ * walks them in order whatever the form. No more than num_tuples positions
+ * may be taken.
+ */
+typedef struct PositionCursor {
+    const Result* result;
+    // Next entry of a list, or current word of a bitmap
+    size_t next;
+    // Positions of the current bitmap word not taken yet
+    uint64_t bits;
+} PositionCursor;
+
+static inline void position_cursor_init(PositionCursor* cursor, const Result* result) {
+    cursor->result = result;
+    cursor->next = 0;
+    cursor->bits = result->data_type == BITMAP && result->capacity > 0 ? *(const uint64_t*) result->payload : 0;
+}
+
+static inline size_t next_position(PositionCursor* cursor) {
+    if (cursor->result->data_type == INDEX) {
+        return ((const size_t*) cursor->result->payload)[cursor->next++];
+    } else if (cursor->result->data_type == INDEX32) {
+        return ((const uint32_t*) cursor->result->payload)[cursor->next++];
+    }
+    while (cursor->bits == 0) {
+        cursor->bits = ((const uint64_t*) cursor->result->payload)[++cursor->next];
+    }
+    size_t position = (cursor->next << 6) + __builtin_ctzll(cursor->bits);
+    cursor->bits &= cursor->bits - 1;
+    return position;
+}
+
 /*
  * an enum which allows us to differentiate between columns and results
  */
@@ -199,7 +335,9 @@ typedef struct ClientContext {
 
 /**
  * comparator
- * A comparator defines a comparison operation over a column.
+ * A comparator defines a comparison operation over a column. A value
+ * matches when it compares to p_low as type1 says and to p_high as type2
+ * says; NO_COMPARISON leaves that side open.
  **/
 typedef struct Comparator {
     long int p_low; // used in equality and ranges.
@@ -223,6 +361,9 @@ typedef enum OperatorType {
     PRINT,
     ARITHMETIC,
     AGGREGATE,
+    CHECKPOINT,
+    STATS,
+    EXPORT,
     SHUTDOWN
 } OperatorType;
 
@@ -242,6 +383,7 @@ typedef enum CreateType {
     _DB,
     _TABLE,
     _COLUMN,
+    _INDEX,
 } CreateType;
 
 typedef enum BatchType {
@@ -255,6 +397,7 @@ typedef enum BatchType {
  * For example, if create_type == _DB, the operator should create a db named <<name>>
  * if create_type = _TABLE, the operator should create a table named <<name>> with <<col_count>> columns within db <<db>>
  * if create_type = = _COLUMN, the operator should create a column named <<name>> within table <<table>>
+ * if create_type == _INDEX, the operator should create an index of type <<index_type>> on <<column>> of <<table>>
  */
 typedef struct CreateOperator {
     CreateType create_type;
@@ -263,6 +406,9 @@ typedef struct CreateOperator {
     Table* table;
     int col_count;
     int sorted;
+    Column* column;
+    uint32_t index_type;
+    uint32_t index_flags;
 } CreateOperator;
 
 /*
@@ -270,15 +416,48 @@ typedef struct CreateOperator {
  */
 typedef struct InsertOperator {
     Table* table;
+    // num_rows values of the first column, then of the second and so on
     int* values;
+    size_t num_rows;
 } InsertOperator;
 /*
  * necessary fields for insertion
  */
+/*
+ * Reads the next piece of a streamed load into buffer, returning its size,
+ * 0 at the end of the data (and on every call after) and -1 if the source
+ * failed.
+ */
+typedef ssize_t (*LoadReader)(void* source, char* buffer, size_t size);
+
 typedef struct LoadOperator {
     char* file_name;
+    // Set if the data is streamed by the client instead of read from file_name
+    LoadReader reader;
+    void* source;
 } LoadOperator;
 
+/*
+ * Writes the next piece of an export, returning 0 or -1 if the sink failed.
+ */
+typedef int (*ExportWriter)(void* sink, const char* buffer, size_t size);
+
+typedef struct ExportOperator {
+    Table* table;
+    char* file_name;
+    // Set if the file is streamed to the client instead of written to file_name
+    ExportWriter writer;
+    void* sink;
+} ExportOperator;
+
+/*
+ * necessary fields for reporting column statistics
+ */
+typedef struct StatsOperator {
+    Table* table;
+    Column* column;
+} StatsOperator;
+
 typedef struct SelectOperator {
     Column* column;
     Result* indexes;
@@ -323,6 +502,8 @@ typedef union OperatorFields {
     CreateOperator create_operator;
     InsertOperator insert_operator;
     LoadOperator load_operator;
+    ExportOperator export_operator;
+    StatsOperator stats_operator;
     SelectOperator select_operator;
     FetchOperator fetch_operator;
     BatchOperator batch_operator;
@@ -346,6 +527,37 @@ typedef struct DbOperator {
 
 extern Db *current_db;
 
+// Value at index of a column
+static inline int column_value(const Column* column, size_t index) {
+    const int* segment = column->segments[index >> SEGMENT_SHIFT];
+    if (segment) {
+        return segment[index & SEGMENT_MASK];
+    }
+    return packed_value(column->packed[index >> SEGMENT_SHIFT], index & SEGMENT_MASK);
+}
+
+/*
+ * Copies a name into a buffer of MAX_SIZE_NAME chars, cut short if it is
+ * longer and always terminated.
+ */
+static inline void copy_name(char* name, const char* source) {
+    const char* end = memchr(source, '\0', MAX_SIZE_NAME - 1);
+    size_t length = end ? (size_t) (end - source) : MAX_SIZE_NAME - 1;
+    memcpy(name, source, length);
+    name[length] = '\0';
+}
+
+// Number of segments holding length values
+static inline size_t segment_count(size_t length) {
+    return (length + SEGMENT_VALUES - 1) >> SEGMENT_SHIFT;
+}
+
+// Number of values in a segment of a column holding length values
+static inline size_t segment_length(size_t length, size_t segment) {
+    size_t start = segment << SEGMENT_SHIFT;
+    return length - start < SEGMENT_VALUES ? length - start : SEGMENT_VALUES;
+}
+
 /*
  * Use this command to see if databases that were persisted start up properly. If files
  * don't load as expected, this can return an error.
@@ -360,6 +572,59 @@ Column* create_column(Table* table, char* name, int sorted, Status* ret_status);
 
 Status relational_insert(Table* table, int* values);
 
+/*
+ * Declares an index on a column and builds it over the rows the table has.
+ * A table has at most one clustered index, declaring it sorts the table.
+ */
+Status create_index(Table* table, Column* column, uint32_t type, uint32_t flags);
+
+/*
+ * Brings the indexes of a table up to date with the rows appended since they
+ * were last updated: one sort of the new rows, merged into each index. A
+ * clustered index moves the new rows into place, rewriting the table from
+ * the first row they land before. Indexes with at most pending rows past
+ * them are left alone. Called after the appended rows are logged.
+ */
+Status update_indexes(Table* table, size_t pending);
+
+/*
+ * Merges the rows left pending by inserts into the indexes of every table.
+ * Called with db_lock held at startup and shutdown only, when no client holds
+ * positions the merge could move rows under; checkpoints persist the
+ * pending rows as they are.
+ */
+Status merge_pending_rows();
+
+/*
+ * Appends num_rows rows to a table in one go, values[i] holding the values
+ * of column i. The values are copied segment by segment and the zone maps
+ * widened once, rather than row by row.
+ */
+Status append_rows(Table* table, const int* const* values, size_t num_rows);
+
+/*
+ * Columns of a persisted database are only read from disk when first used.
+ * load_column() reads a column if it hasn't been yet, load_columns() all
+ * columns of a table. Both are called with db_lock held.
+ */
+Status load_column(Table* table, Column* column);
+
+Status load_columns(Table* table);
+
+void mark_column_dirty(Column* column, size_t from, size_t to);
+
+// Copies values [first, first + count) of a column to out
+void read_column(Column* column, size_t first, size_t count, int* out);
+
+/*
+ * The values of a segment. Packed segments are decoded into *scratch, which
+ * is allocated on first use and must be released with free() by the caller.
+ */
+const int* segment_values(const Column* column, size_t seg, int** scratch);
+
+// Packs the segments persisted since the last call, called with db_lock held
+void compress_columns();
+
 Result* select_column(SelectOperator select_operator, ClientContext* context, Status* ret_status);
 
 Result* fetch(Column* column, Result* indexes, Status* ret_status);
@@ -370,6 +635,9 @@ void execute_batch(ClientContext* context, Status* ret_status);
 
 char* print_result(PrintOperator print_operator, Status* ret_status);
 
+// Frees a result, its payload or plan
+void free_result(Result* result);
+
 Result* add_values(Result* first, Result* second, Status* ret_status);
 
 Result* subtract_values(Result* first, Result* second, Status* ret_status);
@@ -384,8 +652,29 @@ Result* calculate_min(GeneralizedColumn values, Status* ret_status);
 
 Status load_table(const char* file_name);
 
+Status load_stream(LoadReader reader, void* source);
+
 Status db_shutdown();
 
+/*
+ * Writes the changes of every column and then a catalog recording
+ * checkpoint_lsn, so that log records up to it no longer need replaying.
+ */
+Status persist_database(uint64_t checkpoint_lsn);
+
+// Whether anything has changed since the columns were last persisted
+bool database_has_changes();
+
+/*
+ * Bookkeeping around a background checkpoint, called with db_lock held.
+ * checkpoint_started() takes over the dirty pages the checkpoint is writing,
+ * checkpoint_finished() advances the high-water marks if it succeeded and
+ * hands the pages back otherwise.
+ */
+void checkpoint_started();
+
+void checkpoint_finished(bool success);
+
 char* execute_db_operator(DbOperator* query, bool* shutdown_flag);
 
 void db_operator_free(DbOperator* query);
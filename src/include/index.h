@@ -0,0 +1,83 @@
+// index.h
+//
+// Column indexes, declared with create(idx,...) and built in bulk: appended
+// rows are sorted once with a parallel radix sort and merged in, rather than
+// being inserted one at a time.
+//
+// A clustered index keeps its whole table sorted on the column, so it needs
+// no structure of its own: the zone maps of the sorted segments narrow a
+// lookup down to a segment that is then binary searched. An unclustered
+// index keeps a sorted copy of the values along with their positions;
+// a B-tree adds levels of fence keys on top of that copy, built bottom-up.
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Keys per B-tree node, a cache line of ints
+#define INDEX_FANOUT 16
+
+typedef enum IndexType {
+    INDEX_NONE = 0,
+    INDEX_SORTED = 1,
+    INDEX_BTREE = 2
+} IndexType;
+
+// Index flags
+#define INDEX_CLUSTERED 1
+
+typedef struct ColumnIndex {
+    uint32_t type;
+    uint32_t flags;
+    // Rows [0, length) of the table are covered
+    size_t length;
+    // Unclustered indexes: the values in ascending order and their positions,
+    // equal values ordered by position
+    int* values;
+    size_t* positions;
+    // B-trees: levels[0] holds every INDEX_FANOUT-th value, levels[i + 1]
+    // every INDEX_FANOUT-th key of levels[i]
+    int** levels;
+    size_t* level_sizes;
+    size_t num_levels;
+} ColumnIndex;
+
+/*
+ * Rows are sorted as pairs of a key in the upper half and a payload in the
+ * lower half, usually the row's offset from the first row sorted.
+ */
+static inline uint64_t sort_pair(int key, uint32_t payload) {
+    return ((uint64_t) ((uint32_t) key ^ 0x80000000u) << 32) | payload;
+}
+
+static inline int pair_key(uint64_t pair) {
+    return (int) ((uint32_t) (pair >> 32) ^ 0x80000000u);
+}
+
+static inline uint32_t pair_payload(uint64_t pair) {
+    return (uint32_t) pair;
+}
+
+// Sorts pairs by key on the worker pool, pairs with equal keys keep their order
+void sort_pairs(uint64_t* pairs, size_t count);
+
+// A new index covering no rows yet
+ColumnIndex* create_column_index(uint32_t type, uint32_t flags);
+
+/*
+ * Merges count pairs sorted by sort_pairs() into an unclustered index. Their
+ * payloads are positions relative to base, all past the ones indexed so far.
+ */
+int index_merge(ColumnIndex* index, const uint64_t* pairs, size_t count, size_t base);
+
+// Forgets the rows of an unclustered index, to rebuild it from scratch
+void index_clear(ColumnIndex* index);
+
+// The first entry of an unclustered index whose value is at least value
+size_t index_lower_bound(const ColumnIndex* index, long int value);
+
+void free_column_index(ColumnIndex* index);
+
+#endif
@@ -15,7 +15,17 @@ typedef enum message_status {
     EXECUTION_ERROR,
     INCORRECT_FILE_FORMAT,
     FILE_NOT_FOUND,
-    INDEX_ALREADY_EXISTS
+    INDEX_ALREADY_EXISTS,
+    // Sent with a load query whose file the client streams after it, and
+    // with every piece of that file. An empty piece ends the file
+    LOAD_DATA,
+    // Sent with an export query whose file the client wants streamed back,
+    // and by the server with every piece of it ahead of the response
+    EXPORT_DATA,
+    // Sent with a relational_insert(db.tbl) query naming only the table, and
+    // with the single piece after it that holds the rows as ints, one row
+    // after another
+    INSERT_DATA
 } message_status;
 
 // message is a single packet of information sent between client/server.
@@ -6,4 +6,6 @@
 
 DbOperator* parse_command(char* query_command, message* send_message, int client, ClientContext* context);
 
+int insert_rows(InsertOperator* insert, const int* values, size_t count);
+
 #endif
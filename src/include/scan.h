@@ -0,0 +1,60 @@
+// scan.h
+//
+// Range-select kernels. They write out the positions of the values in
+// [low, high) with branchless compaction, as 64-bit or 32-bit positions or
+// as a bitmap, taking 16 values at a time with AVX-512, 8 with AVX2 and one
+// at a time otherwise. The widest kernel the processor supports is picked
+// the first time one is used. Each has a variant for ranges, equalities,
+// one-sided bounds and unbounded selects, used as the bounds call for.
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Set to 0 to always use the scalar kernels
+#ifndef SIMD_SCAN
+#define SIMD_SCAN 1
+#endif
+
+/*
+ * Writes base + i for every values[i] in [low, high), i < count, to out in
+ * ascending order and returns how many it wrote. out must have room for
+ * count positions, any of which may be overwritten.
+ */
+size_t select_range(const int* values, size_t count, long int low, long int high, size_t base, size_t* out);
+
+/*
+ * Writes positions[i] for every values[i] in [low, high), i < count, to out
+ * and returns how many it wrote. out must have room for count positions.
+ */
+size_t select_range_positions(const int* values, const size_t* positions, size_t count,
+                              long int low, long int high, size_t* out);
+
+// select_range() with 32-bit positions
+size_t select_range32(const int* values, size_t count, long int low, long int high, uint32_t base, uint32_t* out);
+
+// select_range_positions() with 32-bit positions
+size_t select_range_positions32(const int* values, const uint32_t* positions, size_t count,
+                                long int low, long int high, uint32_t* out);
+
+/*
+ * Sets bit i % 64 of words[i / 64] for every values[i] in [low, high),
+ * i < count, and clears the others, up to the end of the last word. Returns
+ * the number of bits set.
+ */
+size_t select_range_bitmap(const int* values, size_t count, long int low, long int high, uint64_t* words);
+
+/*
+ * Keeps the bits of num_words words whose values lie in [low, high) and
+ * writes them to out, values holding one value per set bit in order.
+ * Returns the number of bits kept. This one has no SIMD variant.
+ */
+size_t select_bitmap_subset(const int* values, const uint64_t* words, size_t num_words,
+                            long int low, long int high, uint64_t* out);
+
+// Instruction set of the kernels in use: "avx512", "avx2" or "scalar"
+const char* scan_kernel_name();
+
+#endif
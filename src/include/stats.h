@@ -0,0 +1,60 @@
+// stats.h
+//
+// Column statistics, kept up to date as rows are appended and persisted in
+// the catalog: the number of rows seen, their smallest and largest value, a
+// HyperLogLog sketch estimating the number of distinct values, and a uniform
+// reservoir sample of the values from which an equi-depth histogram is drawn.
+// All of them only grow with appends, so they never need a rescan.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// HyperLogLog registers, 2^10 of them estimate within about 3%
+#define STATS_HLL_BITS 10
+#define STATS_HLL_REGISTERS (1 << STATS_HLL_BITS)
+
+// Values kept in the reservoir sample
+#define STATS_SAMPLE_SIZE 1024
+
+// Buckets of the equi-depth histogram
+#define STATS_HISTOGRAM_BUCKETS 16
+
+/*
+ * Laid out the same in memory and in the catalog. An empty column has
+ * min > max.
+ */
+typedef struct ColumnStats {
+    uint64_t count;
+    int32_t min;
+    int32_t max;
+    uint8_t registers[STATS_HLL_REGISTERS];
+    // The first min(count, STATS_SAMPLE_SIZE) entries are in use
+    int32_t sample[STATS_SAMPLE_SIZE];
+} ColumnStats;
+
+// Statistics of no rows
+void stats_reset(ColumnStats* stats);
+
+// Adds count more rows of a column to its statistics
+void stats_add(ColumnStats* stats, const int* values, size_t count);
+
+// Estimated number of distinct values
+uint64_t stats_distinct(const ColumnStats* stats);
+
+/*
+ * Bounds of the equi-depth histogram, each of the STATS_HISTOGRAM_BUCKETS
+ * buckets [bounds[i], bounds[i + 1]] holding about as many rows. Returns the
+ * number of buckets filled, fewer if there are fewer rows.
+ */
+size_t stats_histogram(const ColumnStats* stats, int* bounds);
+
+// Estimated fraction of the rows with a value in [low, high)
+double stats_selectivity(const ColumnStats* stats, long int low, long int high);
+
+// Describes the statistics as key=value pairs, like checkpoint_stats
+char* format_stats(const ColumnStats* stats);
+
+#endif
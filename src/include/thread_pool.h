@@ -0,0 +1,41 @@
+// thread_pool.h
+//
+// A fixed pool of worker threads for fanning work out across cores, for
+// instance one task per column file at startup and shutdown. Work is
+// submitted as a number of independent tasks that run in any order; the
+// submitting thread takes part in running them and returns once all are done.
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+// Number of worker threads, 0 means one per online core
+#ifndef WORKER_THREADS
+#define WORKER_THREADS 0
+#endif
+
+typedef void (*TaskFunction)(void* context, size_t index);
+
+// Starts the worker threads
+void thread_pool_start();
+
+// Stops the worker threads, tasks submitted afterwards run on the caller
+void thread_pool_stop();
+
+/*
+ * Forgets the workers in a forked child, where they don't exist. Tasks
+ * submitted in the child then run on the caller.
+ */
+void thread_pool_forget();
+
+// Number of threads running tasks, counting the submitting thread
+size_t thread_pool_size();
+
+/*
+ * Runs task(context, i) for every i in [0, num_tasks) and waits for all of
+ * them. Tasks submitted from inside a task run inline on that thread.
+ */
+void parallel_for(size_t num_tasks, TaskFunction task, void* context);
+
+#endif
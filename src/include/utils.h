@@ -8,6 +8,8 @@
 #define __UTILS_H__
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 
 /**
@@ -34,6 +36,13 @@ char* trim_whitespace(char *str);
 
 char* trim_quotes(char *str);
 
+/**
+ * computes the CRC-32 of a buffer, continuing from a previous crc
+ * (pass 0 to start a new checksum)
+ **/
+
+uint32_t crc32(const void* buf, size_t len, uint32_t crc);
+
 // cs165_log(out, format, ...)
 // Writes the string from @format to the @out pointer, extendable for
 // additional parameters.
@@ -0,0 +1,105 @@
+// wal.h
+//
+// Append-only write-ahead log. Every operator that changes the database
+// appends a record here before its result is acknowledged, and db_startup()
+// replays the records that are newer than the last persisted catalog.
+//
+// Records are buffered in memory and written out by a background flusher
+// thread, so that many records share a single fdatasync (group commit).
+//
+// The log is split into numbered segments. A checkpoint starts a new segment
+// and, once its catalog is on disk, removes the segments before it.
+
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+#include "cs165_api.h"
+
+#define WAL_SEGMENT_FORMAT "wal.%06u.log"
+
+// Set to 0 to run without a log; data is then only durable after db_shutdown()
+#ifndef WAL_ENABLED
+#define WAL_ENABLED 1
+#endif
+
+// When set, operators wait for their records to reach disk before returning.
+// Set to 0 to acknowledge them right away and let the flusher commit groups
+// of records every WAL_FLUSH_INTERVAL_MS, which loses the acknowledged work
+// of up to that long when the server is killed.
+#ifndef WAL_SYNC_COMMIT
+#define WAL_SYNC_COMMIT 1
+#endif
+
+#ifndef WAL_FLUSH_INTERVAL_MS
+#define WAL_FLUSH_INTERVAL_MS 10
+#endif
+
+// Buffered bytes that wake the flusher early, appenders block at 4x this size
+#define WAL_BUFFER_SIZE (4 << 20)
+
+// Rows per append record, so that loads are logged in bounded chunks
+#define WAL_APPEND_CHUNK (1 << 16)
+
+typedef enum WalRecordType {
+    WAL_CREATE_DB = 1,
+    WAL_CREATE_TABLE = 2,
+    WAL_CREATE_COLUMN = 3,
+    WAL_APPEND = 4,
+    WAL_CREATE_INDEX = 5
+} WalRecordType;
+
+/*
+ * Every record starts with this header. The checksum covers the rest of the
+ * header and the payload, so a torn write at the tail of the log is detected.
+ */
+typedef struct WalRecordHeader {
+    uint32_t checksum;
+    uint32_t type;
+    uint64_t lsn;
+    uint32_t length;
+    uint32_t reserved;
+} WalRecordHeader;
+
+/*
+ * Replays every record with an lsn greater than checkpoint_lsn on top of the
+ * current database. Returns the lsn of the last valid record in the log.
+ */
+Status wal_replay(uint64_t checkpoint_lsn, uint64_t* last_lsn);
+
+// Opens the log for appending and starts the flusher thread
+Status wal_open(uint64_t last_lsn);
+
+// Stops the flusher, flushes pending records and optionally empties the log
+Status wal_close(bool truncate);
+
+/*
+ * Flushes the pending records and continues the log in a new segment, whose
+ * number is returned. segment is 0 when the log is disabled.
+ */
+Status wal_rotate(uint32_t* segment);
+
+// Removes every segment numbered below segment
+void wal_drop_segments(uint32_t segment);
+
+uint64_t wal_log_create_db(const char* db_name);
+
+uint64_t wal_log_create_table(const char* table_name, size_t col_count);
+
+uint64_t wal_log_create_column(const char* table_name, const char* column_name);
+
+uint64_t wal_log_create_index(const char* table_name, const char* column_name, uint32_t type, uint32_t flags);
+
+// Logs rows [first_row, first_row + num_rows) of a table, read from its columns
+uint64_t wal_log_append(Table* table, size_t first_row, size_t num_rows);
+
+/*
+ * Blocks until every record up to lsn is durable. Fails if the log could not
+ * be written, after which no further records become durable.
+ */
+Status wal_wait(uint64_t lsn);
+
+// The lsn of the most recently appended record
+uint64_t wal_last_lsn();
+
+#endif
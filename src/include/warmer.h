@@ -0,0 +1,23 @@
+// warmer.h
+//
+// Columns of a persisted database are read from disk the first time a query
+// looks them up (see load_column()), so the server accepts connections as
+// soon as it has read the catalog, however large the database. Meanwhile the
+// warmer, a background thread, reads in the columns that saw use before the
+// restart, most used first, so that queries on them mostly find them loaded.
+
+#ifndef WARMER_H
+#define WARMER_H
+
+// Set to 0 to only ever load columns on demand
+#ifndef COLUMN_WARMER
+#define COLUMN_WARMER 1
+#endif
+
+// Starts the warmer thread, which exits once no used column is left on disk
+void warmer_start();
+
+// Stops the warmer thread, waiting for the columns it is loading
+void warmer_stop();
+
+#endif
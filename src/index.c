@@ -0,0 +1,277 @@
+/*
+ * This file implements the column indexes described in index.h.
+ *
+ * sort_pairs() is a least significant digit radix sort over the 32 key bits
+ * of the pairs. Every pass splits the pairs into one chunk per thread: the
+ * chunks count their digits, the counts are turned into the offset of every
+ * chunk's run of each digit, and the chunks then scatter their pairs there.
+ * Chunks keep their order, so the sort is stable.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "index.h"
+#include "thread_pool.h"
+
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// Fewer pairs than this are sorted by the calling thread alone
+#define PARALLEL_SORT_PAIRS (1 << 16)
+
+typedef struct RadixPass {
+    const uint64_t* src;
+    uint64_t* dst;
+    size_t count;
+    size_t num_chunks;
+    uint32_t shift;
+    // RADIX_BUCKETS counters per chunk, counts and then offsets
+    size_t* histograms;
+} RadixPass;
+
+
+static void chunk_bounds(const RadixPass* pass, size_t chunk, size_t* begin, size_t* end) {
+    *begin = pass->count * chunk / pass->num_chunks;
+    *end = pass->count * (chunk + 1) / pass->num_chunks;
+}
+
+static void histogram_task(void* context, size_t chunk) {
+    RadixPass* pass = (RadixPass*) context;
+    size_t* histogram = pass->histograms + chunk * RADIX_BUCKETS;
+    memset(histogram, 0, RADIX_BUCKETS * sizeof(size_t));
+    size_t begin, end;
+    chunk_bounds(pass, chunk, &begin, &end);
+    for (size_t i = begin; i < end; i++) {
+        histogram[(pass->src[i] >> pass->shift) & (RADIX_BUCKETS - 1)]++;
+    }
+}
+
+static void scatter_task(void* context, size_t chunk) {
+    RadixPass* pass = (RadixPass*) context;
+    size_t* offsets = pass->histograms + chunk * RADIX_BUCKETS;
+    size_t begin, end;
+    chunk_bounds(pass, chunk, &begin, &end);
+    for (size_t i = begin; i < end; i++) {
+        uint64_t pair = pass->src[i];
+        pass->dst[offsets[(pair >> pass->shift) & (RADIX_BUCKETS - 1)]++] = pair;
+    }
+}
+
+void sort_pairs(uint64_t* pairs, size_t count) {
+    if (count < 2) {
+        return;
+    }
+
+    uint64_t* scratch = malloc(count * sizeof(uint64_t));
+    RadixPass pass;
+    pass.src = pairs;
+    pass.dst = scratch;
+    pass.count = count;
+    pass.num_chunks = count < PARALLEL_SORT_PAIRS ? 1 : thread_pool_size();
+    pass.histograms = malloc(pass.num_chunks * RADIX_BUCKETS * sizeof(size_t));
+
+    for (pass.shift = 32; pass.shift < 64; pass.shift += RADIX_BITS) {
+        parallel_for(pass.num_chunks, histogram_task, &pass);
+
+        // Digits are laid out in order, and within a digit the chunks
+        size_t offset = 0;
+        bool single_digit = false;
+        for (size_t digit = 0; digit < RADIX_BUCKETS; digit++) {
+            for (size_t chunk = 0; chunk < pass.num_chunks; chunk++) {
+                size_t* counter = &pass.histograms[chunk * RADIX_BUCKETS + digit];
+                size_t digit_count = *counter;
+                single_digit |= digit_count == count;
+                *counter = offset;
+                offset += digit_count;
+            }
+        }
+        // A pass in which all pairs share the digit wouldn't move any of them
+        if (single_digit) {
+            continue;
+        }
+
+        parallel_for(pass.num_chunks, scatter_task, &pass);
+        uint64_t* sorted = pass.dst;
+        pass.dst = (uint64_t*) pass.src;
+        pass.src = sorted;
+    }
+
+    if (pass.src != pairs) {
+        memcpy(pairs, pass.src, count * sizeof(uint64_t));
+    }
+    free(pass.histograms);
+    free(scratch);
+}
+
+
+ColumnIndex* create_column_index(uint32_t type, uint32_t flags) {
+    ColumnIndex* index = calloc(1, sizeof(ColumnIndex));
+    index->type = type;
+    index->flags = flags;
+    return index;
+}
+
+static void free_levels(ColumnIndex* index) {
+    for (size_t level = 0; level < index->num_levels; level++) {
+        free(index->levels[level]);
+    }
+    free(index->levels);
+    free(index->level_sizes);
+    index->levels = NULL;
+    index->level_sizes = NULL;
+    index->num_levels = 0;
+}
+
+/*
+ * Build the fence key levels of a B-tree bottom-up from its sorted values,
+ * until a single node holds the root level.
+ */
+static int build_levels(ColumnIndex* index) {
+    free_levels(index);
+    if (index->type != INDEX_BTREE) {
+        return 0;
+    }
+
+    const int* keys = index->values;
+    size_t size = index->length;
+    while (size > INDEX_FANOUT) {
+        size_t fences = (size + INDEX_FANOUT - 1) / INDEX_FANOUT;
+        int* level = malloc(fences * sizeof(int));
+        int** levels = realloc(index->levels, (index->num_levels + 1) * sizeof(int*));
+        size_t* level_sizes = realloc(index->level_sizes, (index->num_levels + 1) * sizeof(size_t));
+        if (levels) {
+            index->levels = levels;
+        }
+        if (level_sizes) {
+            index->level_sizes = level_sizes;
+        }
+        if (level == NULL || levels == NULL || level_sizes == NULL) {
+            free(level);
+            free_levels(index);
+            return -1;
+        }
+        for (size_t fence = 0; fence < fences; fence++) {
+            level[fence] = keys[fence * INDEX_FANOUT];
+        }
+        index->levels[index->num_levels] = level;
+        index->level_sizes[index->num_levels] = fences;
+        index->num_levels++;
+        keys = level;
+        size = fences;
+    }
+    return 0;
+}
+
+int index_merge(ColumnIndex* index, const uint64_t* pairs, size_t count, size_t base) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t length = index->length + count;
+
+    // Rows arriving in order are simply appended
+    if (index->length == 0 || index->values[index->length - 1] <= pair_key(pairs[0])) {
+        int* values = realloc(index->values, length * sizeof(int));
+        if (values == NULL) {
+            return -1;
+        }
+        index->values = values;
+        size_t* positions = realloc(index->positions, length * sizeof(size_t));
+        if (positions == NULL) {
+            return -1;
+        }
+        index->positions = positions;
+        for (size_t j = 0; j < count; j++) {
+            values[index->length + j] = pair_key(pairs[j]);
+            positions[index->length + j] = base + pair_payload(pairs[j]);
+        }
+        index->length = length;
+        return build_levels(index);
+    }
+
+    int* values = malloc(length * sizeof(int));
+    size_t* positions = malloc(length * sizeof(size_t));
+    if (values == NULL || positions == NULL) {
+        free(values);
+        free(positions);
+        return -1;
+    }
+
+    // Entries already indexed have the lower positions, so they go first
+    // among equal values
+    size_t i = 0;
+    size_t j = 0;
+    for (size_t k = 0; k < length; k++) {
+        if (j == count || (i < index->length && index->values[i] <= pair_key(pairs[j]))) {
+            values[k] = index->values[i];
+            positions[k] = index->positions[i++];
+        } else {
+            values[k] = pair_key(pairs[j]);
+            positions[k] = base + pair_payload(pairs[j++]);
+        }
+    }
+
+    free(index->values);
+    free(index->positions);
+    index->values = values;
+    index->positions = positions;
+    index->length = length;
+    return build_levels(index);
+}
+
+void index_clear(ColumnIndex* index) {
+    free_levels(index);
+    free(index->values);
+    free(index->positions);
+    index->values = NULL;
+    index->positions = NULL;
+    index->length = 0;
+}
+
+
+// The first of keys [begin, end) that is at least value, or end
+static size_t scan_node(const int* keys, size_t begin, size_t end, long int value) {
+    while (begin < end && keys[begin] < value) {
+        begin++;
+    }
+    return begin;
+}
+
+size_t index_lower_bound(const ColumnIndex* index, long int value) {
+    if (index->num_levels == 0) {
+        size_t low = 0;
+        size_t high = index->length;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (index->values[middle] < value) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    // Descend from the root into the node below the last key under value,
+    // whose first key is under value as well
+    size_t begin = 0;
+    size_t end = index->level_sizes[index->num_levels - 1];
+    for (size_t level = index->num_levels; level > 0; level--) {
+        size_t first_above = scan_node(index->levels[level - 1], begin, end, value);
+        if (first_above == 0) {
+            return 0;
+        }
+        size_t child_size = level > 1 ? index->level_sizes[level - 2] : index->length;
+        begin = (first_above - 1) * INDEX_FANOUT;
+        end = begin + INDEX_FANOUT < child_size ? begin + INDEX_FANOUT : child_size;
+    }
+    return scan_node(index->values, begin, end, value);
+}
+
+void free_column_index(ColumnIndex* index) {
+    if (index == NULL) {
+        return;
+    }
+    index_clear(index);
+    free(index);
+}
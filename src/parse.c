@@ -96,6 +96,95 @@ DbOperator* parse_create_col(char* create_arguments, message* send_message) {
 }
 
 
+/**
+ * lookup_table_column finds a column given as db.tbl.col along with its
+ * table, for operators that need both. Returns NULL if there is no such column.
+ **/
+static Column* lookup_table_column(char* name, Table** table) {
+    // Split db.tbl from the column name
+    char* separator = strrchr(name, '.');
+    if (separator == NULL) {
+        return NULL;
+    }
+    *separator = '\0';
+    *table = lookup_table(name);
+    for (size_t i = 0; *table != NULL && i < (*table)->col_idx; i++) {
+        if (strcmp((*table)->columns[i]->name, separator + 1) == 0) {
+            return (*table)->columns[i];
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * Parse create index, create(idx,<db.tbl.col>,<sorted|btree>,<clustered|unclustered>)
+ **/
+
+DbOperator* parse_create_idx(char* create_arguments, message* send_message) {
+    char** create_arguments_index = &create_arguments;
+    char* column_name = next_token(create_arguments_index, &send_message->status);
+    char* index_type = next_token(create_arguments_index, &send_message->status);
+    char* clustering = next_token(create_arguments_index, &send_message->status);
+
+    // Incorrect number of arguments
+    if (send_message->status == INCORRECT_FORMAT) {
+        log_err("Incorrect number of arguments\n");
+        return NULL;
+    }
+
+    // Read and chop off last char, which should be a ')'
+    int last_char = strlen(clustering) - 1;
+    if (clustering[last_char] != ')') {
+        log_err("Missing ')' in query\n");
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+
+    // Replace the ')' with a null terminating character
+    clustering[last_char] = '\0';
+
+    uint32_t type;
+    if (strcmp(index_type, "sorted") == 0) {
+        type = INDEX_SORTED;
+    } else if (strcmp(index_type, "btree") == 0) {
+        type = INDEX_BTREE;
+    } else {
+        log_err("Unknown index type\n");
+        send_message->status = INVALID_ARGUMENT;
+        return NULL;
+    }
+    uint32_t flags;
+    if (strcmp(clustering, "clustered") == 0) {
+        flags = INDEX_CLUSTERED;
+    } else if (strcmp(clustering, "unclustered") == 0) {
+        flags = 0;
+    } else {
+        log_err("Index must be clustered or unclustered\n");
+        send_message->status = INVALID_ARGUMENT;
+        return NULL;
+    }
+
+    Table* table;
+    Column* column = lookup_table_column(column_name, &table);
+    if (column == NULL) {
+        log_err("Column not found\n");
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+
+    // Make create dbo for index
+    DbOperator* dbo = malloc(sizeof(DbOperator));
+    dbo->type = CREATE;
+    dbo->operator_fields.create_operator.create_type = _INDEX;
+    dbo->operator_fields.create_operator.table = table;
+    dbo->operator_fields.create_operator.column = column;
+    dbo->operator_fields.create_operator.index_type = type;
+    dbo->operator_fields.create_operator.index_flags = flags;
+    return dbo;
+}
+
+
 /**
  * Parse create table
  **/
@@ -229,6 +318,8 @@ DbOperator* parse_create(char* create_arguments, message* send_message) {
                 dbo = parse_create_tbl(tokenizer_copy, send_message);
             } else if (strcmp(token, "col") == 0) {
                 dbo = parse_create_col(tokenizer_copy, send_message);
+            } else if (strcmp(token, "idx") == 0) {
+                dbo = parse_create_idx(tokenizer_copy, send_message);
             } else {
                 send_message->status = UNKNOWN_COMMAND;
             }
@@ -242,13 +333,42 @@ DbOperator* parse_create(char* create_arguments, message* send_message) {
 }
 
 
+/**
+ * insert_rows fills an insert operator with count values given one row after
+ * another, putting the values of each column next to each other. Returns -1
+ * unless they make up whole rows of the operator's table.
+ **/
+
+int insert_rows(InsertOperator* insert, const int* values, size_t count) {
+    size_t col_count = insert->table->col_count;
+    if (col_count == 0 || count == 0 || count % col_count != 0) {
+        return -1;
+    }
+
+    size_t num_rows = count / col_count;
+    insert->num_rows = num_rows;
+    insert->values = malloc(count * sizeof(int));
+    for (size_t row = 0; row < num_rows; row++) {
+        for (size_t col = 0; col < col_count; col++) {
+            insert->values[col * num_rows + row] = values[row * col_count + col];
+        }
+    }
+    return 0;
+}
+
+
 /**
  * parse_insert reads in the arguments for a create statement and
- * then passes these arguments to a database function to insert a row.
+ * then passes these arguments to a database function to insert rows.
+ * Any multiple of the column count may be given, one row after another.
+ * Given only the table, the operator is left without rows for those of
+ * the INSERT_DATA piece that follows the query.
  **/
 
 DbOperator* parse_insert(char* query_command, message* send_message) {
-    unsigned int columns_inserted = 0;
+    size_t values_inserted = 0;
+    size_t values_capacity = 0;
+    int* values = NULL;
     char* token = NULL;
 
     // Check for leading '('
@@ -263,6 +383,13 @@ DbOperator* parse_insert(char* query_command, message* send_message) {
             return NULL;
         }
 
+        // A table name closing the query announces binary rows
+        size_t name_length = strlen(table_name);
+        bool binary = *command_index == NULL && name_length > 0 && table_name[name_length - 1] == ')';
+        if (binary) {
+            table_name[name_length - 1] = '\0';
+        }
+
         // Lookup the table and make sure it exists
         Table* insert_table = lookup_table(table_name);
         if (insert_table == NULL) {
@@ -270,24 +397,31 @@ DbOperator* parse_insert(char* query_command, message* send_message) {
             return NULL;
         }
 
-        // Make insert operator
         DbOperator* dbo = malloc(sizeof(DbOperator));
         dbo->type = INSERT;
         dbo->operator_fields.insert_operator.table = insert_table;
-        dbo->operator_fields.insert_operator.values = malloc(sizeof(int) * insert_table->col_count);
+        dbo->operator_fields.insert_operator.values = NULL;
+        dbo->operator_fields.insert_operator.num_rows = 0;
+        if (binary) {
+            return dbo;
+        }
 
         // parse inputs until we reach the end. Turn each given string into an integer.
         while ((token = strsep(command_index, ",")) != NULL) {
-            int insert_val = atoi(token);
-            dbo->operator_fields.insert_operator.values[columns_inserted] = insert_val;
-            columns_inserted++;
+            if (values_inserted == values_capacity) {
+                values_capacity = values_capacity ? values_capacity * 2 : insert_table->col_count;
+                values = realloc(values, values_capacity * sizeof(int));
+            }
+            values[values_inserted++] = atoi(token);
         }
-        // check that we received the correct number of input values
-        if (columns_inserted != insert_table->col_count) {
+        // check that we received whole rows
+        if (insert_rows(&dbo->operator_fields.insert_operator, values, values_inserted) == -1) {
             send_message->status = INCORRECT_FORMAT;
+            free(values);
             free(dbo);
             return NULL;
         }
+        free(values);
         return dbo;
     } else {
         log_err("Missing '(' in query\n");
@@ -340,6 +474,8 @@ DbOperator* parse_load(char* load_arguments, message* send_message) {
         DbOperator* dbo = malloc(sizeof(DbOperator));
         dbo->type = LOAD;
         dbo->operator_fields.load_operator.file_name = file_name;
+        dbo->operator_fields.load_operator.reader = NULL;
+        dbo->operator_fields.load_operator.source = NULL;
         return dbo;
     } else {
         log_err("Missing '(' in query\n");
@@ -348,6 +484,52 @@ DbOperator* parse_load(char* load_arguments, message* send_message) {
     }
 }
 
+/**
+ * parse_export
+ **/
+
+DbOperator* parse_export(char* export_arguments, message* send_message) {
+    if (strncmp(export_arguments, "(", 1) != 0) {
+        log_err("Missing '(' in query\n");
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    export_arguments++;
+
+    // Read and chop off last char, which should be a ')'
+    int last_char = strlen(export_arguments) - 1;
+    if (last_char < 0 || export_arguments[last_char] != ')') {
+        log_err("Missing ')' in query\n");
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    export_arguments[last_char] = '\0';
+
+    char* table_name = strsep(&export_arguments, ",");
+    char* file_name = strsep(&export_arguments, ",");
+    if (file_name == NULL || export_arguments != NULL) {
+        log_err("Incorrect number of arguments\n");
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+
+    Table* table = lookup_table(table_name);
+    if (table == NULL) {
+        log_err("Table not found\n");
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+
+    // Make export operator
+    DbOperator* dbo = malloc(sizeof(DbOperator));
+    dbo->type = EXPORT;
+    dbo->operator_fields.export_operator.table = table;
+    dbo->operator_fields.export_operator.file_name = trim_quotes(file_name);
+    dbo->operator_fields.export_operator.writer = NULL;
+    dbo->operator_fields.export_operator.sink = NULL;
+    return dbo;
+}
+
 
 /**
  * parse_select
@@ -382,8 +564,11 @@ DbOperator* parse_select(char* select_arguments, message* send_message, ClientCo
             arg3[last_char] = '\0';
 
             // Parse the bounds
-            int low = (strcmp(arg2, "null") == 0) ? INT_MIN : atoi(arg2);
-            int high = (strcmp(arg3, "null") == 0) ? INT_MAX : atoi(arg3);
+            // A null bound leaves its side of the range open
+            bool open_low = strcmp(arg2, "null") == 0;
+            bool open_high = strcmp(arg3, "null") == 0;
+            int low = open_low ? 0 : atoi(arg2);
+            int high = open_high ? 0 : atoi(arg3);
 
             // Make select dbo
             DbOperator* dbo = malloc(sizeof(DbOperator));
@@ -393,8 +578,8 @@ DbOperator* parse_select(char* select_arguments, message* send_message, ClientCo
             dbo->operator_fields.select_operator.values = NULL;
             dbo->operator_fields.select_operator.comparator.p_low = low;
             dbo->operator_fields.select_operator.comparator.p_high = high;
-            dbo->operator_fields.select_operator.comparator.type1 = GREATER_THAN_OR_EQUAL;
-            dbo->operator_fields.select_operator.comparator.type2 = LESS_THAN;
+            dbo->operator_fields.select_operator.comparator.type1 = open_low ? NO_COMPARISON : GREATER_THAN_OR_EQUAL;
+            dbo->operator_fields.select_operator.comparator.type2 = open_high ? NO_COMPARISON : LESS_THAN;
             dbo->operator_fields.select_operator.handle = handle;
             return dbo;
         } else {
@@ -418,8 +603,11 @@ DbOperator* parse_select(char* select_arguments, message* send_message, ClientCo
             }
             arg4[last_char] = '\0';
 
-            int low = (strcmp(arg3, "null") == 0) ? INT_MIN : atoi(arg3);
-            int high = (strcmp(arg4, "null") == 0) ? INT_MAX : atoi(arg4);
+            // A null bound leaves its side of the range open
+            bool open_low = strcmp(arg3, "null") == 0;
+            bool open_high = strcmp(arg4, "null") == 0;
+            int low = open_low ? 0 : atoi(arg3);
+            int high = open_high ? 0 : atoi(arg4);
 
             DbOperator* dbo = malloc(sizeof(DbOperator));
             dbo->type = SELECT;
@@ -428,8 +616,8 @@ DbOperator* parse_select(char* select_arguments, message* send_message, ClientCo
             dbo->operator_fields.select_operator.values = values_handle->generalized_column.column_pointer.result;
             dbo->operator_fields.select_operator.comparator.p_low = low;
             dbo->operator_fields.select_operator.comparator.p_high = high;
-            dbo->operator_fields.select_operator.comparator.type1 = GREATER_THAN_OR_EQUAL;
-            dbo->operator_fields.select_operator.comparator.type2 = LESS_THAN;
+            dbo->operator_fields.select_operator.comparator.type1 = open_low ? NO_COMPARISON : GREATER_THAN_OR_EQUAL;
+            dbo->operator_fields.select_operator.comparator.type2 = open_high ? NO_COMPARISON : LESS_THAN;
             dbo->operator_fields.select_operator.handle = handle;
             return dbo;
         }
@@ -605,6 +793,34 @@ DbOperator* parse_aggregate(char* aggregate_arguments, AggregateType type, messa
     }
 }
 
+/**
+ * parse_column_stats reads the column of a column_stats(<db.tbl.col>) query
+ **/
+
+DbOperator* parse_column_stats(char* stats_arguments, message* send_message) {
+    if (strncmp(stats_arguments, "(", 1) != 0) {
+        log_err("Missing '(' in query\n");
+        send_message->status = INCORRECT_FORMAT;
+        return NULL;
+    }
+    char* column_name = trim_parenthesis(stats_arguments);
+
+    Table* table;
+    Column* column = lookup_table_column(column_name, &table);
+    if (column == NULL) {
+        log_err("Column not found\n");
+        send_message->status = OBJECT_NOT_FOUND;
+        return NULL;
+    }
+
+    DbOperator* dbo = malloc(sizeof(DbOperator));
+    dbo->type = STATS;
+    dbo->operator_fields.stats_operator.table = table;
+    dbo->operator_fields.stats_operator.column = column;
+    return dbo;
+}
+
+
 /**
  * parse_command takes as input the send_message from the client and then
  * parses it into the appropriate query. Stores into send_message the
@@ -640,8 +856,8 @@ DbOperator* parse_command(char* query_command, message* send_message, int client
         if (handle == NULL) {
             handle = create_handle(context, handle_name);
         } else {
-            free(handle->generalized_column.column_pointer.result->payload);
-            free(handle->generalized_column.column_pointer.result);
+            free_result(handle->generalized_column.column_pointer.result);
+            handle->generalized_column.column_pointer.result = NULL;
         }
 
         query_command = ++equals_pointer;
@@ -666,6 +882,9 @@ DbOperator* parse_command(char* query_command, message* send_message, int client
     } else if (strncmp(query_command, "load", 4) == 0) {
         query_command += 4;
         dbo = parse_load(query_command, send_message);
+    } else if (strncmp(query_command, "export", 6) == 0) {
+        query_command += 6;
+        dbo = parse_export(query_command, send_message);
     } else if (strncmp(query_command, "select", 6) == 0) {
         query_command += 6;
         dbo = parse_select(query_command, send_message, context, handle);
@@ -685,6 +904,12 @@ DbOperator* parse_command(char* query_command, message* send_message, int client
         DbOperator* dbo = malloc(sizeof(DbOperator));
         dbo->type = SHUTDOWN;
         return dbo;
+    } else if (strncmp(query_command, "checkpoint_stats", 16) == 0) {
+        dbo = malloc(sizeof(DbOperator));
+        dbo->type = CHECKPOINT;
+    } else if (strncmp(query_command, "column_stats", 12) == 0) {
+        query_command += 12;
+        dbo = parse_column_stats(query_command, send_message);
     } else if (strncmp(query_command, "add", 3) == 0) {
         query_command += 3;
         dbo = parse_arithmetic(query_command, _ADDITION, send_message, context, handle);
@@ -0,0 +1,625 @@
+/*
+ * This file implements the range-select kernels described in scan.h.
+ *
+ * Bounds are first narrowed to the ints they admit, and the kernels are
+ * picked from what is left of them: an equality, a one-sided bound, any
+ * value at all, or else an inclusive range [lo, lo + span] of ints, where a
+ * value v matches when the unsigned difference v - lo is at most span. Each
+ * is a single compare per value, with no branch on its outcome.
+ *
+ * Every kernel is stamped out once per predicate from the same template, so
+ * that the predicate is fixed at compile time and the loop carries no
+ * switch. Every kernel writes the positions of a whole block of values to
+ * out unconditionally and then advances by the number of matches, which is
+ * why out needs room for count positions.
+ *
+ * AVX2 has no compress instruction, the matching lanes are instead gathered
+ * with a permutation looked up by the comparison mask.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "scan.h"
+
+#if SIMD_SCAN && defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define X86_KERNELS 1
+#else
+#define X86_KERNELS 0
+#endif
+
+/*
+ * Predicates the kernels are specialized for. Each takes a bound and a
+ * span: v in [bound, bound + span], v == bound, v >= bound, v <= bound, or
+ * any v.
+ */
+typedef enum Predicate {
+    MATCH_RANGE,
+    MATCH_EQUAL,
+    MATCH_AT_LEAST,
+    MATCH_AT_MOST,
+    MATCH_ANY,
+    NUM_PREDICATES
+} Predicate;
+
+typedef size_t (*RangeKernel)(const int* values, size_t count, int32_t bound, uint32_t span,
+                              size_t base, size_t* out);
+typedef size_t (*PositionsKernel)(const int* values, const size_t* positions, size_t count,
+                                  int32_t bound, uint32_t span, size_t* out);
+typedef size_t (*Range32Kernel)(const int* values, size_t count, int32_t bound, uint32_t span,
+                                uint32_t base, uint32_t* out);
+typedef size_t (*Positions32Kernel)(const int* values, const uint32_t* positions, size_t count,
+                                    int32_t bound, uint32_t span, uint32_t* out);
+typedef size_t (*BitmapKernel)(const int* values, size_t count, int32_t bound, uint32_t span, uint64_t* words);
+typedef size_t (*SubsetKernel)(const int* values, const uint64_t* words, size_t num_words,
+                               int32_t bound, uint32_t span, uint64_t* out);
+
+typedef struct ScanKernels {
+    const char* name;
+    RangeKernel range[NUM_PREDICATES];
+    PositionsKernel positions[NUM_PREDICATES];
+    Range32Kernel range32[NUM_PREDICATES];
+    Positions32Kernel positions32[NUM_PREDICATES];
+    BitmapKernel bitmap[NUM_PREDICATES];
+    SubsetKernel subset[NUM_PREDICATES];
+} ScanKernels;
+
+static ScanKernels kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+
+// Whether a value matches, one function per predicate
+static inline bool match_range(int value, int32_t bound, uint32_t span) {
+    return (uint32_t) value - (uint32_t) bound <= span;
+}
+
+static inline bool match_equal(int value, int32_t bound, uint32_t span) {
+    (void) span;
+    return value == bound;
+}
+
+static inline bool match_at_least(int value, int32_t bound, uint32_t span) {
+    (void) span;
+    return value >= bound;
+}
+
+static inline bool match_at_most(int value, int32_t bound, uint32_t span) {
+    (void) span;
+    return value <= bound;
+}
+
+static inline bool match_any(int value, int32_t bound, uint32_t span) {
+    (void) value;
+    (void) bound;
+    (void) span;
+    return true;
+}
+
+#define SCALAR_KERNELS(predicate) \
+static size_t range_scalar_##predicate(const int* values, size_t count, int32_t bound, uint32_t span, \
+                                       size_t base, size_t* out) { \
+    size_t n = 0; \
+    for (size_t i = 0; i < count; i++) { \
+        out[n] = base + i; \
+        n += match_##predicate(values[i], bound, span); \
+    } \
+    return n; \
+} \
+\
+static size_t positions_scalar_##predicate(const int* values, const size_t* positions, size_t count, \
+                                           int32_t bound, uint32_t span, size_t* out) { \
+    size_t n = 0; \
+    for (size_t i = 0; i < count; i++) { \
+        out[n] = positions[i]; \
+        n += match_##predicate(values[i], bound, span); \
+    } \
+    return n; \
+} \
+\
+static size_t range32_scalar_##predicate(const int* values, size_t count, int32_t bound, uint32_t span, \
+                                         uint32_t base, uint32_t* out) { \
+    size_t n = 0; \
+    for (size_t i = 0; i < count; i++) { \
+        out[n] = base + (uint32_t) i; \
+        n += match_##predicate(values[i], bound, span); \
+    } \
+    return n; \
+} \
+\
+static size_t positions32_scalar_##predicate(const int* values, const uint32_t* positions, size_t count, \
+                                             int32_t bound, uint32_t span, uint32_t* out) { \
+    size_t n = 0; \
+    for (size_t i = 0; i < count; i++) { \
+        out[n] = positions[i]; \
+        n += match_##predicate(values[i], bound, span); \
+    } \
+    return n; \
+} \
+\
+static size_t bitmap_scalar_##predicate(const int* values, size_t count, int32_t bound, uint32_t span, \
+                                        uint64_t* words) { \
+    size_t n = 0; \
+    for (size_t i = 0; i < count; i += 64) { \
+        size_t block = count - i < 64 ? count - i : 64; \
+        uint64_t word = 0; \
+        for (size_t j = 0; j < block; j++) { \
+            word |= (uint64_t) match_##predicate(values[i + j], bound, span) << j; \
+        } \
+        words[i / 64] = word; \
+        n += __builtin_popcountll(word); \
+    } \
+    return n; \
+} \
+\
+static size_t subset_scalar_##predicate(const int* values, const uint64_t* words, size_t num_words, \
+                                        int32_t bound, uint32_t span, uint64_t* out) { \
+    size_t n = 0; \
+    size_t value = 0; \
+    for (size_t w = 0; w < num_words; w++) { \
+        uint64_t word = 0; \
+        for (uint64_t bits = words[w]; bits; bits &= bits - 1) { \
+            uint64_t match = match_##predicate(values[value++], bound, span); \
+            word |= match << __builtin_ctzll(bits); \
+        } \
+        out[w] = word; \
+        n += __builtin_popcountll(word); \
+    } \
+    return n; \
+}
+
+SCALAR_KERNELS(range)
+SCALAR_KERNELS(equal)
+SCALAR_KERNELS(at_least)
+SCALAR_KERNELS(at_most)
+SCALAR_KERNELS(any)
+
+
+#if X86_KERNELS
+
+// For every mask of 8 lanes, the matching lanes in order
+static int32_t lane_lut[256][8];
+// For every mask of 4 64-bit lanes, the 32-bit halves of the matching lanes
+static int32_t pair_lut[16][8];
+
+static void build_luts() {
+    for (int mask = 0; mask < 256; mask++) {
+        int n = 0;
+        for (int lane = 0; lane < 8; lane++) {
+            if (mask & (1 << lane)) {
+                lane_lut[mask][n++] = lane;
+            }
+        }
+        while (n < 8) {
+            lane_lut[mask][n++] = 0;
+        }
+    }
+    for (int mask = 0; mask < 16; mask++) {
+        int n = 0;
+        for (int lane = 0; lane < 4; lane++) {
+            if (mask & (1 << lane)) {
+                pair_lut[mask][n++] = 2 * lane;
+                pair_lut[mask][n++] = 2 * lane + 1;
+            }
+        }
+        while (n < 8) {
+            pair_lut[mask][n++] = 0;
+        }
+    }
+}
+
+/*
+ * Bit i set for every one of the 8 values at values that matches, one
+ * function per predicate. The span comes with its sign bit flipped.
+ */
+__attribute__((target("avx2")))
+static inline unsigned match_range_avx2(const int* values, __m256i bound, __m256i span) {
+    // Unsigned compare through a signed one with the sign bits flipped
+    __m256i flip = _mm256_set1_epi32(INT32_MIN);
+    __m256i difference = _mm256_xor_si256(_mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) values), bound), flip);
+    __m256i outside = _mm256_cmpgt_epi32(difference, span);
+    return ~(unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xFF;
+}
+
+__attribute__((target("avx2")))
+static inline unsigned match_equal_avx2(const int* values, __m256i bound, __m256i span) {
+    (void) span;
+    __m256i equal = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*) values), bound);
+    return (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned match_at_least_avx2(const int* values, __m256i bound, __m256i span) {
+    (void) span;
+    __m256i below = _mm256_cmpgt_epi32(bound, _mm256_loadu_si256((const __m256i*) values));
+    return ~(unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(below)) & 0xFF;
+}
+
+__attribute__((target("avx2")))
+static inline unsigned match_at_most_avx2(const int* values, __m256i bound, __m256i span) {
+    (void) span;
+    __m256i above = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*) values), bound);
+    return ~(unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(above)) & 0xFF;
+}
+
+__attribute__((target("avx2")))
+static inline unsigned match_any_avx2(const int* values, __m256i bound, __m256i span) {
+    (void) values;
+    (void) bound;
+    (void) span;
+    return 0xFF;
+}
+
+#define AVX2_KERNELS(predicate) \
+__attribute__((target("avx2,popcnt"))) \
+static size_t range_avx2_##predicate(const int* values, size_t count, int32_t bound, uint32_t span, \
+                                     size_t base, size_t* out) { \
+    __m256i bound_vector = _mm256_set1_epi32(bound); \
+    __m256i span_vector = _mm256_set1_epi32((int32_t) (span ^ 0x80000000u)); \
+    size_t n = 0; \
+    size_t i = 0; \
+    for (; i + 8 <= count; i += 8) { \
+        unsigned mask = match_##predicate##_avx2(values + i, bound_vector, span_vector); \
+        __m256i lanes = _mm256_loadu_si256((const __m256i*) lane_lut[mask]); \
+        __m256i start = _mm256_set1_epi64x((long long) (base + i)); \
+        _mm256_storeu_si256((__m256i*) (out + n), \
+            _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(lanes)), start)); \
+        _mm256_storeu_si256((__m256i*) (out + n + 4), \
+            _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_extracti128_si256(lanes, 1)), start)); \
+        n += __builtin_popcount(mask); \
+    } \
+    return n + range_scalar_##predicate(values + i, count - i, bound, span, base + i, out + n); \
+} \
+\
+__attribute__((target("avx2,popcnt"))) \
+static size_t positions_avx2_##predicate(const int* values, const size_t* positions, size_t count, \
+                                         int32_t bound, uint32_t span, size_t* out) { \
+    __m256i bound_vector = _mm256_set1_epi32(bound); \
+    __m256i span_vector = _mm256_set1_epi32((int32_t) (span ^ 0x80000000u)); \
+    size_t n = 0; \
+    size_t i = 0; \
+    for (; i + 8 <= count; i += 8) { \
+        unsigned mask = match_##predicate##_avx2(values + i, bound_vector, span_vector); \
+        for (int half = 0; half < 2; half++) { \
+            unsigned half_mask = (mask >> (4 * half)) & 0xF; \
+            __m256i pairs = _mm256_loadu_si256((const __m256i*) pair_lut[half_mask]); \
+            __m256i chosen = _mm256_loadu_si256((const __m256i*) (positions + i + 4 * half)); \
+            _mm256_storeu_si256((__m256i*) (out + n), _mm256_permutevar8x32_epi32(chosen, pairs)); \
+            n += __builtin_popcount(half_mask); \
+        } \
+    } \
+    return n + positions_scalar_##predicate(values + i, positions + i, count - i, bound, span, out + n); \
+} \
+\
+__attribute__((target("avx2,popcnt"))) \
+static size_t range32_avx2_##predicate(const int* values, size_t count, int32_t bound, uint32_t span, \
+                                       uint32_t base, uint32_t* out) { \
+    __m256i bound_vector = _mm256_set1_epi32(bound); \
+    __m256i span_vector = _mm256_set1_epi32((int32_t) (span ^ 0x80000000u)); \
+    size_t n = 0; \
+    size_t i = 0; \
+    for (; i + 8 <= count; i += 8) { \
+        unsigned mask = match_##predicate##_avx2(values + i, bound_vector, span_vector); \
+        __m256i lanes = _mm256_loadu_si256((const __m256i*) lane_lut[mask]); \
+        _mm256_storeu_si256((__m256i*) (out + n), _mm256_add_epi32(lanes, _mm256_set1_epi32((int32_t) (base + i)))); \
+        n += __builtin_popcount(mask); \
+    } \
+    return n + range32_scalar_##predicate(values + i, count - i, bound, span, base + (uint32_t) i, out + n); \
+} \
+\
+__attribute__((target("avx2,popcnt"))) \
+static size_t positions32_avx2_##predicate(const int* values, const uint32_t* positions, size_t count, \
+                                           int32_t bound, uint32_t span, uint32_t* out) { \
+    __m256i bound_vector = _mm256_set1_epi32(bound); \
+    __m256i span_vector = _mm256_set1_epi32((int32_t) (span ^ 0x80000000u)); \
+    size_t n = 0; \
+    size_t i = 0; \
+    for (; i + 8 <= count; i += 8) { \
+        unsigned mask = match_##predicate##_avx2(values + i, bound_vector, span_vector); \
+        __m256i lanes = _mm256_loadu_si256((const __m256i*) lane_lut[mask]); \
+        __m256i chosen = _mm256_loadu_si256((const __m256i*) (positions + i)); \
+        _mm256_storeu_si256((__m256i*) (out + n), _mm256_permutevar8x32_epi32(chosen, lanes)); \
+        n += __builtin_popcount(mask); \
+    } \
+    return n + positions32_scalar_##predicate(values + i, positions + i, count - i, bound, span, out + n); \
+} \
+\
+__attribute__((target("avx2,popcnt"))) \
+static size_t bitmap_avx2_##predicate(const int* values, size_t count, int32_t bound, uint32_t span, \
+                                      uint64_t* words) { \
+    __m256i bound_vector = _mm256_set1_epi32(bound); \
+    __m256i span_vector = _mm256_set1_epi32((int32_t) (span ^ 0x80000000u)); \
+    size_t n = 0; \
+    size_t i = 0; \
+    for (; i + 64 <= count; i += 64) { \
+        uint64_t word = 0; \
+        for (int group = 0; group < 8; group++) { \
+            word |= (uint64_t) match_##predicate##_avx2(values + i + 8 * group, bound_vector, span_vector) \
+                << (8 * group); \
+        } \
+        words[i / 64] = word; \
+        n += __builtin_popcountll(word); \
+    } \
+    return n + bitmap_scalar_##predicate(values + i, count - i, bound, span, words + i / 64); \
+}
+
+AVX2_KERNELS(range)
+AVX2_KERNELS(equal)
+AVX2_KERNELS(at_least)
+AVX2_KERNELS(at_most)
+AVX2_KERNELS(any)
+
+// Bit i set for every one of the 16 values at values that matches
+__attribute__((target("avx512f")))
+static inline __mmask16 match_range_avx512(const int* values, __m512i bound, __m512i span) {
+    return _mm512_cmple_epu32_mask(_mm512_sub_epi32(_mm512_loadu_si512(values), bound), span);
+}
+
+__attribute__((target("avx512f")))
+static inline __mmask16 match_equal_avx512(const int* values, __m512i bound, __m512i span) {
+    (void) span;
+    return _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(values), bound);
+}
+
+__attribute__((target("avx512f")))
+static inline __mmask16 match_at_least_avx512(const int* values, __m512i bound, __m512i span) {
+    (void) span;
+    return _mm512_cmpge_epi32_mask(_mm512_loadu_si512(values), bound);
+}
+
+__attribute__((target("avx512f")))
+static inline __mmask16 match_at_most_avx512(const int* values, __m512i bound, __m512i span) {
+    (void) span;
+    return _mm512_cmple_epi32_mask(_mm512_loadu_si512(values), bound);
+}
+
+__attribute__((target("avx512f")))
+static inline __mmask16 match_any_avx512(const int* values, __m512i bound, __m512i span) {
+    (void) values;
+    (void) bound;
+    (void) span;
+    return 0xFFFF;
+}
+
+#define AVX512_KERNELS(predicate) \
+__attribute__((target("avx512f,popcnt"))) \
+static size_t range_avx512_##predicate(const int* values, size_t count, int32_t bound, uint32_t span, \
+                                       size_t base, size_t* out) { \
+    __m512i bound_vector = _mm512_set1_epi32(bound); \
+    __m512i span_vector = _mm512_set1_epi32((int32_t) span); \
+    __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); \
+    size_t n = 0; \
+    size_t i = 0; \
+    for (; i + 16 <= count; i += 16) { \
+        __mmask16 mask = match_##predicate##_avx512(values + i, bound_vector, span_vector); \
+        __m512i matching = _mm512_maskz_compress_epi32(mask, lanes); \
+        __m512i start = _mm512_set1_epi64((long long) (base + i)); \
+        _mm512_storeu_si512(out + n, \
+            _mm512_add_epi64(_mm512_cvtepu32_epi64(_mm512_castsi512_si256(matching)), start)); \
+        _mm512_storeu_si512(out + n + 8, \
+            _mm512_add_epi64(_mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(matching, 1)), start)); \
+        n += __builtin_popcount(mask); \
+    } \
+    return n + range_scalar_##predicate(values + i, count - i, bound, span, base + i, out + n); \
+} \
+\
+__attribute__((target("avx512f,popcnt"))) \
+static size_t positions_avx512_##predicate(const int* values, const size_t* positions, size_t count, \
+                                           int32_t bound, uint32_t span, size_t* out) { \
+    __m512i bound_vector = _mm512_set1_epi32(bound); \
+    __m512i span_vector = _mm512_set1_epi32((int32_t) span); \
+    size_t n = 0; \
+    size_t i = 0; \
+    for (; i + 16 <= count; i += 16) { \
+        __mmask16 mask = match_##predicate##_avx512(values + i, bound_vector, span_vector); \
+        __mmask8 low_mask = (__mmask8) mask; \
+        __mmask8 high_mask = (__mmask8) (mask >> 8); \
+        _mm512_mask_compressstoreu_epi64(out + n, low_mask, _mm512_loadu_si512(positions + i)); \
+        n += __builtin_popcount(low_mask); \
+        _mm512_mask_compressstoreu_epi64(out + n, high_mask, _mm512_loadu_si512(positions + i + 8)); \
+        n += __builtin_popcount(high_mask); \
+    } \
+    return n + positions_scalar_##predicate(values + i, positions + i, count - i, bound, span, out + n); \
+} \
+\
+__attribute__((target("avx512f,popcnt"))) \
+static size_t range32_avx512_##predicate(const int* values, size_t count, int32_t bound, uint32_t span, \
+                                         uint32_t base, uint32_t* out) { \
+    __m512i bound_vector = _mm512_set1_epi32(bound); \
+    __m512i span_vector = _mm512_set1_epi32((int32_t) span); \
+    __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); \
+    size_t n = 0; \
+    size_t i = 0; \
+    for (; i + 16 <= count; i += 16) { \
+        __mmask16 mask = match_##predicate##_avx512(values + i, bound_vector, span_vector); \
+        __m512i offsets = _mm512_add_epi32(lanes, _mm512_set1_epi32((int32_t) (base + i))); \
+        _mm512_mask_compressstoreu_epi32(out + n, mask, offsets); \
+        n += __builtin_popcount(mask); \
+    } \
+    return n + range32_scalar_##predicate(values + i, count - i, bound, span, base + (uint32_t) i, out + n); \
+} \
+\
+__attribute__((target("avx512f,popcnt"))) \
+static size_t positions32_avx512_##predicate(const int* values, const uint32_t* positions, size_t count, \
+                                             int32_t bound, uint32_t span, uint32_t* out) { \
+    __m512i bound_vector = _mm512_set1_epi32(bound); \
+    __m512i span_vector = _mm512_set1_epi32((int32_t) span); \
+    size_t n = 0; \
+    size_t i = 0; \
+    for (; i + 16 <= count; i += 16) { \
+        __mmask16 mask = match_##predicate##_avx512(values + i, bound_vector, span_vector); \
+        _mm512_mask_compressstoreu_epi32(out + n, mask, _mm512_loadu_si512(positions + i)); \
+        n += __builtin_popcount(mask); \
+    } \
+    return n + positions32_scalar_##predicate(values + i, positions + i, count - i, bound, span, out + n); \
+} \
+\
+__attribute__((target("avx512f,popcnt"))) \
+static size_t bitmap_avx512_##predicate(const int* values, size_t count, int32_t bound, uint32_t span, \
+                                        uint64_t* words) { \
+    __m512i bound_vector = _mm512_set1_epi32(bound); \
+    __m512i span_vector = _mm512_set1_epi32((int32_t) span); \
+    size_t n = 0; \
+    size_t i = 0; \
+    for (; i + 64 <= count; i += 64) { \
+        uint64_t word = 0; \
+        for (int group = 0; group < 4; group++) { \
+            word |= (uint64_t) match_##predicate##_avx512(values + i + 16 * group, bound_vector, span_vector) \
+                << (16 * group); \
+        } \
+        words[i / 64] = word; \
+        n += __builtin_popcountll(word); \
+    } \
+    return n + bitmap_scalar_##predicate(values + i, count - i, bound, span, words + i / 64); \
+}
+
+AVX512_KERNELS(range)
+AVX512_KERNELS(equal)
+AVX512_KERNELS(at_least)
+AVX512_KERNELS(at_most)
+AVX512_KERNELS(any)
+
+#endif
+
+
+// Use the kernels of an instruction set for a predicate
+#define USE_KERNELS(isa, predicate, index) \
+    kernels.range[index] = range_##isa##_##predicate; \
+    kernels.positions[index] = positions_##isa##_##predicate; \
+    kernels.range32[index] = range32_##isa##_##predicate; \
+    kernels.positions32[index] = positions32_##isa##_##predicate; \
+    kernels.bitmap[index] = bitmap_##isa##_##predicate
+
+#define USE_ALL_KERNELS(isa) \
+    USE_KERNELS(isa, range, MATCH_RANGE); \
+    USE_KERNELS(isa, equal, MATCH_EQUAL); \
+    USE_KERNELS(isa, at_least, MATCH_AT_LEAST); \
+    USE_KERNELS(isa, at_most, MATCH_AT_MOST); \
+    USE_KERNELS(isa, any, MATCH_ANY)
+
+static void pick_kernels() {
+    // Bitmap subsets have no SIMD variant
+    kernels.subset[MATCH_RANGE] = subset_scalar_range;
+    kernels.subset[MATCH_EQUAL] = subset_scalar_equal;
+    kernels.subset[MATCH_AT_LEAST] = subset_scalar_at_least;
+    kernels.subset[MATCH_AT_MOST] = subset_scalar_at_most;
+    kernels.subset[MATCH_ANY] = subset_scalar_any;
+
+    kernels.name = "scalar";
+    USE_ALL_KERNELS(scalar);
+#if X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernels.name = "avx512";
+        USE_ALL_KERNELS(avx512);
+    } else if (__builtin_cpu_supports("avx2")) {
+        build_luts();
+        kernels.name = "avx2";
+        USE_ALL_KERNELS(avx2);
+    }
+#endif
+}
+
+/*
+ * Pick the predicate matching the ints in [low, high), with its bound and
+ * span. False if no int lies in it.
+ */
+static bool pick_predicate(long int low, long int high, Predicate* predicate, int32_t* bound, uint32_t* span) {
+    if (high <= INT_MIN || low > INT_MAX) {
+        return false;
+    }
+    long int first = low > INT_MIN ? low : INT_MIN;
+    long int last = high - 1 < INT_MAX ? high - 1 : INT_MAX;
+    if (first > last) {
+        return false;
+    }
+
+    *bound = (int32_t) first;
+    *span = (uint32_t) (last - first);
+    if (first == INT_MIN && last == INT_MAX) {
+        *predicate = MATCH_ANY;
+    } else if (first == last) {
+        *predicate = MATCH_EQUAL;
+    } else if (first == INT_MIN) {
+        *predicate = MATCH_AT_MOST;
+        *bound = (int32_t) last;
+    } else if (last == INT_MAX) {
+        *predicate = MATCH_AT_LEAST;
+    } else {
+        *predicate = MATCH_RANGE;
+    }
+    pthread_once(&kernels_once, pick_kernels);
+    return true;
+}
+
+size_t select_range(const int* values, size_t count, long int low, long int high, size_t base, size_t* out) {
+    Predicate predicate;
+    int32_t bound;
+    uint32_t span;
+    if (!pick_predicate(low, high, &predicate, &bound, &span)) {
+        return 0;
+    }
+    return kernels.range[predicate](values, count, bound, span, base, out);
+}
+
+size_t select_range_positions(const int* values, const size_t* positions, size_t count,
+                              long int low, long int high, size_t* out) {
+    Predicate predicate;
+    int32_t bound;
+    uint32_t span;
+    if (!pick_predicate(low, high, &predicate, &bound, &span)) {
+        return 0;
+    }
+    return kernels.positions[predicate](values, positions, count, bound, span, out);
+}
+
+size_t select_range32(const int* values, size_t count, long int low, long int high, uint32_t base, uint32_t* out) {
+    Predicate predicate;
+    int32_t bound;
+    uint32_t span;
+    if (!pick_predicate(low, high, &predicate, &bound, &span)) {
+        return 0;
+    }
+    return kernels.range32[predicate](values, count, bound, span, base, out);
+}
+
+size_t select_range_positions32(const int* values, const uint32_t* positions, size_t count,
+                                long int low, long int high, uint32_t* out) {
+    Predicate predicate;
+    int32_t bound;
+    uint32_t span;
+    if (!pick_predicate(low, high, &predicate, &bound, &span)) {
+        return 0;
+    }
+    return kernels.positions32[predicate](values, positions, count, bound, span, out);
+}
+
+size_t select_range_bitmap(const int* values, size_t count, long int low, long int high, uint64_t* words) {
+    Predicate predicate;
+    int32_t bound;
+    uint32_t span;
+    if (!pick_predicate(low, high, &predicate, &bound, &span)) {
+        memset(words, 0, (count + 63) / 64 * sizeof(uint64_t));
+        return 0;
+    }
+    return kernels.bitmap[predicate](values, count, bound, span, words);
+}
+
+size_t select_bitmap_subset(const int* values, const uint64_t* words, size_t num_words,
+                            long int low, long int high, uint64_t* out) {
+    Predicate predicate;
+    int32_t bound;
+    uint32_t span;
+    if (!pick_predicate(low, high, &predicate, &bound, &span)) {
+        memset(out, 0, num_words * sizeof(uint64_t));
+        return 0;
+    }
+    return kernels.subset[predicate](values, words, num_words, bound, span, out);
+}
+
+const char* scan_kernel_name() {
+    pthread_once(&kernels_once, pick_kernels);
+    return kernels.name;
+}
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <sys/stat.h>
 
+#include "checkpoint.h"
 #include "common.h"
 #include "parse.h"
 #include "cs165_api.h"
@@ -42,6 +43,113 @@
  *      How will you ensure different queries invoke different execution paths in your code?
  **/
 
+/*
+ * A load the client streams as LOAD_DATA messages, read by receive_load_data().
+ */
+typedef struct LoadSource {
+    int client_socket;
+    // Bytes of the current piece still to be received
+    size_t remaining;
+    bool ended;
+} LoadSource;
+
+static bool recv_fully(int socket, void* buffer, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t bytes = recv(socket, (char*) buffer + done, size - done, 0);
+        if (bytes <= 0) {
+            return false;
+        }
+        done += bytes;
+    }
+    return true;
+}
+
+static ssize_t receive_load_data(void* context, char* buffer, size_t size) {
+    LoadSource* source = (LoadSource*) context;
+    if (source->ended) {
+        return 0;
+    }
+    if (source->remaining == 0) {
+        message piece;
+        if (!recv_fully(source->client_socket, &piece, sizeof(message)) ||
+                piece.status != LOAD_DATA || piece.length < 0) {
+            log_err("Receiving load data failed\n");
+            return -1;
+        }
+        if (piece.length == 0) {
+            source->ended = true;
+            return 0;
+        }
+        source->remaining = piece.length;
+    }
+
+    size_t bytes = source->remaining < size ? source->remaining : size;
+    if (!recv_fully(source->client_socket, buffer, bytes)) {
+        log_err("Receiving load data failed\n");
+        return -1;
+    }
+    source->remaining -= bytes;
+    return bytes;
+}
+
+/*
+ * Receives the INSERT_DATA piece that follows a binary insert and fills the
+ * insert with its rows. Returns the query, or NULL with the status set if
+ * the rows don't fit it; a query that isn't a binary insert ignores them.
+ */
+static DbOperator* receive_insert_data(int client_socket, DbOperator* query, message* send_message) {
+    message piece;
+    if (!recv_fully(client_socket, &piece, sizeof(message)) ||
+            piece.status != INSERT_DATA || piece.length < 0) {
+        log_err("Receiving insert data failed\n");
+        exit(1);
+    }
+    int* values = malloc(piece.length);
+    if (!recv_fully(client_socket, values, piece.length)) {
+        log_err("Receiving insert data failed\n");
+        exit(1);
+    }
+
+    if (query && query->type == INSERT && query->operator_fields.insert_operator.num_rows == 0 &&
+            insert_rows(&query->operator_fields.insert_operator, values, piece.length / sizeof(int)) == -1) {
+        free(query);
+        query = NULL;
+        send_message->status = INCORRECT_FORMAT;
+    }
+    free(values);
+    return query;
+}
+
+static bool send_fully(int socket, const void* buffer, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t bytes = send(socket, (const char*) buffer + done, size - done, 0);
+        if (bytes == -1) {
+            return false;
+        }
+        done += bytes;
+    }
+    return true;
+}
+
+/*
+ * Sends a piece of an export the client streams, see EXPORT_DATA. An empty
+ * piece ends the file.
+ */
+static bool send_export_piece(int client_socket, const char* buffer, size_t size) {
+    message piece;
+    piece.status = EXPORT_DATA;
+    piece.length = size;
+    piece.payload = NULL;
+    return send_fully(client_socket, &piece, sizeof(message)) && send_fully(client_socket, buffer, size);
+}
+
+static int send_export_data(void* sink, const char* buffer, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    return send_export_piece(*(int*) sink, buffer, size) ? 0 : -1;
+}
+
 /**
  * handle_client(client_socket)
  * This is the execution routine after a client has connected.
@@ -84,10 +192,41 @@ void handle_client(int client_socket, bool* shutdown_flag) {
             recv_message.payload = recv_buffer;
             recv_message.payload[recv_message.length] = '\0';
 
+            // Keep checkpoints from forking in the middle of the message
+            pthread_mutex_lock(&db_lock);
+
             // 1. Parse command
             //    Query string is converted into a request for an database operator
             DbOperator* query = parse_command(recv_message.payload, &send_message, client_socket, client_context);
 
+            // The data of a streamed load follows its query
+            LoadSource load_source = { client_socket, 0, false };
+            if (recv_message.status == LOAD_DATA) {
+                if (query && query->type == LOAD) {
+                    query->operator_fields.load_operator.reader = receive_load_data;
+                    query->operator_fields.load_operator.source = &load_source;
+                } else {
+                    char drain[BUF_SIZE];
+                    while (receive_load_data(&load_source, drain, sizeof(drain)) > 0);
+                }
+            }
+
+            // The rows of a binary insert follow its query, other inserts need rows
+            if (recv_message.status == INSERT_DATA) {
+                query = receive_insert_data(client_socket, query, &send_message);
+            }
+            if (query && query->type == INSERT && query->operator_fields.insert_operator.num_rows == 0) {
+                free(query);
+                query = NULL;
+                send_message.status = INCORRECT_FORMAT;
+            }
+
+            // The file of a streamed export goes out ahead of the response
+            if (recv_message.status == EXPORT_DATA && query && query->type == EXPORT) {
+                query->operator_fields.export_operator.writer = send_export_data;
+                query->operator_fields.export_operator.sink = &client_socket;
+            }
+
             // 2. Handle request
             //    Corresponding database operator is executed over the query
             char* response = NULL;
@@ -117,6 +256,12 @@ void handle_client(int client_socket, bool* shutdown_flag) {
                 log_err("Error parsing message\n");
             }
 
+            // End the streamed export, even if there was nothing to export
+            if (recv_message.status == EXPORT_DATA && !send_export_piece(client_socket, NULL, 0)) {
+                log_err("Server failed to send export data\n");
+                exit(1);
+            }
+
             // TODO: chunk the response if it's too big
 
             // 3. Send status of the received message (OK, UNKNOWN_QUERY, etc)
@@ -135,12 +280,12 @@ void handle_client(int client_socket, bool* shutdown_flag) {
             if (response) {
                 free(response);
             }
+            pthread_mutex_unlock(&db_lock);
         }
     } while (!done);
 
     for (int h = 0; h < client_context->chandles_in_use; h++) {
-        free(client_context->chandle_table[h].generalized_column.column_pointer.result->payload);
-        free(client_context->chandle_table[h].generalized_column.column_pointer.result);
+        free_result(client_context->chandle_table[h].generalized_column.column_pointer.result);
     }
     free(client_context->chandle_table);
     free(client_context);
@@ -0,0 +1,137 @@
+/*
+ * This file implements the column statistics described in stats.h.
+ *
+ * The reservoir sample replaces the entry at a pseudo-random position drawn
+ * from the row number, so that the same rows always give the same sample,
+ * for instance when they are appended again by log replay.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+// Room for a response of format_stats()
+#define STATS_RESPONSE_SIZE 1024
+
+
+// A 64-bit mix of a number (the splitmix64 finalizer)
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static int compare_ints(const void* first, const void* second) {
+    int a = *(const int*) first;
+    int b = *(const int*) second;
+    return (a > b) - (a < b);
+}
+
+void stats_reset(ColumnStats* stats) {
+    memset(stats, 0, sizeof(ColumnStats));
+    stats->min = INT32_MAX;
+    stats->max = INT32_MIN;
+}
+
+void stats_add(ColumnStats* stats, const int* values, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int value = values[i];
+        if (value < stats->min) {
+            stats->min = value;
+        }
+        if (value > stats->max) {
+            stats->max = value;
+        }
+
+        // The top bits pick the register, which keeps the longest run of
+        // leading zeros seen in the rest
+        uint64_t hash = mix((uint32_t) value);
+        uint64_t rest = hash << STATS_HLL_BITS;
+        uint8_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - STATS_HLL_BITS + 1;
+        uint8_t* reg = &stats->registers[hash >> (64 - STATS_HLL_BITS)];
+        if (rank > *reg) {
+            *reg = rank;
+        }
+
+        uint64_t row = stats->count++;
+        if (row < STATS_SAMPLE_SIZE) {
+            stats->sample[row] = value;
+        } else {
+            uint64_t slot = mix(row) % (row + 1);
+            if (slot < STATS_SAMPLE_SIZE) {
+                stats->sample[slot] = value;
+            }
+        }
+    }
+}
+
+uint64_t stats_distinct(const ColumnStats* stats) {
+    double m = STATS_HLL_REGISTERS;
+    double sum = 0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < STATS_HLL_REGISTERS; i++) {
+        sum += ldexp(1.0, -stats->registers[i]);
+        zeros += stats->registers[i] == 0;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+    // Few distinct values leave registers empty, count those instead
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros);
+    }
+    uint64_t distinct = (uint64_t) (estimate + 0.5);
+    return distinct < stats->count ? distinct : stats->count;
+}
+
+size_t stats_histogram(const ColumnStats* stats, int* bounds) {
+    size_t n = stats->count < STATS_SAMPLE_SIZE ? stats->count : STATS_SAMPLE_SIZE;
+    size_t buckets = n < STATS_HISTOGRAM_BUCKETS ? n : STATS_HISTOGRAM_BUCKETS;
+    if (buckets == 0) {
+        return 0;
+    }
+
+    int sorted[STATS_SAMPLE_SIZE];
+    memcpy(sorted, stats->sample, n * sizeof(int));
+    qsort(sorted, n, sizeof(int), compare_ints);
+    bounds[0] = stats->min;
+    for (size_t bucket = 1; bucket < buckets; bucket++) {
+        bounds[bucket] = sorted[bucket * n / buckets];
+    }
+    bounds[buckets] = stats->max;
+    return buckets;
+}
+
+double stats_selectivity(const ColumnStats* stats, long int low, long int high) {
+    if (stats->count == 0 || high <= stats->min || low > stats->max) {
+        return 0;
+    }
+    size_t n = stats->count < STATS_SAMPLE_SIZE ? stats->count : STATS_SAMPLE_SIZE;
+    size_t matches = 0;
+    for (size_t i = 0; i < n; i++) {
+        matches += stats->sample[i] >= low && stats->sample[i] < high;
+    }
+    return (double) matches / n;
+}
+
+char* format_stats(const ColumnStats* stats) {
+    char* response = malloc(STATS_RESPONSE_SIZE);
+    if (stats->count == 0) {
+        snprintf(response, STATS_RESPONSE_SIZE, "rows=0,distinct=0");
+        return response;
+    }
+
+    int bounds[STATS_HISTOGRAM_BUCKETS + 1];
+    size_t buckets = stats_histogram(stats, bounds);
+    int length = snprintf(response, STATS_RESPONSE_SIZE, "rows=%lu,min=%d,max=%d,distinct=%lu,histogram=",
+                          (unsigned long) stats->count, stats->min, stats->max,
+                          (unsigned long) stats_distinct(stats));
+    for (size_t i = 0; i <= buckets; i++) {
+        length += snprintf(response + length, STATS_RESPONSE_SIZE - length, i ? "|%d" : "%d", bounds[i]);
+    }
+    return response;
+}
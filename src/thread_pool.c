@@ -0,0 +1,170 @@
+/*
+ * This file implements the worker pool described in thread_pool.h.
+ *
+ * A single job is active at a time. Workers and the submitting thread claim
+ * task indexes from it under the pool lock until none are left; the last one
+ * to finish a task wakes the submitter.
+ */
+
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "thread_pool.h"
+#include "utils.h"
+
+typedef struct Job {
+    TaskFunction task;
+    void* context;
+    size_t num_tasks;
+    size_t next;
+    size_t done;
+} Job;
+
+static struct {
+    pthread_t* threads;
+    size_t num_threads;
+    bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    // Serializes submitters, the pool runs one job at a time
+    pthread_mutex_t submit;
+    Job* job;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .finished = PTHREAD_COND_INITIALIZER,
+    .submit = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Set on threads running a task, whose own submissions must not wait on the pool
+static __thread bool in_task;
+
+
+/*
+ * Runs tasks of the current job until all have been claimed. Called and
+ * returns with the pool lock held.
+ */
+static void run_tasks(Job* job) {
+    while (job->next < job->num_tasks) {
+        size_t index = job->next++;
+        pthread_mutex_unlock(&pool.lock);
+        in_task = true;
+        job->task(job->context, index);
+        in_task = false;
+        pthread_mutex_lock(&pool.lock);
+        if (++job->done == job->num_tasks) {
+            pthread_cond_broadcast(&pool.finished);
+        }
+    }
+}
+
+static void* worker_loop(void* arg) {
+    (void) arg;
+
+    pthread_mutex_lock(&pool.lock);
+    while (true) {
+        while (pool.running && (pool.job == NULL || pool.job->next == pool.job->num_tasks)) {
+            pthread_cond_wait(&pool.work, &pool.lock);
+        }
+        if (!pool.running) {
+            break;
+        }
+        run_tasks(pool.job);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+
+void thread_pool_start() {
+    if (pool.running) {
+        return;
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t num_threads = WORKER_THREADS > 0 ? WORKER_THREADS : (cores > 1 ? cores : 1);
+    // The submitting thread is one of them
+    num_threads--;
+    if (num_threads == 0) {
+        return;
+    }
+
+    pool.threads = malloc(num_threads * sizeof(pthread_t));
+    pool.running = true;
+    for (pool.num_threads = 0; pool.num_threads < num_threads; pool.num_threads++) {
+        if (pthread_create(&pool.threads[pool.num_threads], NULL, worker_loop, NULL) != 0) {
+            log_err("Starting worker thread failed\n");
+            break;
+        }
+    }
+}
+
+void thread_pool_stop() {
+    if (!pool.running) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.running = false;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+    for (size_t i = 0; i < pool.num_threads; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    free(pool.threads);
+    pool.threads = NULL;
+    pool.num_threads = 0;
+}
+
+void thread_pool_forget() {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_t submit = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+    pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+
+    // Any of these may have been held by a thread that didn't survive the fork
+    pool.lock = lock;
+    pool.submit = submit;
+    pool.work = work;
+    pool.finished = finished;
+    pool.running = false;
+    pool.num_threads = 0;
+    pool.job = NULL;
+}
+
+size_t thread_pool_size() {
+    return pool.num_threads + 1;
+}
+
+
+void parallel_for(size_t num_tasks, TaskFunction task, void* context) {
+    if (!pool.running || in_task || num_tasks <= 1) {
+        for (size_t i = 0; i < num_tasks; i++) {
+            task(context, i);
+        }
+        return;
+    }
+
+    Job job = {
+        .task = task,
+        .context = context,
+        .num_tasks = num_tasks,
+        .next = 0,
+        .done = 0,
+    };
+
+    pthread_mutex_lock(&pool.submit);
+    pthread_mutex_lock(&pool.lock);
+    pool.job = &job;
+    pthread_cond_broadcast(&pool.work);
+    run_tasks(&job);
+    while (job.done < job.num_tasks) {
+        pthread_cond_wait(&pool.finished, &pool.lock);
+    }
+    pool.job = NULL;
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.submit);
+}
@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "utils.h"
 
 #define ANSI_COLOR_RED     "\x1b[31m"
@@ -81,6 +82,34 @@ char* trim_quotes(char *str) {
     str[current] = '\0';
     return str;
 }
+
+static uint32_t crc32_table[256];
+static pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+static void build_crc32_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc32_table[i] = c;
+    }
+}
+
+/* computes the standard (IEEE 802.3) CRC-32 of a buffer.
+ * The lookup table is built once, by the first caller.
+ */
+uint32_t crc32(const void* buf, size_t len, uint32_t crc) {
+    pthread_once(&crc32_table_once, build_crc32_table);
+
+    const unsigned char* bytes = buf;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc32_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
 /* The following three functions will show output on the terminal
  * based off whether the corresponding level is defined.
  * To see log output, define LOG.
@@ -0,0 +1,653 @@
+/*
+ * This file implements the write-ahead log described in wal.h.
+ *
+ * Appenders serialize records into an in-memory buffer while holding the log
+ * lock. The flusher thread swaps that buffer with a spare one, writes it out
+ * and issues a single fdatasync for every record it contained, then publishes
+ * the new durable lsn to anyone waiting in wal_wait().
+ */
+
+#define _DEFAULT_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cs165_api.h"
+#include "utils.h"
+#include "wal.h"
+
+typedef struct WalCreateTable {
+    char name[MAX_SIZE_NAME];
+    uint64_t col_count;
+} WalCreateTable;
+
+typedef struct WalCreateColumn {
+    char table[MAX_SIZE_NAME];
+    char name[MAX_SIZE_NAME];
+} WalCreateColumn;
+
+typedef struct WalCreateIndex {
+    char table[MAX_SIZE_NAME];
+    char column[MAX_SIZE_NAME];
+    uint32_t type;
+    uint32_t flags;
+} WalCreateIndex;
+
+// Followed by num_columns arrays of num_rows ints, one per column
+typedef struct WalAppend {
+    char table[MAX_SIZE_NAME];
+    uint64_t num_rows;
+    uint64_t num_columns;
+} WalAppend;
+
+static struct {
+    int fd;
+    uint32_t segment;
+    bool running;
+    bool flush_requested;
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t flushed;
+    char* buffer;
+    size_t used;
+    size_t capacity;
+    char* spare;
+    size_t spare_capacity;
+    size_t record_offset;
+    uint64_t last_lsn;
+    uint64_t durable_lsn;
+    // Size of the current segment up to the last durable record
+    off_t durable_offset;
+    // Set once a group failed to reach disk, later ones are dropped as they
+    // would follow a hole in the log
+    bool failed;
+} wal = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .flushed = PTHREAD_COND_INITIALIZER,
+};
+
+
+static void segment_path(char* path, uint32_t segment) {
+    sprintf(path, "%s/" WAL_SEGMENT_FORMAT, MAINDIR, segment);
+}
+
+static int compare_segments(const void* a, const void* b) {
+    uint32_t left = *(const uint32_t*) a;
+    uint32_t right = *(const uint32_t*) b;
+    return (left > right) - (left < right);
+}
+
+/*
+ * Collects the numbers of the log segments on disk in ascending order.
+ * The returned array must be released with free().
+ */
+static size_t list_segments(uint32_t** segments) {
+    size_t count = 0;
+    size_t capacity = 8;
+    *segments = malloc(capacity * sizeof(uint32_t));
+
+    DIR* dir = opendir(MAINDIR);
+    if (!dir) {
+        return 0;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned int segment;
+        int consumed = 0;
+        if (sscanf(entry->d_name, "wal.%u.log%n", &segment, &consumed) != 1 ||
+            consumed == 0 || entry->d_name[consumed] != '\0') {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *segments = realloc(*segments, capacity * sizeof(uint32_t));
+        }
+        (*segments)[count++] = segment;
+    }
+    closedir(dir);
+
+    qsort(*segments, count, sizeof(uint32_t), compare_segments);
+    return count;
+}
+
+static void sync_directory() {
+    int dir_fd = open(MAINDIR, O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+static uint32_t record_checksum(const WalRecordHeader* header, const void* payload) {
+    uint32_t crc = crc32(&header->type, sizeof(WalRecordHeader) - sizeof(header->checksum), 0);
+    return crc32(payload, header->length, crc);
+}
+
+static Table* find_table(const char* name) {
+    if (!current_db) {
+        return NULL;
+    }
+    for (size_t i = 0; i < current_db->tables_size; i++) {
+        if (strcmp(current_db->tables[i]->name, name) == 0) {
+            return current_db->tables[i];
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Reserves room for a record in the log buffer and returns a pointer to its
+ * payload. The log lock is held until the matching end_record() call.
+ */
+static char* begin_record(WalRecordType type, size_t length) {
+    pthread_mutex_lock(&wal.lock);
+
+    // Apply back pressure when the flusher can't keep up with the appenders
+    while (wal.running && wal.used > 4 * WAL_BUFFER_SIZE) {
+        wal.flush_requested = true;
+        pthread_cond_signal(&wal.work);
+        pthread_cond_wait(&wal.flushed, &wal.lock);
+    }
+
+    size_t needed = wal.used + sizeof(WalRecordHeader) + length;
+    if (needed > wal.capacity) {
+        size_t new_capacity = wal.capacity * 2;
+        if (new_capacity < needed) {
+            new_capacity = needed;
+        }
+        wal.buffer = realloc(wal.buffer, new_capacity);
+        wal.capacity = new_capacity;
+    }
+
+    WalRecordHeader* header = (WalRecordHeader*) (wal.buffer + wal.used);
+    header->type = type;
+    header->length = length;
+    header->reserved = 0;
+    wal.record_offset = wal.used;
+    return wal.buffer + wal.used + sizeof(WalRecordHeader);
+}
+
+/*
+ * Seals the record started by begin_record() and releases the log lock.
+ */
+static uint64_t end_record() {
+    WalRecordHeader* header = (WalRecordHeader*) (wal.buffer + wal.record_offset);
+    header->lsn = ++wal.last_lsn;
+    header->checksum = record_checksum(header, header + 1);
+    wal.used = wal.record_offset + sizeof(WalRecordHeader) + header->length;
+
+    uint64_t lsn = wal.last_lsn;
+    if (wal.used >= WAL_BUFFER_SIZE) {
+        pthread_cond_signal(&wal.work);
+    }
+    pthread_mutex_unlock(&wal.lock);
+    return lsn;
+}
+
+static int write_fully(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/*
+ * Background thread committing the buffered records in groups.
+ */
+static void* flush_loop(void* arg) {
+    (void) arg;
+
+    pthread_mutex_lock(&wal.lock);
+    while (true) {
+        if (wal.running && !wal.flush_requested && wal.used < WAL_BUFFER_SIZE) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += WAL_FLUSH_INTERVAL_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&wal.work, &wal.lock, &deadline);
+        }
+        wal.flush_requested = false;
+
+        if (wal.used == 0) {
+            if (!wal.running) {
+                break;
+            }
+            continue;
+        }
+
+        // Swap in the spare buffer so that appenders can keep going
+        char* group = wal.buffer;
+        size_t group_size = wal.used;
+        size_t group_capacity = wal.capacity;
+        uint64_t group_lsn = wal.last_lsn;
+        wal.buffer = wal.spare;
+        wal.capacity = wal.spare_capacity;
+        wal.used = 0;
+        pthread_mutex_unlock(&wal.lock);
+
+        bool written = !wal.failed && write_fully(wal.fd, group, group_size) == 0 && fdatasync(wal.fd) == 0;
+        if (!written && !wal.failed) {
+            log_err("Writing to the log failed\n");
+            // Cut off the torn group, replay stops at the first bad record
+            if (ftruncate(wal.fd, wal.durable_offset) == -1) {
+                log_err("Truncating log failed\n");
+            }
+        }
+
+        pthread_mutex_lock(&wal.lock);
+        wal.spare = group;
+        wal.spare_capacity = group_capacity;
+        if (written) {
+            wal.durable_lsn = group_lsn;
+            wal.durable_offset += group_size;
+        } else {
+            wal.failed = true;
+        }
+        pthread_cond_broadcast(&wal.flushed);
+    }
+    pthread_mutex_unlock(&wal.lock);
+    return NULL;
+}
+
+
+/*
+ * Applies a single log record to the current database.
+ */
+static Status apply_record(const WalRecordHeader* header, const char* payload) {
+    Status ret_status;
+    ret_status.code = OK;
+
+    if (header->type == WAL_CREATE_DB) {
+        char name[MAX_SIZE_NAME];
+        memcpy(name, payload, MAX_SIZE_NAME);
+        ret_status = create_db(name);
+    } else if (header->type == WAL_CREATE_TABLE) {
+        const WalCreateTable* record = (const WalCreateTable*) payload;
+        if (current_db == NULL) {
+            ret_status.code = ERROR;
+            return ret_status;
+        }
+        create_table(current_db, record->name, record->col_count, &ret_status);
+    } else if (header->type == WAL_CREATE_COLUMN) {
+        WalCreateColumn record;
+        memcpy(&record, payload, sizeof(record));
+        Table* table = find_table(record.table);
+        if (table == NULL) {
+            ret_status.code = ERROR;
+            return ret_status;
+        }
+        create_column(table, record.name, 0, &ret_status);
+    } else if (header->type == WAL_CREATE_INDEX) {
+        WalCreateIndex record;
+        memcpy(&record, payload, sizeof(record));
+        Table* table = find_table(record.table);
+        Column* column = NULL;
+        for (size_t col = 0; table != NULL && col < table->col_count; col++) {
+            if (table->columns[col] && strcmp(table->columns[col]->name, record.column) == 0) {
+                column = table->columns[col];
+            }
+        }
+        if (column == NULL) {
+            ret_status.code = ERROR;
+            return ret_status;
+        }
+        ret_status = create_index(table, column, record.type, record.flags);
+    } else if (header->type == WAL_APPEND) {
+        const WalAppend* record = (const WalAppend*) payload;
+        const int* data = (const int*) (record + 1);
+        Table* table = find_table(record->table);
+        if (table == NULL || table->col_count != record->num_columns) {
+            ret_status.code = ERROR;
+            return ret_status;
+        }
+        // The record is column-major, so it appends as it is
+        const int* values[table->col_count + 1];
+        for (size_t col = 0; col < table->col_count; col++) {
+            values[col] = data + col * record->num_rows;
+        }
+        ret_status = append_rows(table, values, record->num_rows);
+    } else {
+        ret_status.code = ERROR;
+    }
+
+    return ret_status;
+}
+
+
+/*
+ * Replays one log segment. Returns false if the segment ends in a torn
+ * record, which is cut off so that new records follow valid ones.
+ */
+static bool replay_segment(uint32_t segment, uint64_t checkpoint_lsn, uint64_t* last_lsn,
+                           size_t* replayed) {
+    char path[strlen(MAINDIR) + sizeof(WAL_SEGMENT_FORMAT) + 16];
+    segment_path(path, segment);
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        log_err("Opening log segment %s failed\n", path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    char* log = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (log == MAP_FAILED) {
+        close(fd);
+        log_err("Mmapping log failed\n");
+        return false;
+    }
+    madvise(log, st.st_size, MADV_SEQUENTIAL);
+
+    size_t offset = 0;
+    size_t size = st.st_size;
+    while (offset + sizeof(WalRecordHeader) <= size) {
+        const WalRecordHeader* header = (const WalRecordHeader*) (log + offset);
+        const char* payload = (const char*) (header + 1);
+        if (header->length > size - offset - sizeof(WalRecordHeader) ||
+            record_checksum(header, payload) != header->checksum) {
+            break;
+        }
+
+        if (header->lsn > checkpoint_lsn) {
+            if (apply_record(header, payload).code != OK) {
+                log_err("Replaying log record %lu failed\n", (unsigned long) header->lsn);
+            }
+            (*replayed)++;
+        }
+        if (header->lsn > *last_lsn) {
+            *last_lsn = header->lsn;
+        }
+        offset += sizeof(WalRecordHeader) + header->length;
+    }
+    munmap(log, st.st_size);
+
+    if (offset < size) {
+        log_info("Discarding %zu bytes of incomplete log records\n", size - offset);
+        if (ftruncate(fd, offset) == -1) {
+            log_err("Truncating log failed\n");
+        }
+    }
+    close(fd);
+    return offset == size;
+}
+
+Status wal_replay(uint64_t checkpoint_lsn, uint64_t* last_lsn) {
+    Status ret_status;
+    ret_status.code = OK;
+    *last_lsn = checkpoint_lsn;
+
+    uint32_t* segments;
+    size_t num_segments = list_segments(&segments);
+    size_t replayed = 0;
+    for (size_t i = 0; i < num_segments; i++) {
+        if (!replay_segment(segments[i], checkpoint_lsn, last_lsn, &replayed) &&
+            i + 1 < num_segments) {
+            // Later segments would apply on top of missing records
+            log_err("Log segment %u is damaged, ignoring %zu later segments\n",
+                    segments[i], num_segments - i - 1);
+            break;
+        }
+    }
+    free(segments);
+
+    log_info("Replayed %zu log records\n", replayed);
+    return ret_status;
+}
+
+
+Status wal_open(uint64_t last_lsn) {
+    Status ret_status;
+    ret_status.code = OK;
+    wal.last_lsn = wal.durable_lsn = last_lsn;
+    if (!WAL_ENABLED) {
+        return ret_status;
+    }
+
+    struct stat st;
+    if (stat(MAINDIR, &st) == -1) {
+        mkdir(MAINDIR, 0777);
+    }
+
+    // Keep appending to the newest segment
+    uint32_t* segments;
+    size_t num_segments = list_segments(&segments);
+    wal.segment = num_segments > 0 ? segments[num_segments - 1] : 1;
+    free(segments);
+
+    char path[strlen(MAINDIR) + sizeof(WAL_SEGMENT_FORMAT) + 16];
+    segment_path(path, wal.segment);
+    wal.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (wal.fd < 0 || fstat(wal.fd, &st) == -1) {
+        log_err("Opening log failed\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+    wal.durable_offset = st.st_size;
+    wal.failed = false;
+
+    wal.capacity = wal.spare_capacity = WAL_BUFFER_SIZE;
+    wal.buffer = malloc(wal.capacity);
+    wal.spare = malloc(wal.spare_capacity);
+    wal.used = 0;
+    wal.running = true;
+    wal.flush_requested = false;
+
+    if (pthread_create(&wal.flusher, NULL, flush_loop, NULL) != 0) {
+        log_err("Starting log flusher failed\n");
+        close(wal.fd);
+        wal.fd = -1;
+        ret_status.code = ERROR;
+    }
+    return ret_status;
+}
+
+
+Status wal_close(bool truncate) {
+    Status ret_status;
+    ret_status.code = OK;
+    if (wal.fd < 0) {
+        return ret_status;
+    }
+
+    pthread_mutex_lock(&wal.lock);
+    wal.running = false;
+    pthread_cond_signal(&wal.work);
+    pthread_mutex_unlock(&wal.lock);
+    pthread_join(wal.flusher, NULL);
+
+    if (truncate) {
+        wal_drop_segments(wal.segment);
+        if (ftruncate(wal.fd, 0) == -1 || fsync(wal.fd) == -1) {
+            log_err("Truncating log failed\n");
+            ret_status.code = ERROR;
+        }
+    }
+
+    close(wal.fd);
+    wal.fd = -1;
+    free(wal.buffer);
+    free(wal.spare);
+    wal.buffer = wal.spare = NULL;
+    return ret_status;
+}
+
+
+Status wal_rotate(uint32_t* segment) {
+    Status ret_status;
+    ret_status.code = OK;
+    *segment = 0;
+    if (wal.fd < 0) {
+        return ret_status;
+    }
+
+    pthread_mutex_lock(&wal.lock);
+    // Everything appended so far belongs to the current segment
+    while (wal.running && !wal.failed && wal.durable_lsn < wal.last_lsn) {
+        wal.flush_requested = true;
+        pthread_cond_signal(&wal.work);
+        pthread_cond_wait(&wal.flushed, &wal.lock);
+    }
+    if (wal.failed) {
+        pthread_mutex_unlock(&wal.lock);
+        log_err("Log is damaged, not starting a new segment\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+
+    char path[strlen(MAINDIR) + sizeof(WAL_SEGMENT_FORMAT) + 16];
+    segment_path(path, wal.segment + 1);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (fd < 0) {
+        pthread_mutex_unlock(&wal.lock);
+        log_err("Creating log segment failed\n");
+        ret_status.code = ERROR;
+        return ret_status;
+    }
+    sync_directory();
+
+    // The flusher is idle, it only touches the descriptor with a group to write
+    close(wal.fd);
+    wal.fd = fd;
+    wal.durable_offset = 0;
+    *segment = ++wal.segment;
+    pthread_mutex_unlock(&wal.lock);
+    return ret_status;
+}
+
+void wal_drop_segments(uint32_t segment) {
+    uint32_t* segments;
+    size_t num_segments = list_segments(&segments);
+    for (size_t i = 0; i < num_segments && segments[i] < segment; i++) {
+        char path[strlen(MAINDIR) + sizeof(WAL_SEGMENT_FORMAT) + 16];
+        segment_path(path, segments[i]);
+        if (unlink(path) == -1) {
+            log_err("Removing log segment %s failed\n", path);
+        }
+    }
+    free(segments);
+}
+
+
+uint64_t wal_log_create_db(const char* db_name) {
+    if (wal.fd < 0) {
+        return 0;
+    }
+    char* payload = begin_record(WAL_CREATE_DB, MAX_SIZE_NAME);
+    memset(payload, 0, MAX_SIZE_NAME);
+    copy_name(payload, db_name);
+    return end_record();
+}
+
+uint64_t wal_log_create_table(const char* table_name, size_t col_count) {
+    if (wal.fd < 0) {
+        return 0;
+    }
+    WalCreateTable record;
+    memset(&record, 0, sizeof(record));
+    copy_name(record.name, table_name);
+    record.col_count = col_count;
+
+    char* payload = begin_record(WAL_CREATE_TABLE, sizeof(record));
+    memcpy(payload, &record, sizeof(record));
+    return end_record();
+}
+
+uint64_t wal_log_create_column(const char* table_name, const char* column_name) {
+    if (wal.fd < 0) {
+        return 0;
+    }
+    WalCreateColumn record;
+    memset(&record, 0, sizeof(record));
+    copy_name(record.table, table_name);
+    copy_name(record.name, column_name);
+
+    char* payload = begin_record(WAL_CREATE_COLUMN, sizeof(record));
+    memcpy(payload, &record, sizeof(record));
+    return end_record();
+}
+
+uint64_t wal_log_create_index(const char* table_name, const char* column_name, uint32_t type, uint32_t flags) {
+    if (wal.fd < 0) {
+        return 0;
+    }
+    WalCreateIndex record;
+    memset(&record, 0, sizeof(record));
+    copy_name(record.table, table_name);
+    copy_name(record.column, column_name);
+    record.type = type;
+    record.flags = flags;
+
+    char* payload = begin_record(WAL_CREATE_INDEX, sizeof(record));
+    memcpy(payload, &record, sizeof(record));
+    return end_record();
+}
+
+uint64_t wal_log_append(Table* table, size_t first_row, size_t num_rows) {
+    uint64_t lsn = 0;
+    if (wal.fd < 0) {
+        return lsn;
+    }
+
+    // Large appends are split so that no single record grows unbounded
+    for (size_t done = 0; done < num_rows; done += WAL_APPEND_CHUNK) {
+        size_t rows = num_rows - done < WAL_APPEND_CHUNK ? num_rows - done : WAL_APPEND_CHUNK;
+
+        WalAppend record;
+        memset(&record, 0, sizeof(record));
+        copy_name(record.table, table->name);
+        record.num_rows = rows;
+        record.num_columns = table->col_count;
+
+        char* payload = begin_record(WAL_APPEND, sizeof(record) + table->col_count * rows * sizeof(int));
+        memcpy(payload, &record, sizeof(record));
+        int* data = (int*) (payload + sizeof(record));
+        for (size_t col = 0; col < table->col_count; col++) {
+            read_column(table->columns[col], first_row + done, rows, data + col * rows);
+        }
+        lsn = end_record();
+    }
+    return lsn;
+}
+
+
+Status wal_wait(uint64_t lsn) {
+    Status ret_status;
+    pthread_mutex_lock(&wal.lock);
+    while (wal.running && !wal.failed && wal.durable_lsn < lsn) {
+        wal.flush_requested = true;
+        pthread_cond_signal(&wal.work);
+        pthread_cond_wait(&wal.flushed, &wal.lock);
+    }
+    ret_status.code = wal.durable_lsn >= lsn ? OK : ERROR;
+    pthread_mutex_unlock(&wal.lock);
+    return ret_status;
+}
+
+uint64_t wal_last_lsn() {
+    pthread_mutex_lock(&wal.lock);
+    uint64_t lsn = wal.last_lsn;
+    pthread_mutex_unlock(&wal.lock);
+    return lsn;
+}
@@ -0,0 +1,106 @@
+/*
+ * This file implements the column warmer described in warmer.h.
+ *
+ * The warmer works in rounds. Each round takes db_lock, picks the most used
+ * columns still on disk, one per worker, and loads them in parallel. A query
+ * thus waits for at most one round before it gets the lock.
+ */
+
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <stdbool.h>
+#include "checkpoint.h"
+#include "cs165_api.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include "warmer.h"
+
+typedef struct WarmTask {
+    Table* table;
+    Column* column;
+    Status status;
+} WarmTask;
+
+static struct {
+    bool running;
+    pthread_t thread;
+} warmer;
+
+
+/*
+ * Fills tasks with up to max of the columns still on disk that saw use,
+ * most used first, and returns how many it found.
+ */
+static size_t hottest_columns(WarmTask* tasks, size_t max) {
+    size_t num_tasks = 0;
+    for (size_t tbl = 0; tbl < current_db->tables_size; tbl++) {
+        Table* table = current_db->tables[tbl];
+        for (size_t col = 0; col < table->col_count; col++) {
+            Column* column = table->columns[col];
+            if (column->catalog_entry == NULL || column->accesses == 0) {
+                continue;
+            }
+
+            // Insert it in order, dropping the least used column if full
+            size_t i = num_tasks < max ? num_tasks++ : max;
+            for (; i > 0 && tasks[i - 1].column->accesses < column->accesses; i--) {
+                if (i < max) {
+                    tasks[i] = tasks[i - 1];
+                }
+            }
+            if (i < max) {
+                tasks[i].table = table;
+                tasks[i].column = column;
+            }
+        }
+    }
+    return num_tasks;
+}
+
+static void warm_task(void* context, size_t index) {
+    WarmTask* task = (WarmTask*) context + index;
+    task->status = load_column(task->table, task->column);
+}
+
+static void* warmer_loop(void* arg) {
+    (void) arg;
+
+    size_t max = thread_pool_size();
+    WarmTask tasks[max];
+    while (__atomic_load_n(&warmer.running, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&db_lock);
+        size_t num_tasks = current_db ? hottest_columns(tasks, max) : 0;
+        parallel_for(num_tasks, warm_task, tasks);
+        pthread_mutex_unlock(&db_lock);
+
+        // A column that fails to load is left for its first query to report
+        bool failed = false;
+        for (size_t i = 0; i < num_tasks; i++) {
+            failed |= tasks[i].status.code != OK;
+        }
+        if (num_tasks == 0 || failed) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+void warmer_start() {
+    if (!COLUMN_WARMER || warmer.running) {
+        return;
+    }
+    warmer.running = true;
+    if (pthread_create(&warmer.thread, NULL, warmer_loop, NULL) != 0) {
+        log_err("Starting warmer thread failed\n");
+        warmer.running = false;
+    }
+}
+
+void warmer_stop() {
+    if (!warmer.running) {
+        return;
+    }
+    __atomic_store_n(&warmer.running, false, __ATOMIC_RELAXED);
+    pthread_join(warmer.thread, NULL);
+}